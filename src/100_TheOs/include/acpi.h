@@ -0,0 +1,42 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+// Root System Description Pointer, the fields after rsdt_address only
+// exist from ACPI 2.0 (revision >= 2)
+typedef struct {
+    char signature[8];        // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+// Header shared by every system description table
+typedef struct {
+    char signature[4];
+    uint32_t length;          // Including this header
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// Keep a copy of the RSDP handed over by the bootloader (multiboot2
+// ACPI tags). Called before the heap wipes the multiboot information.
+void acpi_set_rsdp(const void* rsdp, uint32_t size);
+
+// Find a table by its signature, e.g. "APIC" for the MADT. The table is
+// mapped and its checksum verified. Needs paging to be set up.
+const acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+#endif // ACPI_H
@@ -0,0 +1,92 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Local APIC registers, byte offsets from the MMIO base
+#define LAPIC_ID         0x020
+#define LAPIC_VERSION    0x030
+#define LAPIC_TPR        0x080
+#define LAPIC_EOI        0x0B0
+#define LAPIC_SVR        0x0F0
+#define LAPIC_ICR_LOW    0x300
+#define LAPIC_ICR_HIGH   0x310
+#define LAPIC_LVT_TIMER  0x320
+#define LAPIC_LVT_LINT0  0x350
+#define LAPIC_LVT_LINT1  0x360
+#define LAPIC_LVT_ERROR  0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR  0x390
+#define LAPIC_TIMER_DIV  0x3E0
+
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+
+// Vector for spurious local APIC interrupts, these must not get an EOI
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// Local APIC timer. Above the IRQ vectors, so device interrupts cannot
+// hold it off.
+#define APIC_TIMER_VECTOR 0xEF
+#define LAPIC_TIMER_DIV_16 0x3
+
+// Limits for what the MADT can describe
+#define APIC_MAX_CPUS    16
+#define APIC_MAX_IOAPICS 4
+
+// True once interrupts are delivered through the I/O APIC
+extern bool apic_enabled;
+extern volatile uint32_t* lapic_base;
+
+// APIC IDs of the processors listed in the MADT, the boot CPU included
+extern uint8_t apic_cpu_ids[APIC_MAX_CPUS];
+extern int apic_cpu_count;
+
+// Find the APICs in the ACPI MADT, enable the local APIC and route the
+// ISA IRQs (all masked) through the I/O APIC to vectors 32-47. Returns
+// false when there is no usable APIC, the 8259 PIC stays in charge then.
+bool apic_init(void);
+
+// Enable the calling application processor's local APIC, same settings
+// as the boot CPU's
+void apic_init_ap(void);
+
+// Mask or unmask an ISA IRQ at the I/O APIC
+void apic_set_irq_mask(uint8_t irq, bool masked);
+
+// I/O APIC input an ISA IRQ arrives on, false if it has none
+bool apic_irq_gsi(uint8_t irq, uint32_t* gsi);
+
+void apic_print_info(void);
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic_base[reg / 4] = value;
+}
+
+static inline uint8_t lapic_id(void)
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// End of interrupt is a single MMIO write, no port I/O
+static inline void apic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APIC_H
@@ -0,0 +1,252 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+// Atomic operations and memory barriers for 32-bit values.
+//
+// The kernel is built with -march=i386, where GCC turns the __atomic and
+// __sync builtins it cannot inline (cmpxchg and xadd are i486
+// instructions) into calls to libatomic, which a freestanding kernel does
+// not have. Everything here is inline assembly instead. The names follow
+// C11 <stdatomic.h>; C++ code gets an atomic<T> with the C++20
+// std::atomic members at the end.
+//
+// x86 keeps loads ordered with loads and stores with stores, and a
+// locked instruction is a full barrier. So acquire loads and release
+// stores only have to stop the compiler, and only seq_cst stores and
+// fences cost anything.
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    memory_order_relaxed,
+    memory_order_consume,
+    memory_order_acquire,
+    memory_order_release,
+    memory_order_acq_rel,
+    memory_order_seq_cst,
+} memory_order;
+
+// Compiler-only barrier: no memory access moves across it
+#define barrier() asm volatile("" : : : "memory")
+
+// Processor barriers. A locked add to the stack is as strong as mfence
+// and exists on every CPU, mfence needs SSE2.
+#define smp_mb()  asm volatile("lock; addl $0, (%%esp)" : : : "memory", "cc")
+#define smp_rmb() barrier()
+#define smp_wmb() barrier()
+
+// Spin-wait hint, also lets a hyperthread sibling run
+static inline void cpu_relax(void)
+{
+    asm volatile("pause" : : : "memory");
+}
+
+static inline void atomic_thread_fence(memory_order order)
+{
+    if (order == memory_order_seq_cst) {
+        smp_mb();
+    } else if (order != memory_order_relaxed) {
+        barrier();
+    }
+}
+
+// Ordering against an interrupt handler on the same CPU
+static inline void atomic_signal_fence(memory_order order)
+{
+    (void)order;
+    barrier();
+}
+
+static inline uint32_t atomic_load_explicit(const volatile uint32_t* p, memory_order order)
+{
+    uint32_t value = *p;
+    if (order != memory_order_relaxed) barrier();
+    return value;
+}
+
+static inline uint32_t atomic_load(const volatile uint32_t* p)
+{
+    return atomic_load_explicit(p, memory_order_seq_cst);
+}
+
+static inline uint32_t atomic_exchange(volatile uint32_t* p, uint32_t value)
+{
+    // xchg with memory is always locked
+    asm volatile("xchgl %0, %1" : "+r" (value), "+m" (*p) : : "memory");
+    return value;
+}
+
+static inline void atomic_store_explicit(volatile uint32_t* p, uint32_t value, memory_order order)
+{
+    if (order == memory_order_seq_cst) {
+        atomic_exchange(p, value);
+    } else {
+        if (order != memory_order_relaxed) barrier();
+        *p = value;
+    }
+}
+
+static inline void atomic_store(volatile uint32_t* p, uint32_t value)
+{
+    atomic_store_explicit(p, value, memory_order_seq_cst);
+}
+
+// On failure *expected gets the value that was there
+static inline bool atomic_compare_exchange_strong(volatile uint32_t* p, uint32_t* expected,
+                                                  uint32_t desired)
+{
+    uint32_t prev = *expected;
+    bool ok;
+    asm volatile("lock; cmpxchgl %3, %1; sete %0"
+                 : "=q" (ok), "+m" (*p), "+a" (prev) : "r" (desired) : "memory", "cc");
+    *expected = prev;
+    return ok;
+}
+
+// cmpxchg does not fail spuriously, weak is the same as strong
+static inline bool atomic_compare_exchange_weak(volatile uint32_t* p, uint32_t* expected,
+                                                uint32_t desired)
+{
+    return atomic_compare_exchange_strong(p, expected, desired);
+}
+
+// The value before the operation
+static inline uint32_t atomic_fetch_add(volatile uint32_t* p, uint32_t value)
+{
+    asm volatile("lock; xaddl %0, %1" : "+r" (value), "+m" (*p) : : "memory", "cc");
+    return value;
+}
+
+static inline uint32_t atomic_fetch_sub(volatile uint32_t* p, uint32_t value)
+{
+    return atomic_fetch_add(p, -value);
+}
+
+static inline uint32_t atomic_fetch_or(volatile uint32_t* p, uint32_t value)
+{
+    uint32_t old = *p;
+    while (!atomic_compare_exchange_weak(p, &old, old | value)) {
+    }
+    return old;
+}
+
+static inline uint32_t atomic_fetch_and(volatile uint32_t* p, uint32_t value)
+{
+    uint32_t old = *p;
+    while (!atomic_compare_exchange_weak(p, &old, old & value)) {
+    }
+    return old;
+}
+
+// No result needed: cheaper than fetch_add
+static inline void atomic_inc(volatile uint32_t* p)
+{
+    asm volatile("lock; incl %0" : "+m" (*p) : : "memory", "cc");
+}
+
+// True when the value reached zero
+static inline bool atomic_dec_and_test(volatile uint32_t* p)
+{
+    bool zero;
+    asm volatile("lock; decl %0; sete %1" : "+m" (*p), "=q" (zero) : : "memory", "cc");
+    return zero;
+}
+
+#ifdef __cplusplus
+}
+
+// std::atomic for 32-bit integers and pointers. wait() spins: there is
+// nothing to sleep on here, blocking waits are a scheduler matter.
+template <typename T>
+class atomic {
+    static_assert(sizeof(T) == 4, "atomic<T> supports 32-bit types");
+
+public:
+    atomic() = default;
+    atomic(T value) : value_(to_raw(value)) {}
+    atomic(const atomic&) = delete;
+    atomic& operator=(const atomic&) = delete;
+
+    T load(memory_order order = memory_order_seq_cst) const
+    {
+        return from_raw(atomic_load_explicit(&value_, order));
+    }
+    void store(T value, memory_order order = memory_order_seq_cst)
+    {
+        atomic_store_explicit(&value_, to_raw(value), order);
+    }
+    T exchange(T value, memory_order = memory_order_seq_cst)
+    {
+        return from_raw(atomic_exchange(&value_, to_raw(value)));
+    }
+    bool compare_exchange_strong(T& expected, T desired, memory_order = memory_order_seq_cst)
+    {
+        uint32_t raw = to_raw(expected);
+        bool ok = atomic_compare_exchange_strong(&value_, &raw, to_raw(desired));
+        expected = from_raw(raw);
+        return ok;
+    }
+    bool compare_exchange_weak(T& expected, T desired, memory_order order = memory_order_seq_cst)
+    {
+        return compare_exchange_strong(expected, desired, order);
+    }
+    T fetch_add(uint32_t n, memory_order = memory_order_seq_cst)
+    {
+        return from_raw(atomic_fetch_add(&value_, n));
+    }
+    T fetch_sub(uint32_t n, memory_order = memory_order_seq_cst)
+    {
+        return from_raw(atomic_fetch_sub(&value_, n));
+    }
+
+    operator T() const { return load(); }
+    T operator=(T value) { store(value); return value; }
+    T operator++() { return from_raw(atomic_fetch_add(&value_, 1) + 1); }
+    T operator++(int) { return from_raw(atomic_fetch_add(&value_, 1)); }
+    T operator--() { return from_raw(atomic_fetch_sub(&value_, 1) - 1); }
+    T operator--(int) { return from_raw(atomic_fetch_sub(&value_, 1)); }
+
+    void wait(T old, memory_order order = memory_order_seq_cst) const
+    {
+        while (load(order) == old) {
+            cpu_relax();
+        }
+    }
+    void notify_one() {}
+    void notify_all() {}
+
+    static constexpr bool is_always_lock_free = true;
+
+private:
+    static uint32_t to_raw(T value) { return (uint32_t)value; }
+    static T from_raw(uint32_t raw) { return (T)raw; }
+
+    volatile uint32_t value_ = 0;
+};
+
+class atomic_flag {
+public:
+    bool test_and_set(memory_order = memory_order_seq_cst)
+    {
+        return atomic_exchange(&value_, 1) != 0;
+    }
+    void clear(memory_order order = memory_order_seq_cst)
+    {
+        atomic_store_explicit(&value_, 0, order == memory_order_seq_cst ? order : memory_order_release);
+    }
+    bool test(memory_order order = memory_order_seq_cst) const
+    {
+        return atomic_load_explicit(&value_, order) != 0;
+    }
+
+private:
+    volatile uint32_t value_ = 0;
+};
+#endif
+
+#endif // ATOMIC_H
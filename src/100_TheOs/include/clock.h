@@ -0,0 +1,70 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "interrupts.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest the timer stays quiet when nothing is waiting for it
+#define CLOCK_IDLE_MS 1000
+
+// True once time comes from the clocksource (TSC or HPET) and the timer
+// runs one-shot
+extern bool clock_tickless;
+
+// Timer interrupts taken, periodic or one-shot
+extern uint32_t clock_events;
+
+// Time the TSC against PIT channel 2. Polls, so it works before
+// interrupts are set up; everything below depends on it.
+void clock_calibrate_tsc(void);
+uint32_t clock_tsc_khz(void);
+
+// Local APIC timer counts per millisecond at divide by 16, 0 if it was
+// not calibrated. The same on every processor.
+uint32_t clock_lapic_per_ms(void);
+
+// Pick a clocksource and switch to tickless mode, with the local APIC
+// timer when the APIC is in use, else the HPET, else the PIT. Stays on
+// the periodic PIT tick without a calibrated TSC or an HPET.
+void clock_init(void);
+
+// Nanoseconds since the TSC was calibrated (since clock_init() on
+// machines with an HPET and no TSC)
+uint64_t ktime_get_ns(void);
+
+// Calibrated busy-waits
+void udelay(uint32_t us);
+void ndelay(uint32_t ns);
+
+// Milliseconds since boot
+uint32_t clock_now_ms(void);
+
+// Make sure a timer interrupt arrives no later than deadline (in
+// clock_now_ms() time). Only the nearest deadline is kept, so callers
+// that wake up early must arm again. Only CPU 0 runs the clock; on other
+// processors this does nothing and their tick covers the deadline.
+void clock_arm(uint32_t deadline);
+
+// Milliseconds until the next timer interrupt is due, what an idle CPU can
+// expect to sleep at most
+uint32_t clock_next_event_ms(void);
+
+// Timer interrupt, from the PIT, the HPET or the local APIC timer
+void clock_event(registers_t* regs);
+
+void clock_print_info(void);
+
+// Compare one-shot accuracy of the PIT, HPET and local APIC timer, and
+// the cost of reading each clock
+void clock_jitter_benchmark(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CLOCK_H
@@ -9,5 +9,19 @@ void outb(uint16_t port, uint8_t value);
 uint8_t inb(uint16_t port);
 // Read a word (2 bytes) from I/O port
 uint16_t inw(uint16_t port);
+// Send a word (2 bytes) to I/O port
+void outw(uint16_t port, uint16_t value);
+// Send a double word (4 bytes) to I/O port
+void outl(uint16_t port, uint32_t value);
+// Read a double word (4 bytes) from I/O port
+uint32_t inl(uint16_t port);
+
+// Read the CPU time-stamp counter
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 
 #endif
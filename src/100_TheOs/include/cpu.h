@@ -0,0 +1,60 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+// CPUID leaf 1 feature bits
+#define CPUID_EDX_FPU   (1 << 0)
+#define CPUID_EDX_TSC   (1 << 4)
+#define CPUID_EDX_MSR   (1 << 5)
+#define CPUID_EDX_APIC  (1 << 9)
+#define CPUID_EDX_SEP   (1 << 11)
+#define CPUID_EDX_FXSR  (1 << 24)
+#define CPUID_EDX_SSE   (1 << 25)
+#define CPUID_EDX_SSE2  (1 << 26)
+#define CPUID_ECX_SSE3  (1 << 0)
+#define CPUID_ECX_MONITOR (1 << 3)
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    asm volatile("cpuid"
+                 : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                 : "a" (leaf), "c" (0));
+}
+
+// Model-specific registers
+#define MSR_APIC_BASE 0x1B
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
+// Feature bits from CPUID leaf 1
+uint32_t cpu_features_edx(void);
+uint32_t cpu_features_ecx(void);
+
+static inline bool cpu_has_edx(uint32_t bit)
+{
+    return (cpu_features_edx() & bit) != 0;
+}
+
+static inline bool cpu_has_ecx(uint32_t bit)
+{
+    return (cpu_features_ecx() & bit) != 0;
+}
+
+// Turn on SSE for kernel code (CR4.OSFXSR/OSXMMEXCPT). Returns false if
+// the CPU has no SSE2.
+bool cpu_enable_sse(void);
+bool cpu_sse_enabled(void);
+
+#endif // CPU_H
@@ -49,8 +49,6 @@ void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, ui
 
 
 
-static struct idt_entry_t idt[IDT_ENTRIES];
-static struct idt_ptr_t idt_ptr;
 static struct gdt_entry_t gdt[GDT_ENTRIES];
 static struct gdt_ptr_t gdt_ptr;
 
@@ -0,0 +1,55 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// x87/SSE register state of one execution context. fxsave needs 512
+// bytes on a 16 byte boundary; the fnsave fallback uses 108 of them.
+typedef struct {
+    uint8_t state[512];
+    bool used;          // Has touched the FPU, state holds its registers
+} __attribute__((aligned(16))) fpu_context_t;
+
+typedef struct {
+    uint32_t switches;  // fpu_switch() calls that changed context
+    uint32_t traps;     // #NM traps taken
+    uint32_t saves;     // Previous owner's state written out
+    uint32_t restores;  // State loaded back for a context
+    uint32_t inits;     // First FPU use by a context
+} fpu_stats_t;
+
+// The kernel's own context (shell worker, boot code)
+extern fpu_context_t fpu_kernel_context;
+
+// Enable the FPU (and fxsave/SSE when present) with lazy switching
+void fpu_init(void);
+
+// FPU setup on an application processor, with ctx (its idle thread's)
+// as the current context
+void fpu_init_ap(fpu_context_t* ctx);
+
+// Save the registers to the context that owns them, so it can continue
+// on any processor
+void fpu_flush(void);
+
+// Make ctx the current context. Nothing is saved here: CR0.TS is set
+// and the first FPU instruction of the new context traps to #NM, which
+// swaps the state. A context that never uses the FPU costs nothing.
+void fpu_switch(fpu_context_t* ctx);
+
+void fpu_context_init(fpu_context_t* ctx);
+// Forget a context that is going away
+void fpu_context_release(fpu_context_t* ctx);
+
+void fpu_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FPU_H
@@ -0,0 +1,50 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "libc/stdint.h"
+#include "libc/stddef.h"
+#include "libc/stdbool.h"
+#include "multiboot2.h"
+
+// Size of one text cell in pixels (8x16 VGA font)
+#define FB_CELL_WIDTH 8
+#define FB_CELL_HEIGHT 16
+
+// Largest console we keep a cell buffer for (1920x1200 with 8x16 cells)
+#define FB_MAX_COLS 240
+#define FB_MAX_ROWS 75
+
+// Linear framebuffer description taken from the multiboot2 framebuffer tag
+typedef struct {
+    uint8_t* base;        // Identity mapped start of the framebuffer
+    uint32_t pitch;       // Bytes per scanline
+    uint32_t width;       // Width in pixels
+    uint32_t height;      // Height in pixels
+    uint8_t bpp;          // Bits per pixel (only 32 is rendered)
+    uint8_t red_pos;      // Bit position of the colour channels
+    uint8_t green_pos;
+    uint8_t blue_pos;
+} framebuffer_t;
+
+// Parse the multiboot2 framebuffer tag. Returns true if the framebuffer
+// is a 32-bit RGB surface the console can render to.
+bool framebuffer_init(struct multiboot_tag_framebuffer* tag);
+bool framebuffer_present(void);
+const framebuffer_t* framebuffer_get(void);
+
+// Convert an 8-bit per channel colour to the framebuffer pixel format
+uint32_t framebuffer_rgb(uint8_t r, uint8_t g, uint8_t b);
+
+// Text console backend used by monitor.c. The monitor owns the cell
+// buffer (VGA style char | attr << 8 entries); the framebuffer only
+// tracks which cells changed and renders them on flush.
+size_t fb_console_cols(void);
+size_t fb_console_rows(void);
+void fb_console_attach(uint16_t* cells);
+void fb_console_mark(size_t x, size_t y);
+void fb_console_mark_all(void);
+void fb_console_scroll(size_t lines);
+void fb_console_set_cursor(size_t x, size_t y);
+void fb_console_flush(void);
+
+#endif // FRAMEBUFFER_H
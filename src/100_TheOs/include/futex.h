@@ -0,0 +1,51 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+// Futexes: sleeping on a 32-bit word in memory. User-space locks keep
+// their state in the word and only enter the kernel to wait while it
+// holds a given value, or to wake waiters after changing it. Waiters
+// are kept in a hash of wait queues keyed by the word's physical
+// address, so two mappings of one page share a futex.
+//
+// SYS_FUTEX_WAIT and SYS_FUTEX_WAKE expose these to ring 3; usync.h has
+// the mutex and condition variable built on them.
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hash buckets, a power of two
+#define FUTEX_HASH_BITS 5
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+// futex_wait() results
+#define FUTEX_WOKEN 0       // Slept and was woken; the caller re-checks the word
+#define FUTEX_AGAIN 1       // *addr did not hold val, so it did not sleep
+
+typedef struct {
+    uint32_t waits;         // Callers that went to sleep
+    uint32_t again;         // Callers that found the value already changed
+    uint32_t wakes;         // futex_wake() calls
+    uint32_t woken;         // Threads they woke
+} futex_stats_t;
+
+extern futex_stats_t futex_stats;
+
+void futex_init(void);
+
+// Sleep while *addr == val, checked after the caller is queued so a wake
+// that follows a change of the word is never missed. Thread context.
+// addr must be 4-byte aligned and mapped.
+uint32_t futex_wait(volatile uint32_t* addr, uint32_t val);
+
+// Wake up to n threads sleeping on addr, returns how many. Any context.
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FUTEX_H
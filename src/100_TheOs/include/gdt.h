@@ -30,8 +30,35 @@ struct GdtPtr
     #endif
 }__attribute__((packed)); 
 
+// Task state segment. Only esp0/ss0 are used: the stack the CPU
+// switches to when an interrupt or int 0x80 arrives from ring 3.
+struct TssEntry
+{
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t unused[22];
+    uint16_t trap;
+    uint16_t iomap_base;
+}__attribute__((packed));
+
+// Segment selectors, user selectors include RPL 3.
+// sysenter/sysexit require this order: kernel code, kernel data,
+// user code, user data.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x1B
+#define GDT_USER_DATA   0x23
+#define GDT_TSS         0x28
+#define GDT_PERCPU      0x30    // Per-CPU data, loaded in GS (percpu.h)
+
+extern struct TssEntry tss_entry;
+
 void init_gdt();
 
+// Own GDT and TSS for an application processor, loaded on that CPU
+void gdt_init_ap(int cpu);
+
 #ifdef __x86_64__
 void gdt_flush(uint64_t gdt_ptr);
 #else
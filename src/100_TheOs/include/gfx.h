@@ -0,0 +1,36 @@
+#ifndef GFX_H
+#define GFX_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+// Most dirty rectangles tracked per frame before they are merged
+#define GFX_MAX_DIRTY 32
+
+typedef struct {
+    int32_t x, y;
+    int32_t w, h;
+} gfx_rect_t;
+
+// Enter a double buffered 32-bit graphics mode through the VBE driver
+bool gfx_begin(uint32_t width, uint32_t height);
+void gfx_end(void);
+
+uint32_t gfx_width(void);
+uint32_t gfx_height(void);
+
+// Drawing goes to the back page and marks the area dirty
+void gfx_fill_rect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+void gfx_blit(const uint32_t* src, uint32_t src_pitch, int32_t x, int32_t y, int32_t w, int32_t h);
+
+// Flip pages, then bring the new back page up to date by copying only
+// the rectangles that changed in the frame just shown
+void gfx_present(void);
+
+// Use the SSE2 fill/blit kernels (if the CPU has them) or rep stosd/movsd
+bool gfx_use_sse2(bool enable);
+
+// 'gfxbench': fills/sec and blits/sec for each kernel
+void gfx_benchmark(void);
+
+#endif // GFX_H
@@ -0,0 +1,46 @@
+#ifndef HPET_H
+#define HPET_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// True once the HPET main counter is running
+extern bool hpet_present;
+
+// Find the HPET through the ACPI "HPET" table, map it and start the main
+// counter. Returns false if there is none.
+bool hpet_init(void);
+
+// Main counter, extended to 64 bits in software on 32-bit counters (read
+// at least once per wrap, about 5 minutes at 14.3 MHz)
+uint64_t hpet_read_counter(void);
+uint32_t hpet_counts_per_ms(void);
+
+// Comparator 0 as an event timer. Its interrupt arrives as IRQ0, through
+// the I/O APIC input IRQ0 uses or in legacy replacement mode (which also
+// cuts the PIT off IRQ0 and the RTC off IRQ8). hpet_events_available()
+// says whether either is possible; hpet_enable_events() switches the
+// routing on.
+bool hpet_events_available(void);
+void hpet_enable_events(void);
+bool hpet_legacy_routing(void);
+
+// True while legacy replacement is switched on, IRQ8 belongs to the HPET
+bool hpet_legacy_enabled(void);
+
+// Fire once after counts, or every counts ticks; hpet_stop() disarms
+void hpet_set_oneshot(uint32_t counts);
+void hpet_set_periodic(uint32_t counts);
+void hpet_stop(void);
+
+void hpet_print_info(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HPET_H
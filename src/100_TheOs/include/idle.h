@@ -0,0 +1,63 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Idle states, shallowest first. The mwait ones only exist when CPUID
+// reports MONITOR/MWAIT.
+enum {
+    IDLE_HLT,
+    IDLE_MWAIT_C1,
+    IDLE_MWAIT_DEEP,    // Deepest C-state CPUID leaf 5 lists
+    IDLE_STATE_COUNT,
+};
+
+// Predicted idle needed before the deep state is worth its exit latency
+#define IDLE_DEEP_MIN_MS 2
+
+typedef struct {
+    const char* name;
+    bool available;
+    uint32_t hint;      // mwait hint (EAX)
+} idle_state_t;
+
+extern idle_state_t idle_states[IDLE_STATE_COUNT];
+
+// Kept per CPU in percpu_t and written only by that CPU. Others read the
+// 64-bit times while seq is even and unchanged across the read.
+typedef struct {
+    volatile uint32_t seq;      // Odd while an idle period is entered or left
+    volatile bool in_progress;
+    uint64_t enter;             // Start of the period in progress
+    uint64_t total_ns;          // Finished idle periods
+    uint32_t early_wakeups;     // Before half of the predicted idle time
+    uint32_t entries[IDLE_STATE_COUNT];
+    uint64_t residency_ns[IDLE_STATE_COUNT];
+} idle_stats_t;
+
+// Probe the idle states and start the once-a-second utilization sample
+void idle_init(void);
+
+// Sleep until the next interrupt in the state the prediction allows.
+// Called with interrupts off, returns with them on, so a wakeup that
+// arrives after the caller's last check is not lost.
+void cpu_idle(void);
+
+// Idle share of the last full second in percent, over all online CPUs
+uint32_t idle_percent(void);
+
+void idle_print_stats(void);
+
+// Utilization in the top right corner, redrawn every second
+void idle_status_line(bool enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IDLE_H
@@ -54,60 +54,15 @@
 #define IRQ15 47
 #define IRQ_COUNT 16
 
-// Fetch the isr functions
-extern void isr0 ();
-extern void isr1 ();
-extern void isr2 ();
-extern void isr3 ();
-extern void isr4 ();
-extern void isr5 ();
-extern void isr6 ();
-extern void isr7 ();
-extern void isr8 ();
-extern void isr9 ();
-extern void isr10();
-extern void isr11();
-extern void isr12();
-extern void isr13();
-extern void isr14();
-extern void isr15();
-extern void isr16();
-extern void isr17();
-extern void isr18();
-extern void isr19();
-extern void isr20();
-extern void isr21();
-extern void isr22();
-extern void isr23();
-extern void isr24();
-extern void isr25();
-extern void isr26();
-extern void isr27();
-extern void isr28();
-extern void isr29();
-extern void isr30();
-extern void isr31();
-extern void irq0 ();
-extern void irq1 ();
-extern void irq2 ();
-extern void irq3 ();
-extern void irq4 ();
-extern void irq5 ();
-extern void irq6 ();
-extern void irq7 ();
-extern void irq8 ();
-extern void irq9 ();
-extern void irq10();
-extern void irq11();
-extern void irq12();
-extern void irq13();
-extern void irq14();
-extern void irq15();
+// Entry stubs generated in isr_asm.asm, one per vector
+extern void* isr_stub_table[IDT_ENTRIES];
+
+// IDT gate types
+#define IDT_GATE_INTERRUPT 0x8E  // Present, ring 0, 32-bit interrupt gate
+#define IDT_GATE_USER      0x60  // OR in to make a gate reachable from ring 3
 
 // Start irq controller
 void start_irq();
-// Start interrupt functions
-void start_interrupts();
 
 // Struct for registers
 typedef struct registers {
@@ -123,22 +78,29 @@ typedef void (*isr_t)(registers_t*, void*);
 void register_interrupt_handler(uint8_t n, isr_t handler, void* context);
 void register_irq_handler(uint8_t irq, isr_t handler, void* context);
 
-// Int controller struct
-struct int_controller_t {
-  int num;
-  isr_t controller;
+// Handler table entry, read directly by the entry stubs in isr_asm.asm.
+// The layout (8 bytes, handler first) must match interrupt_common_stub.
+struct interrupt_handler_t {
+  isr_t handler;
   void *data;
 };
 
+extern struct interrupt_handler_t interrupt_handlers[IDT_ENTRIES];
+
 // Register the isr controller
 void register_irq_controller(int irq, isr_t controller, void* ctx);
 
 // Load the interrupt controller
 void load_interrupt_controller(uint8_t n, isr_t controller, void*);
 
-// Static variables for the interrupt controller
-static struct int_controller_t int_controllers[IDT_ENTRIES];
-static struct int_controller_t irq_controllers[IRQ_COUNT];
+// Point an IDT entry at an entry stub
+void interrupt_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags);
+
+// Default handler for vectors nobody registered
+void isr_controller(registers_t* regs, void* context);
+
+// Measure the int/iret round trip through the entry stubs
+void interrupt_benchmark(void);
 
 void init_irq(void);   // If you're calling it internally
 void start_irq(void);  // If calling from kernel.cpp
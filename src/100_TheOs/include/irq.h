@@ -7,9 +7,19 @@
 // Function to initialize all IRQ handlers
 void init_irq(void);
 
-void irq_controller(registers_t* regs);
+void irq_controller(registers_t* regs, void* context);
 
 
+// Enable or disable an IRQ line at the active interrupt controller
+void irq_unmask(uint8_t irq);
+void irq_mask(uint8_t irq);
+
+// Storm throttling: called on every timer event, runs the handlers of
+// lines masked because of an interrupt storm and unmasks them once
+// their back-off has passed
+void irq_poll_throttled(registers_t* regs);
+void irq_print_throttle_stats(void);
+
 // Function to register a specific IRQ handler
 void register_irq_handler(uint8_t irq, isr_t handler, void* context);
 
@@ -0,0 +1,42 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+#include "libc/stdint.h"
+#include "interrupts.h"
+#include "apic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Handler durations are counted in log2 buckets: bucket n holds
+// durations of 2^n up to 2^(n+1)-1 cycles
+#define IRQSTAT_BUCKETS 32
+
+typedef struct {
+    uint32_t count;          // Times the vector was taken
+    uint32_t max_cycles;     // Longest single handler run
+    uint64_t cycles;         // Total cycles spent in the handler
+    uint32_t histogram[IRQSTAT_BUCKETS];
+} irq_stat_t;
+
+// One block per CPU, written only by that CPU, so recording needs no lock
+// or atomic. The print functions add them up.
+extern irq_stat_t irq_stats[APIC_MAX_CPUS][IDT_ENTRIES];
+
+// Called by interrupt_common_stub after every handler, start is the TSC
+// value read just before the handler was called
+void irqstat_record(registers_t* regs, uint64_t start);
+
+void irqstat_reset(void);
+// One line per vector that has been taken, summed over the online CPUs,
+// with the calls per CPU when there is more than one
+void irqstat_print_summary(void);
+// Duration histogram of one vector, all CPUs together
+void irqstat_print_histogram(uint8_t vector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IRQSTAT_H
@@ -17,6 +17,11 @@ void start_keyboard(void);
 void keyboard_controller(registers_t* regs, void* context);
 char scancode_to_ascii(uint8_t scancode);
 
+// Block until a key is typed and return it: '\n' for Enter, '\b' for
+// Backspace. While a thread waits here keys go to it instead of the
+// shell. Not from the kernel worker, which is what delivers the keys.
+char keyboard_getchar(void);
+
 #ifdef __cplusplus
 }
 #endif
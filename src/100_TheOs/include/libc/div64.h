@@ -0,0 +1,22 @@
+#pragma once
+
+#include "libc/stdint.h"
+
+// Divide a 64-bit value by a 32-bit one with two 32-bit divl instructions.
+// The kernel links without libgcc, so plain 64-bit '/' and '%' are not
+// available on i386.
+static inline uint64_t div64_32(uint64_t dividend, uint32_t divisor, uint32_t* remainder)
+{
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t q_high = 0, q_low, rem;
+
+    if (high >= divisor) {
+        q_high = high / divisor;
+        high %= divisor;
+    }
+    asm("divl %4" : "=a" (q_low), "=d" (rem) : "a" (low), "d" (high), "rm" (divisor));
+
+    if (remainder) *remainder = rem;
+    return ((uint64_t)q_high << 32) | q_low;
+}
@@ -0,0 +1,74 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "libc/stdint.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Log levels, lower is more important
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+// Build-time threshold, set from OS_LOG_LEVEL in CMakeLists.txt.
+// Levels above it are removed by the preprocessor: their arguments are
+// never evaluated and no code or strings end up in the kernel.
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_LEVEL_INFO
+#endif
+
+// Runtime threshold for the levels that were compiled in
+extern uint8_t log_level;
+
+void log_set_level(uint8_t level);
+const char* log_level_name(uint8_t level);
+void log_write(uint8_t level, const char* tag, const char* format, ...);
+
+#define LOG_AT(level, tag, ...) \
+    do { \
+        if ((level) <= log_level) \
+            log_write((level), (tag), __VA_ARGS__); \
+    } while (0)
+
+#define LOG_NOTHING do { } while (0)
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_ERROR
+#define LOG_ERROR(tag, ...) LOG_AT(LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#else
+#define LOG_ERROR(tag, ...) LOG_NOTHING
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_WARN
+#define LOG_WARN(tag, ...) LOG_AT(LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#else
+#define LOG_WARN(tag, ...) LOG_NOTHING
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_INFO
+#define LOG_INFO(tag, ...) LOG_AT(LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#else
+#define LOG_INFO(tag, ...) LOG_NOTHING
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(tag, ...) LOG_AT(LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#else
+#define LOG_DEBUG(tag, ...) LOG_NOTHING
+#endif
+
+#if LOG_LEVEL_MAX >= LOG_LEVEL_TRACE
+#define LOG_TRACE(tag, ...) LOG_AT(LOG_LEVEL_TRACE, tag, __VA_ARGS__)
+#else
+#define LOG_TRACE(tag, ...) LOG_NOTHING
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_H
@@ -22,6 +22,13 @@ void print_memory_layout(void);
 // Paging setup
 void init_paging(void);
 void paging_map_virtual_to_phys(uint32_t virtual_addr, uint32_t physical_addr);
+// Identity map a device memory range (framebuffers, MMIO registers)
+void paging_map_mmio(uint32_t physical_addr, uint32_t size);
+// Make mapped pages accessible from user mode
+void paging_set_user(uint32_t addr, uint32_t size);
+
+// Physical address a virtual one is mapped to, 0 if it is not mapped
+uint32_t paging_virt_to_phys(uint32_t virtual_addr);
 
 // Basic alloc/free
 void* malloc(size_t size);
@@ -33,6 +40,7 @@ void* pmalloc(size_t size);
 // Memory helper functions
 void test_memory(void);
 void* memcpy(void* dest, const void* src, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
 void* memset(void* ptr, int value, size_t n);
 void* memset16(void* ptr, uint16_t value, size_t n);
 #endif
@@ -7,10 +7,15 @@
 #include "libc/stdint.h"
 #include "libc/stddef.h"
 
+// Number of virtual consoles (Alt+F1..F4)
+#define VT_COUNT 4
+
 void monitor_initialize() ;
 void monitor_setcolor(uint8_t color);
 
 void monitor_put(char c);
+void monitor_putentryat(char c, uint8_t color, size_t x, size_t y);
+void monitor_backspace(void);
 void monitor_clear();
 void monitor_write(const char* data, size_t size);
 void monitor_write_hex(uint32_t n);
@@ -20,5 +25,20 @@ void monitor_writestring(const char* data);
 void terminal_printf(const char* format, ...);
 void terminal_clear(void);
 
+// Text in the top right corner of the visible console, in reverse video
+void monitor_status(const char* text);
+
+// Virtual consoles. Output goes to the calling thread's console, which
+// monitor_select_output_vt() changes; monitor_switch_vt() is safe from
+// interrupt context. On a framebuffer the repaint after a switch is left
+// to a console thread, which monitor_start_thread() starts once the
+// scheduler runs.
+void monitor_switch_vt(int vt);
+void monitor_select_output_vt(int vt);
+int monitor_visible_vt(void);
+int monitor_output_vt(void);
+void monitor_redraw(void);
+void monitor_start_thread(void);
+
 
 #endif // MONITOR_H
\ No newline at end of file
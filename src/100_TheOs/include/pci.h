@@ -0,0 +1,29 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Offsets in the configuration header
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_BAR0      0x10
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+} pci_device_t;
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+
+// Find the first function with the given vendor and device ID
+bool pci_find_device(uint16_t vendor, uint16_t device, pci_device_t* out);
+
+// Base address of a memory BAR with the flag bits masked off
+uint32_t pci_bar_address(const pci_device_t* dev, int bar);
+
+#endif // PCI_H
@@ -0,0 +1,95 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "apic.h"
+#include "fpu.h"
+#include "idle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct thread;
+struct TssEntry;
+
+// Data only its own processor touches, or nearly so. Every CPU's GDT has
+// a descriptor based at its block (GDT_PERCPU), which GS holds in the
+// kernel, so a field is one mov %gs:offset away and needs no lock or
+// atomic. Blocks are a cache line apart to keep CPUs from sharing lines.
+typedef struct percpu {
+    struct percpu* self;
+    uint32_t index;             // 0 for the boot CPU
+    uint8_t apic_id;
+
+    struct thread* current;     // Running thread
+    struct TssEntry* tss;       // This CPU's TSS. Offsets up to here are
+                                // used by syscall_asm.asm.
+
+    // Lazy FPU switching: the running context and the one whose state
+    // is in the registers
+    fpu_context_t* fpu_current;
+    fpu_context_t* fpu_owner;
+    fpu_stats_t fpu_stats;
+
+    // Idle states and time, see idle.c
+    idle_stats_t idle_stats;
+
+    // Where sysenter lands (MSR_SYSENTER_ESP). sysenter_entry moves to
+    // the calling thread's own kernel stack straight away.
+    uint32_t sysenter_stack[4];
+
+    // Application processors only
+    volatile bool idle_waiting; // Halted, wants an IPI when work comes
+    bool tick_running;
+} __attribute__((aligned(64))) percpu_t;
+
+extern percpu_t percpu_areas[APIC_MAX_CPUS];
+
+// Set once init_gdt() has loaded GS on the boot CPU. Code that may run
+// before that checks it; the scheduler, FPU and APs come later.
+extern bool percpu_ready;
+
+// Set up a processor's block, before its GDT is loaded
+void percpu_init(int cpu);
+
+#define PERCPU_OFFSET(field) __builtin_offsetof(percpu_t, field)
+
+// One field of the calling processor's block. Fields of 1, 2 or 4 bytes.
+#define this_cpu_read(field) ({                                             \
+    __typeof__(((percpu_t*)0)->field) _value;                               \
+    asm volatile("mov %%gs:%c1, %0" : "=q" (_value) : "i" (PERCPU_OFFSET(field))); \
+    _value;                                                                 \
+})
+
+#define this_cpu_write(field, value) do {                                   \
+    __typeof__(((percpu_t*)0)->field) _value = (value);                     \
+    asm volatile("mov %0, %%gs:%c1" : : "q" (_value), "i" (PERCPU_OFFSET(field)) : "memory"); \
+} while (0)
+
+// A 32-bit counter. A single instruction, so an interrupt cannot split it
+// and no lock prefix is needed.
+#define this_cpu_inc(field) \
+    asm volatile("incl %%gs:%c0" : : "i" (PERCPU_OFFSET(field)) : "memory")
+
+static inline percpu_t* this_cpu(void)
+{
+    return this_cpu_read(self);
+}
+
+static inline uint32_t this_cpu_index(void)
+{
+    return this_cpu_read(index);
+}
+
+static inline percpu_t* per_cpu(int cpu)
+{
+    return &percpu_areas[cpu];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERCPU_H
@@ -25,7 +25,15 @@ extern volatile uint32_t system_ticks;
 #define TICKS_PER_MS 1
 
 void test_pit_10seconds(void);
+
+// Tick jitter, sleep latency and wakeup overshoot against the TSC
+void timer_benchmark(void);
+
 void init_pit();
+uint32_t pit_get_ticks(void);
+uint32_t pit_tick_count(void);
+void pit_set_oneshot(uint16_t count);
+uint32_t get_uptime_seconds(void);
 void sleep_interrupt(uint32_t milliseconds);
 void sleep_busy(uint32_t milliseconds);
 void test_timing_accuracy(void);
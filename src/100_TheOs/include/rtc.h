@@ -0,0 +1,51 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Rate of the optional periodic interrupt on IRQ8
+#define RTC_PERIODIC_HZ 2
+
+typedef struct {
+    uint16_t year;      // e.g. 2026
+    uint8_t month;      // 1-12
+    uint8_t day;        // 1-31
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+} rtc_time_t;
+
+// Read the CMOS clock once and start the wall clock from it. The RTC is
+// taken to be in UTC.
+void rtc_init(void);
+
+// Wall clock, nanoseconds since 1970-01-01 UTC. It advances with
+// ktime_get_ns(), the RTC is only read at boot.
+uint64_t ktime_get_real_ns(void);
+
+// Set the wall clock, and the CMOS clock so it survives a reboot
+void settime(uint32_t unix_seconds);
+
+uint32_t rtc_to_unix(const rtc_time_t* time);
+void rtc_from_unix(uint32_t unix_seconds, rtc_time_t* time);
+
+// "YYYY-MM-DD HH:MM:SS"
+bool rtc_parse(const char* text, rtc_time_t* time);
+
+// Periodic interrupt at RTC_PERIODIC_HZ, a second time source checked
+// against the clocksource. Fails while the HPET owns IRQ8 (legacy
+// replacement).
+bool rtc_enable_periodic(bool enable);
+
+void rtc_print_date(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RTC_H
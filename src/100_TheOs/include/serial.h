@@ -0,0 +1,20 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "libc/stdint.h"
+#include "libc/stddef.h"
+#include "libc/stdbool.h"
+
+// First serial port (QEMU -serial)
+#define SERIAL_COM1 0x3F8
+
+// Initialize COM1 at 115200 baud, 8N1. Returns false if no UART answers.
+bool serial_init(void);
+bool serial_present(void);
+
+void serial_putc(char c);
+void serial_write(const void* data, size_t size);
+void serial_writestring(const char* str);
+void serial_printf(const char* format, ...);
+
+#endif // SERIAL_H
@@ -0,0 +1,48 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "apic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where the real-mode entry code is copied, also the STARTUP IPI vector
+// (page 8). Must match smp_trampoline.asm.
+#define SMP_TRAMPOLINE_BASE 0x8000
+
+// Each processor's boot and idle stack
+#define SMP_STACK_SIZE 16384
+
+// Application processor interrupts, next to the local APIC timer
+#define SMP_TICK_VECTOR     0xEE    // Periodic scheduler tick while busy
+#define SMP_RESCHED_VECTOR  0xED    // Wake an idle CPU to look for work
+
+// Processors running, the boot CPU included
+extern volatile int smp_cpus_online;
+
+// True once application processors are being started. Until then
+// everything runs on CPU 0 and threads stay where they are.
+extern volatile bool smp_active;
+
+// Start every enabled processor in the MADT. Needs the local APIC timer
+// calibrated and the scheduler running.
+void smp_init(void);
+
+// Send an IPI to an idle processor, if there is one, so it looks for
+// work to steal
+void smp_kick_idle(void);
+
+// Reschedule IPI to one processor: a thread was queued there, or (CPU 0)
+// a timer was added
+void smp_send_resched(int cpu);
+
+void smp_print_info(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SMP_H
@@ -0,0 +1,201 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+// Ticket spinlocks and reader-writer spinlocks.
+//
+// A ticket lock hands the lock out in arrival order: taking a ticket is
+// one xadd, and unlocking is a plain increment of the "now serving" half.
+// An uncontended lock/unlock pair is a single locked instruction.
+//
+// Nothing stops the scheduler from preempting a thread that holds a
+// lock, and an interrupt handler taking a lock its CPU already holds
+// would spin forever. So use the _irqsave forms unless interrupts are
+// known to be off already.
+//
+// With LOCK_STATS (OS_LOCK_STATS in CMake) every lock counts its
+// acquisitions, how many had to wait and the cycles spent waiting;
+// lock_print_stats() lists the named ones. Without it the counters
+// compile out.
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "atomic.h"
+
+#ifndef LOCK_STATS
+#define LOCK_STATS 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lock_stats {
+    const char* name;
+    uint32_t acquired;          // Writers only, for reader-writer locks
+    volatile uint32_t contended;
+    uint64_t spin_cycles;       // Waiting, only when counted under the lock
+    struct lock_stats* next;    // All locks taken so far
+    volatile uint32_t registered;
+} lock_stats_t;
+
+typedef struct {
+    volatile uint32_t tickets;  // Low half: now serving, high half: next ticket
+#if LOCK_STATS
+    lock_stats_t stats;
+#endif
+} spinlock_t;
+
+// Readers count in the low bits. A waiting writer keeps new readers out.
+#define RWLOCK_WRITER  0x80000000
+#define RWLOCK_WAITING 0x40000000
+
+typedef struct {
+    volatile uint32_t state;
+#if LOCK_STATS
+    lock_stats_t stats;
+#endif
+} rwlock_t;
+
+#if LOCK_STATS
+#define SPINLOCK_INIT(lock_name) { .tickets = 0, .stats = { .name = lock_name } }
+#define RWLOCK_INIT(lock_name) { .state = 0, .stats = { .name = lock_name } }
+#else
+#define SPINLOCK_INIT(lock_name) { .tickets = 0 }
+#define RWLOCK_INIT(lock_name) { .state = 0 }
+#endif
+
+void spin_lock_init(spinlock_t* lock, const char* name);
+void rwlock_init(rwlock_t* lock, const char* name);
+
+// Slow paths and statistics, spinlock.c
+void spin_lock_wait(spinlock_t* lock, uint32_t ticket);
+void read_lock_wait(rwlock_t* lock);
+void write_lock_wait(rwlock_t* lock);
+void lock_stats_register(lock_stats_t* stats);
+void lock_print_stats(void);
+void lock_reset_stats(void);
+
+static inline void lock_stats_acquired(lock_stats_t* stats)
+{
+    if (!stats->registered) {
+        lock_stats_register(stats);
+    }
+    stats->acquired++;
+}
+
+static inline void spin_lock(spinlock_t* lock)
+{
+    uint32_t old = atomic_fetch_add(&lock->tickets, 1 << 16);
+    if ((old >> 16) != (old & 0xFFFF)) {
+        spin_lock_wait(lock, old >> 16);
+    }
+#if LOCK_STATS
+    lock_stats_acquired(&lock->stats);
+#endif
+}
+
+static inline bool spin_trylock(spinlock_t* lock)
+{
+    uint32_t old = lock->tickets;
+    if ((old >> 16) != (old & 0xFFFF) ||
+        !atomic_compare_exchange_strong(&lock->tickets, &old, old + (1 << 16))) {
+        return false;
+    }
+#if LOCK_STATS
+    lock_stats_acquired(&lock->stats);
+#endif
+    return true;
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+    // Only the holder writes the low half; a 16-bit increment cannot
+    // carry into the ticket others are adding to
+    barrier();
+    asm volatile("incw %0" : "+m" (*(volatile uint16_t*)&lock->tickets) : : "memory", "cc");
+}
+
+static inline bool spin_is_locked(const spinlock_t* lock)
+{
+    uint32_t tickets = lock->tickets;
+    return (tickets >> 16) != (tickets & 0xFFFF);
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags)
+{
+    spin_unlock(lock);
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+static inline void read_lock(rwlock_t* lock)
+{
+    uint32_t old = lock->state;
+    if ((old & (RWLOCK_WRITER | RWLOCK_WAITING)) ||
+        !atomic_compare_exchange_strong(&lock->state, &old, old + 1)) {
+        read_lock_wait(lock);
+    }
+}
+
+static inline void read_unlock(rwlock_t* lock)
+{
+    atomic_fetch_sub(&lock->state, 1);
+}
+
+static inline void write_lock(rwlock_t* lock)
+{
+    uint32_t old = 0;
+    if (!atomic_compare_exchange_strong(&lock->state, &old, RWLOCK_WRITER)) {
+        write_lock_wait(lock);
+    }
+#if LOCK_STATS
+    lock_stats_acquired(&lock->stats);
+#endif
+}
+
+static inline void write_unlock(rwlock_t* lock)
+{
+    // Keeps RWLOCK_WAITING of another writer
+    atomic_fetch_and(&lock->state, ~RWLOCK_WRITER);
+}
+
+static inline uint32_t read_lock_irqsave(rwlock_t* lock)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t* lock, uint32_t flags)
+{
+    read_unlock(lock);
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+static inline uint32_t write_lock_irqsave(rwlock_t* lock)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t* lock, uint32_t flags)
+{
+    write_unlock(lock);
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPINLOCK_H
@@ -0,0 +1,56 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYSCALL_VECTOR 0x80
+
+// System call numbers, syscall_asm.asm and user_sync.asm have copies
+enum {
+    SYS_NULL = 0,       // Does nothing, for measuring the entry cost
+    SYS_GETTICKS = 1,   // PIT ticks since boot
+    SYS_WRITE = 2,      // write(buffer, length) to the console
+    SYS_EXIT = 3,       // Leave user mode, back to usermode_enter()'s caller
+    SYS_FUTEX_WAIT = 4, // futex_wait(addr, value), see futex.h
+    SYS_FUTEX_WAKE = 5, // futex_wake(addr, count)
+    SYSCALL_COUNT
+};
+
+// Calling convention for both entry paths: eax = number, ebx/esi/edi =
+// arguments, result in eax. sysenter callers pass their esp in ecx and
+// the return address in edx; both are clobbered.
+typedef uint32_t (*syscall_fn_t)(uint32_t a, uint32_t b, uint32_t c);
+
+// Install the DPL 3 int 0x80 gate and, when CPUID reports SEP, the
+// boot CPU's SYSENTER MSRs
+void init_syscalls(void);
+bool syscall_sysenter_supported(void);
+
+// SYSENTER MSRs of the calling processor, from its bring-up
+void syscall_init_cpu(void);
+
+// Called by both entry paths
+uint32_t syscall_dispatch(uint32_t number, uint32_t a, uint32_t b, uint32_t c);
+
+// Run code in ring 3 until it calls SYS_EXIT, returns the exit code.
+// The kernel stack its interrupts and system calls use is stored in
+// *kernel_esp and in this CPU's TSS; the scheduler puts it back in the
+// TSS whenever the thread is switched in.
+uint32_t usermode_enter(uint32_t eip, uint32_t esp, uint32_t* kernel_esp);
+
+// Cycles per null system call from ring 3, for each mechanism
+void syscall_benchmark(void);
+
+// Uncontended and contended ring 3 mutex (usync.h) costs
+void futex_benchmark(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYSCALL_H
@@ -0,0 +1,123 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "fpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Threads that can exist at once, including the kernel worker (thread 0)
+#define THREAD_MAX 16
+#define THREAD_STACK_SIZE 16384
+
+// Default time slice before the clock preempts a thread
+#define SCHED_QUANTUM_MS 10
+
+typedef enum {
+    THREAD_UNUSED,
+    THREAD_READY,       // On the run queue
+    THREAD_RUNNING,
+    THREAD_BLOCKED,     // On a wait queue (waitqueue.h)
+    THREAD_DEAD,        // Exited, its slot is freed by the next thread
+} thread_state_t;
+
+typedef void (*thread_fn_t)(void* arg);
+
+struct wait_queue;
+
+typedef struct thread {
+    uint32_t esp;           // Saved by thread_switch()
+    struct thread* next;    // Run queue link
+    thread_state_t state;
+    uint32_t id;
+    char name[16];
+    thread_fn_t fn;
+    void* arg;
+    uint8_t* stack;         // Kept when the slot is reused
+    fpu_context_t* fpu;
+    struct thread* wait_next;       // Wait queue link
+    struct wait_queue* wait_queue;  // Queue it is on, if any
+    uint32_t wait_key;              // What it waits for there, see wake_up_key()
+    bool pinned;            // Never moved to another CPU's run queue
+    uint32_t cpu;           // Processor it last ran on
+    int console;            // Virtual console it prints to, from its creator
+    uint32_t user_esp0;     // Kernel stack top while it runs ring 3 code
+                            // (TSS esp0), 0 otherwise
+    uint32_t switches;      // Times switched in
+    uint32_t preemptions;   // Times the clock took the CPU away
+    uint64_t cycles;        // TSC cycles run
+} thread_t;
+
+// Time slice in milliseconds, changed with sched_set_quantum()
+extern uint32_t sched_quantum_ms;
+
+// Make the running boot flow thread 0, give CPU 0 an idle thread and
+// start preempting
+void sched_init(void);
+
+// Make an application processor's boot flow its idle thread
+void sched_init_ap(int cpu);
+
+// Start fn(arg) in a new kernel thread. Returns NULL when all
+// THREAD_MAX slots are taken.
+thread_t* thread_create(const char* name, thread_fn_t fn, void* arg);
+
+// Same, but the thread always runs on the calling processor
+thread_t* thread_create_pinned(const char* name, thread_fn_t fn, void* arg);
+
+// Give the CPU to the next ready thread, if there is one
+void thread_yield(void);
+
+// End the calling thread, same as returning from its function
+void thread_exit(void) __attribute__((noreturn));
+
+thread_t* thread_current(void);
+
+// Virtual console the calling thread's output goes to (monitor.c). Before
+// sched_init() that is the boot flow's.
+int thread_console(void);
+void thread_set_console(int vt);
+
+// Give up the CPU until thread_wake(). The caller has set its state to
+// THREAD_BLOCKED with interrupts off, normally through wait_prepare(); if
+// it was woken since, this returns right away.
+void sched_block(void);
+
+// Make a blocked thread runnable again, on the CPU it last ran on. Any
+// context. A thread not yet switched out just keeps running.
+void thread_wake(thread_t* t);
+
+// From the reschedule IPI: another CPU may have queued a thread here
+void sched_remote_wake(void);
+
+// True if some thread other than the caller is waiting to run on this
+// CPU. With nothing queued here it steals a thread from another CPU.
+bool sched_others_ready(void);
+
+// From clock_event(): account the time slice, and ask for a switch if it
+// is used up
+void sched_clock(uint32_t now);
+
+// Switch if sched_clock() asked for it. Called by interrupt_common_stub
+// after the handler and irqstat_record(), so the interrupted vector's
+// time does not include the threads that ran in between.
+void sched_preempt(void);
+
+void sched_set_quantum(uint32_t ms);
+void sched_print_threads(void);
+
+// Cycles per context switch, measured with threads yielding to each other
+void sched_benchmark(void);
+
+// Save callee-saved registers and EFLAGS on the current stack, store esp
+// in *save_esp and continue on new_esp (thread_asm.asm)
+void thread_switch(uint32_t* save_esp, uint32_t new_esp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THREAD_H
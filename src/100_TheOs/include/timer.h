@@ -0,0 +1,46 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Timers that can be pending at once
+#define TIMER_POOL_SIZE 64
+
+// Runs in interrupt context with interrupts off: keep it short, and
+// hand anything longer to work_queue()
+typedef void (*timer_fn_t)(void* arg);
+
+// Names a timer for timer_cancel(). Stays unique after the timer fires,
+// so cancelling a stale id is harmless. 0 is never a valid id.
+typedef uint32_t timer_id_t;
+
+// Call fn(arg) once at deadline, in clock_now_ms() time. Returns 0 when
+// all TIMER_POOL_SIZE timers are in use.
+timer_id_t timer_add(uint32_t deadline, timer_fn_t fn, void* arg);
+
+// Call fn(arg) at first and then every period milliseconds until the
+// timer is cancelled
+timer_id_t timer_add_periodic(uint32_t first, uint32_t period, timer_fn_t fn, void* arg);
+
+// True if the timer was pending and will not run
+bool timer_cancel(timer_id_t id);
+
+// Run the timers that are due, called on every timer event
+void timer_run(uint32_t now);
+
+// Arm the clock for the next pending timer. CPU 0, when another CPU has
+// added a timer.
+void timer_rearm(void);
+
+void timer_print_info(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMER_H
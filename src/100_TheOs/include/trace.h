@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "common.h"
+#include "percpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One buffer per CPU, so CPUs never share a ring or its head
+#define TRACE_MAX_CPUS APIC_MAX_CPUS
+
+// Events per CPU, must be a power of two (24 bytes each). All buffers
+// are in .bss, which has to end below the page directory at 4 MB.
+#define TRACE_BUFFER_EVENTS 2048
+
+// Event IDs. *_BEGIN / *_END pairs become duration slices in the
+// Chrome trace viewer, everything else is an instant event.
+typedef enum {
+    TRACE_IRQ_BEGIN = 1,    // arg0 = IRQ number
+    TRACE_IRQ_END,          // arg0 = IRQ number
+    TRACE_CMD_BEGIN,        // arg0 = first 4 command characters, arg1 = length
+    TRACE_CMD_END,          // arg0 = first 4 command characters
+    TRACE_MALLOC,           // arg0 = size, arg1 = pointer
+    TRACE_FREE,             // arg0 = pointer
+    TRACE_PMALLOC,          // arg0 = page address
+    TRACE_PIT_TICK,         // arg0 = tick count
+    TRACE_IRQ_THROTTLE,     // arg0 = IRQ number, arg1 = 1 masked / 0 unmasked
+    TRACE_SCHED_SWITCH,     // arg0 = previous thread id, arg1 = next thread id
+    TRACE_EVENT_COUNT
+} trace_event_id_t;
+
+// Fixed-size binary record, also the on-wire format of 'trace dump bin'
+typedef struct {
+    uint64_t tsc;        // Time-stamp counter when the event was logged
+    uint16_t id;         // trace_event_id_t
+    uint16_t cpu;        // CPU that logged the event
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t reserved;
+} __attribute__((packed)) trace_event_t;
+
+typedef struct {
+    uint32_t head;       // Next slot to write, wraps around the ring
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+} trace_buffer_t;
+
+extern bool trace_enabled;
+extern trace_buffer_t trace_buffers[TRACE_MAX_CPUS];
+
+void trace_init(void);
+void trace_clear(void);
+void trace_dump_json(void);
+void trace_dump_binary(void);
+
+// Tracing starts before init_gdt() loads GS; until then only the boot
+// CPU runs
+static inline uint32_t trace_cpu_id(void)
+{
+    return percpu_ready ? this_cpu_index() : 0;
+}
+
+// Record an event. Claiming the slot is a single xadd, so an interrupt
+// logging its own event in between cannot tear the record.
+static inline void trace_event(uint16_t id, uint32_t arg0, uint32_t arg1)
+{
+    if (!trace_enabled) return;
+
+    uint32_t cpu = trace_cpu_id();
+    trace_buffer_t* buf = &trace_buffers[cpu];
+    uint32_t slot = 1;
+    asm volatile("lock; xaddl %0, %1" : "+r" (slot), "+m" (buf->head) : : "memory");
+
+    trace_event_t* ev = &buf->events[slot & (TRACE_BUFFER_EVENTS - 1)];
+    ev->tsc = rdtsc();
+    ev->id = id;
+    ev->cpu = cpu;
+    ev->arg0 = arg0;
+    ev->arg1 = arg1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_H
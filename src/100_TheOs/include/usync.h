@@ -0,0 +1,49 @@
+#ifndef USYNC_H
+#define USYNC_H
+
+// Mutexes and condition variables for ring 3 code, on top of the futex
+// system calls (futex.h). The functions are in user_sync.asm, in the
+// .user section, and must only be called from ring 3; the objects must
+// live in user memory as well.
+//
+// Taking a free mutex is one lock cmpxchg and releasing it, if nobody
+// waited, one lock dec. Only a thread that has to sleep, or has to wake
+// a sleeper, makes a system call.
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 0 = free, 1 = held, 2 = held and maybe waited for
+typedef struct {
+    volatile uint32_t state;
+} umutex_t;
+
+// Signalling bumps seq; a waiter sleeps until it moves. waiters lets a
+// signal with nobody waiting skip the system call.
+typedef struct {
+    volatile uint32_t seq;
+    volatile uint32_t waiters;
+} ucond_t;
+
+#define UMUTEX_INIT { 0 }
+#define UCOND_INIT { 0, 0 }
+
+void umutex_lock(umutex_t* mutex);
+bool umutex_trylock(umutex_t* mutex);
+void umutex_unlock(umutex_t* mutex);
+
+// Release mutex, sleep until signalled, take mutex again. May return
+// without a signal, so callers wait in a loop on their condition.
+void ucond_wait(ucond_t* cond, umutex_t* mutex);
+void ucond_signal(ucond_t* cond);
+void ucond_broadcast(ucond_t* cond);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USYNC_H
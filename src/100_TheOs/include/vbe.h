@@ -0,0 +1,64 @@
+#ifndef VBE_H
+#define VBE_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+// Bochs/QEMU "-vga std" display interface (DISPI)
+#define VBE_DISPI_IOPORT_INDEX 0x01CE
+#define VBE_DISPI_IOPORT_DATA  0x01CF
+
+#define VBE_DISPI_INDEX_ID          0x0
+#define VBE_DISPI_INDEX_XRES        0x1
+#define VBE_DISPI_INDEX_YRES        0x2
+#define VBE_DISPI_INDEX_BPP         0x3
+#define VBE_DISPI_INDEX_ENABLE      0x4
+#define VBE_DISPI_INDEX_BANK        0x5
+#define VBE_DISPI_INDEX_VIRT_WIDTH  0x6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT 0x7
+#define VBE_DISPI_INDEX_X_OFFSET    0x8
+#define VBE_DISPI_INDEX_Y_OFFSET    0x9
+#define VBE_DISPI_INDEX_VIDEO_MEMORY_64K 0xA
+
+#define VBE_DISPI_ID2 0xB0C2        // First version with LFB and virtual height
+
+#define VBE_DISPI_DISABLED    0x00
+#define VBE_DISPI_ENABLED     0x01
+#define VBE_DISPI_LFB_ENABLED 0x40
+#define VBE_DISPI_NOCLEARMEM  0x80
+
+// PCI ID of the emulated adapter, BAR0 is the linear framebuffer
+#define VBE_PCI_VENDOR 0x1234
+#define VBE_PCI_DEVICE 0x1111
+
+typedef struct {
+    uint32_t* lfb;          // Linear framebuffer base
+    uint32_t width;         // Visible size in pixels
+    uint32_t height;
+    uint32_t pitch;         // Pixels per scanline
+    uint32_t page_rows[2];  // First framebuffer row of each page
+    int front;              // Page currently scanned out
+} vbe_mode_t;
+
+// Detect the adapter and locate its LFB. Returns false if there is no
+// Bochs-compatible display.
+bool vbe_init(void);
+bool vbe_present(void);
+
+// Switch to a 32-bit mode with two pages for double buffering
+bool vbe_set_mode(uint32_t width, uint32_t height);
+
+// Leave the graphics mode and restore whatever was active before
+void vbe_restore_mode(void);
+
+const vbe_mode_t* vbe_get_mode(void);
+
+// Pixel pointer of the page being drawn (the one not on screen)
+uint32_t* vbe_back_buffer(void);
+uint32_t* vbe_front_buffer(void);
+
+// Show the back page. The flip is a single Y_OFFSET write, so the
+// display never scans out a half drawn frame.
+void vbe_flip(void);
+
+#endif // VBE_H
@@ -0,0 +1,87 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+// Wait queues: a thread sleeps on an event instead of polling for it,
+// and whoever completes the event (an interrupt handler, a timer, another
+// thread) wakes it. The CPU runs other threads or idles meanwhile.
+//
+// A waiter always re-checks its condition after waking; wait_event()
+// does the loop. Wakeups are never lost: the waiter is queued and marked
+// blocked before its last check, so a wake in between just leaves it
+// running.
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+#include "spinlock.h"
+#include "thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct wait_queue {
+    spinlock_t lock;
+    struct thread* head;    // Longest waiting first, linked by wait_next
+    struct thread* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT(lock_name) { .lock = SPINLOCK_INIT(lock_name), .head = 0, .tail = 0 }
+
+void wait_queue_init(wait_queue_t* wq, const char* name);
+
+// Queue the calling thread and mark it blocked. Interrupts stay off until
+// wait_finish(), which takes the flags returned here. In between the
+// caller checks its condition and calls sched_block() if it still has to
+// wait.
+uint32_t wait_prepare(wait_queue_t* wq);
+
+// Same, waiting for one key among the waiters of a shared queue, e.g. a
+// futex address in a hash bucket
+uint32_t wait_prepare_key(wait_queue_t* wq, uint32_t key);
+void wait_finish(wait_queue_t* wq, uint32_t flags);
+
+// Sleep until condition is true. Thread context only. The condition is
+// evaluated with interrupts off, keep it cheap.
+#define wait_event(wq, condition) do {                  \
+    while (!(condition)) {                              \
+        uint32_t _wait_flags = wait_prepare(wq);        \
+        if (!(condition)) {                             \
+            sched_block();                              \
+        }                                               \
+        wait_finish(wq, _wait_flags);                   \
+    }                                                   \
+} while (0)
+
+// Wake the longest waiting thread, up to n, or every thread. Any context, also
+// interrupt handlers. Return how many were woken.
+uint32_t wake_up(wait_queue_t* wq);
+uint32_t wake_up_nr(wait_queue_t* wq, uint32_t n);
+uint32_t wake_up_all(wait_queue_t* wq);
+
+// Wake up to n threads that wait for key, the longest waiting first
+uint32_t wake_up_key(wait_queue_t* wq, uint32_t key, uint32_t n);
+
+static inline bool wait_queue_active(const wait_queue_t* wq)
+{
+    return wq->head != 0;
+}
+
+// A one-shot event, such as a timer running out or a device interrupt
+// finishing a transfer. complete() sets it under the queue's lock, so the
+// completion may live on the waiter's stack: the waiter cannot see it
+// done and return while complete() still touches it.
+typedef struct {
+    wait_queue_t wait;
+    bool done;
+} completion_t;
+
+// Stack completions pass name NULL, so lock statistics do not list them
+void completion_init(completion_t* c, const char* name);
+void complete(completion_t* c);
+void wait_for_completion(completion_t* c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WAITQUEUE_H
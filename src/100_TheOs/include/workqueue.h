@@ -0,0 +1,36 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "libc/stdint.h"
+#include "libc/stdbool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pending work items, must be a power of two
+#define WORK_QUEUE_SIZE 64
+
+typedef void (*work_fn_t)(void* data);
+
+// Queue fn(data) to run later with interrupts enabled. Safe to call from
+// interrupt handlers. Returns false (and counts a drop) if the queue is full.
+bool work_queue(work_fn_t fn, void* data);
+
+// Run everything queued so far, in order. Called by the kernel worker.
+void work_run_pending(void);
+
+bool work_pending(void);
+
+// The kernel worker: runs queued work and blocks while there is none.
+// Never returns.
+void work_worker_loop(void);
+
+// Number of items dropped because the queue was full
+extern uint32_t work_dropped;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WORKQUEUE_H
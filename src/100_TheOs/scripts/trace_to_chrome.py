@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Convert a binary kernel trace ('trace dump bin' captured from the serial
+port) into Chrome trace-format JSON for chrome://tracing or Perfetto.
+
+Usage: trace_to_chrome.py capture.bin > trace.json
+"""
+import json
+import struct
+import sys
+
+MAGIC = 0x43525455  # "UTRC"
+
+EVENT_NAMES = {
+    1: ("irq", "B"), 2: ("irq", "E"),
+    3: ("cmd", "B"), 4: ("cmd", "E"),
+    5: ("malloc", "i"), 6: ("free", "i"),
+    7: ("pmalloc", "i"), 8: ("pit_tick", "i"),
+    9: ("throttle", "i"), 10: ("switch", "i"),
+}
+
+
+def event_name(event_id, arg0):
+    name, phase = EVENT_NAMES.get(event_id, ("unknown", "i"))
+    if name == "irq":
+        name += str(arg0)
+    elif name == "cmd":
+        text = arg0.to_bytes(4, "little").split(b"\0")[0]
+        name += ":" + text.decode("ascii", "replace")
+    return name, phase
+
+
+def convert(data):
+    # The capture may contain console noise before the header
+    start = data.find(struct.pack("<I", MAGIC))
+    if start < 0:
+        sys.exit("no trace header found")
+    magic, version, cpus, event_size, cycles_per_ms, tsc_lo, tsc_hi = \
+        struct.unpack_from("<7I", data, start)
+    if version != 1:
+        sys.exit("unsupported trace version %d" % version)
+    base_tsc = (tsc_hi << 32) | tsc_lo
+    offset = start + 7 * 4
+
+    # One track per CPU: events carry their CPU as the thread id
+    events = [{"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+               "args": {"name": "CPU %d" % cpu}} for cpu in range(cpus)]
+    for _ in range(cpus):
+        (count,) = struct.unpack_from("<I", data, offset)
+        offset += 4
+        for _ in range(count):
+            tsc, event_id, cpu, arg0, arg1, _ = struct.unpack_from("<QHHIII", data, offset)
+            offset += event_size
+            name, phase = event_name(event_id, arg0)
+            event = {
+                "name": name,
+                "ph": phase,
+                "ts": (tsc - base_tsc) * 1000.0 / cycles_per_ms,
+                "pid": 0,
+                "tid": cpu,
+                "args": {"arg0": arg0, "arg1": arg1},
+            }
+            if phase == "i":
+                event["s"] = "t"
+            events.append(event)
+
+    return {"displayTimeUnit": "ns", "traceEvents": events}
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as f:
+        json.dump(convert(f.read()), sys.stdout)
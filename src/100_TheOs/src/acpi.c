@@ -0,0 +1,114 @@
+// acpi.c -- Locating ACPI tables through the RSDT/XSDT.
+//
+// Only table discovery lives here; the users (the MADT in apic.c) parse
+// their own tables. Tables are identity mapped on demand with
+// paging_map_mmio(), firmware usually puts them at the top of RAM.
+
+#include "acpi.h"
+#include "memory/memory.h"
+#include "log.h"
+
+static acpi_rsdp_t rsdp_copy;
+static bool rsdp_found = false;
+
+static bool acpi_checksum_ok(const void* data, uint32_t length)
+{
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static bool acpi_signature_is(const char* a, const char* b, int length)
+{
+    for (int i = 0; i < length; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+void acpi_set_rsdp(const void* rsdp, uint32_t size)
+{
+    if (size > sizeof(rsdp_copy)) size = sizeof(rsdp_copy);
+    if (size < 20 || !acpi_checksum_ok(rsdp, 20)) return;
+
+    // Prefer the ACPI 2.0 copy when the bootloader passes both
+    if (rsdp_found && rsdp_copy.revision >= 2 && size < sizeof(rsdp_copy)) return;
+
+    memset(&rsdp_copy, 0, sizeof(rsdp_copy));
+    memcpy(&rsdp_copy, rsdp, size);
+    rsdp_found = true;
+}
+
+// Without a bootloader tag, look where the BIOS puts the RSDP: the first
+// KB of the EBDA and the ROM area 0xE0000-0xFFFFF, on 16 byte boundaries
+static bool acpi_scan_rsdp(void)
+{
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t*)0x40E) << 4;
+    uint32_t ranges[2][2] = {
+        { ebda, ebda + 1024 },
+        { 0xE0000, 0x100000 },
+    };
+
+    for (int r = 0; r < 2; r++) {
+        if (ranges[r][0] == 0) continue;
+        for (uint32_t addr = ranges[r][0]; addr < ranges[r][1]; addr += 16) {
+            const acpi_rsdp_t* candidate = (const acpi_rsdp_t*)addr;
+            if (acpi_signature_is(candidate->signature, "RSD PTR ", 8) &&
+                acpi_checksum_ok(candidate, 20)) {
+                acpi_set_rsdp(candidate, candidate->revision >= 2 ? sizeof(acpi_rsdp_t) : 20);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Map a table and check it, NULL if it is not usable
+static const acpi_sdt_header_t* acpi_map_table(uint32_t address)
+{
+    if (address == 0) return NULL;
+
+    paging_map_mmio(address, sizeof(acpi_sdt_header_t));
+    const acpi_sdt_header_t* table = (const acpi_sdt_header_t*)address;
+    paging_map_mmio(address, table->length);
+
+    if (!acpi_checksum_ok(table, table->length)) {
+        LOG_WARN("acpi", "Bad checksum on table at 0x%x\n", address);
+        return NULL;
+    }
+    return table;
+}
+
+const acpi_sdt_header_t* acpi_find_table(const char* signature)
+{
+    if (!rsdp_found && !acpi_scan_rsdp()) {
+        return NULL;
+    }
+
+    // The XSDT has 64-bit entries; we can only reach tables below 4 GB
+    bool use_xsdt = rsdp_copy.revision >= 2 && rsdp_copy.xsdt_address != 0 &&
+                    (rsdp_copy.xsdt_address >> 32) == 0;
+    const acpi_sdt_header_t* root = acpi_map_table(use_xsdt ? (uint32_t)rsdp_copy.xsdt_address
+                                                            : rsdp_copy.rsdt_address);
+    if (root == NULL) return NULL;
+
+    uint32_t entry_size = use_xsdt ? 8 : 4;
+    uint32_t count = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    const uint8_t* entries = (const uint8_t*)(root + 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* entry = entries + i * entry_size;
+        uint32_t address = *(const uint32_t*)entry;
+        if (use_xsdt && *(const uint32_t*)(entry + 4) != 0) continue;
+
+        paging_map_mmio(address, sizeof(acpi_sdt_header_t));
+        const acpi_sdt_header_t* table = (const acpi_sdt_header_t*)address;
+        if (acpi_signature_is(table->signature, signature, 4)) {
+            return acpi_map_table(address);
+        }
+    }
+    return NULL;
+}
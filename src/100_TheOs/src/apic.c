@@ -0,0 +1,272 @@
+// apic.c -- Local APIC and I/O APIC setup from the ACPI MADT.
+//
+// The legacy IRQs keep their vectors (32 + IRQ) so drivers do not notice
+// which controller delivers them. ISA IRQs are mapped to I/O APIC inputs
+// through the MADT's interrupt source overrides (QEMU moves the PIT to
+// GSI 2, for example).
+
+#include "apic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "memory/memory.h"
+#include "log.h"
+
+extern void terminal_printf(const char* format, ...);
+
+// MADT entry types
+#define MADT_LOCAL_APIC          0
+#define MADT_IO_APIC             1
+#define MADT_SOURCE_OVERRIDE     2
+#define MADT_LOCAL_APIC_OVERRIDE 5
+
+// I/O APIC registers, selected through IOREGSEL and accessed via IOWIN
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REG_REDIR   0x10
+
+// Redirection entry bits
+#define IOAPIC_ACTIVE_LOW    (1 << 13)
+#define IOAPIC_LEVEL_TRIGGER (1 << 15)
+#define IOAPIC_MASKED        (1 << 16)
+
+#define ISA_IRQ_COUNT 16
+#define NO_GSI 0xFFFFFFFF
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct {
+    volatile uint32_t* base;
+    uint8_t id;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+} ioapic_t;
+
+bool apic_enabled = false;
+volatile uint32_t* lapic_base = NULL;
+
+uint8_t apic_cpu_ids[APIC_MAX_CPUS];
+int apic_cpu_count = 0;
+
+// Device interrupts all go to the boot CPU
+static uint8_t bsp_apic_id = 0;
+
+static ioapic_t ioapics[APIC_MAX_IOAPICS];
+static int ioapic_count = 0;
+
+// Where each ISA IRQ arrives at the I/O APICs, with its polarity and
+// trigger mode (0 for the ISA default: active high, edge)
+static uint32_t isa_gsi[ISA_IRQ_COUNT];
+static uint32_t isa_flags[ISA_IRQ_COUNT];
+
+static uint32_t ioapic_read(const ioapic_t* io, uint8_t reg)
+{
+    io->base[0] = reg;
+    return io->base[4];
+}
+
+static void ioapic_write(const ioapic_t* io, uint8_t reg, uint32_t value)
+{
+    io->base[0] = reg;
+    io->base[4] = value;
+}
+
+static const ioapic_t* ioapic_for_gsi(uint32_t gsi)
+{
+    for (int i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_count) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+static void apic_parse_madt(const acpi_madt_t* madt)
+{
+    lapic_base = (volatile uint32_t*)madt->lapic_address;
+
+    const uint8_t* p = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (p + sizeof(madt_entry_t) <= end) {
+        const madt_entry_t* entry = (const madt_entry_t*)p;
+        if (entry->length < sizeof(madt_entry_t)) break;
+
+        switch (entry->type) {
+            case MADT_LOCAL_APIC:
+                // processor id, APIC id, flags (bit 0: enabled)
+                if ((*(const uint32_t*)(p + 4) & 1) && apic_cpu_count < APIC_MAX_CPUS) {
+                    apic_cpu_ids[apic_cpu_count++] = p[3];
+                }
+                break;
+            case MADT_IO_APIC:
+                // id, reserved, address, GSI base
+                if (ioapic_count < APIC_MAX_IOAPICS) {
+                    ioapic_t* io = &ioapics[ioapic_count++];
+                    io->id = p[2];
+                    io->base = (volatile uint32_t*)*(const uint32_t*)(p + 4);
+                    io->gsi_base = *(const uint32_t*)(p + 8);
+                }
+                break;
+            case MADT_SOURCE_OVERRIDE: {
+                // bus, ISA IRQ, GSI, MPS flags
+                uint8_t irq = p[3];
+                uint16_t mps = *(const uint16_t*)(p + 8);
+                if (irq < ISA_IRQ_COUNT) {
+                    isa_gsi[irq] = *(const uint32_t*)(p + 4);
+                    isa_flags[irq] = 0;
+                    if ((mps & 0x3) == 0x3) isa_flags[irq] |= IOAPIC_ACTIVE_LOW;
+                    if (((mps >> 2) & 0x3) == 0x3) isa_flags[irq] |= IOAPIC_LEVEL_TRIGGER;
+                }
+                break;
+            }
+            case MADT_LOCAL_APIC_OVERRIDE: {
+                uint64_t address = *(const uint64_t*)(p + 4);
+                if ((address >> 32) == 0) {
+                    lapic_base = (volatile uint32_t*)(uint32_t)address;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        p += entry->length;
+    }
+}
+
+static void apic_spurious_handler(registers_t* regs, void* context)
+{
+    // Nothing to do, and no EOI for spurious interrupts
+}
+
+// Redirection entry for an ISA IRQ, delivered to the boot CPU
+static void ioapic_route_isa(uint8_t irq, bool masked)
+{
+    const ioapic_t* io = ioapic_for_gsi(isa_gsi[irq]);
+    if (io == NULL) return;
+
+    uint8_t pin = isa_gsi[irq] - io->gsi_base;
+    uint32_t low = (IRQ0 + irq) | isa_flags[irq] | (masked ? IOAPIC_MASKED : 0);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2 + 1, (uint32_t)bsp_apic_id << 24);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, low);
+}
+
+void apic_set_irq_mask(uint8_t irq, bool masked)
+{
+    if (!apic_enabled || irq >= ISA_IRQ_COUNT) return;
+    ioapic_route_isa(irq, masked);
+}
+
+bool apic_irq_gsi(uint8_t irq, uint32_t* gsi)
+{
+    if (!apic_enabled || irq >= ISA_IRQ_COUNT || isa_gsi[irq] == NO_GSI) return false;
+    *gsi = isa_gsi[irq];
+    return true;
+}
+
+// Local APIC registers every processor sets up the same way
+static void lapic_setup(void)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+bool apic_init(void)
+{
+    if (!cpu_has_edx(CPUID_EDX_APIC) || !cpu_has_edx(CPUID_EDX_MSR)) {
+        LOG_INFO("apic", "No local APIC, using the 8259 PIC\n");
+        return false;
+    }
+
+    const acpi_madt_t* madt = (const acpi_madt_t*)acpi_find_table("APIC");
+    if (madt == NULL) {
+        LOG_INFO("apic", "No ACPI MADT, using the 8259 PIC\n");
+        return false;
+    }
+
+    // Identity ISA mapping unless the MADT says otherwise
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        isa_gsi[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+    apic_parse_madt(madt);
+
+    // An override takes the input over; the ISA IRQ that would have used
+    // it by default has no line (QEMU: IRQ0 -> GSI 2, so IRQ2 is gone)
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        if (isa_gsi[irq] == (uint32_t)irq) continue;
+        for (int other = 0; other < ISA_IRQ_COUNT; other++) {
+            if (other != irq && isa_gsi[other] == isa_gsi[irq] && isa_gsi[other] == (uint32_t)other) {
+                isa_gsi[other] = NO_GSI;
+            }
+        }
+    }
+    if (lapic_base == NULL || ioapic_count == 0) {
+        LOG_INFO("apic", "No I/O APIC in the MADT, using the 8259 PIC\n");
+        return false;
+    }
+
+    // Map the register pages and size each I/O APIC
+    paging_map_mmio((uint32_t)lapic_base, 4096);
+    for (int i = 0; i < ioapic_count; i++) {
+        paging_map_mmio((uint32_t)ioapics[i].base, 4096);
+        ioapics[i].gsi_count = ((ioapic_read(&ioapics[i], IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < ioapics[i].gsi_count; pin++) {
+            ioapic_write(&ioapics[i], IOAPIC_REG_REDIR + pin * 2, IOAPIC_MASKED);
+        }
+    }
+
+    // Make sure the local APIC is globally enabled at its MMIO address
+    uint64_t base_msr = rdmsr(MSR_APIC_BASE);
+    wrmsr(MSR_APIC_BASE, (base_msr & 0xFFF) | (1 << 11) | (uint32_t)lapic_base);
+
+    load_interrupt_controller(APIC_SPURIOUS_VECTOR, apic_spurious_handler, NULL);
+    lapic_setup();
+    bsp_apic_id = lapic_id();
+
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        ioapic_route_isa(irq, true);
+    }
+
+    apic_enabled = true;
+    LOG_INFO("apic", "Local APIC %d at 0x%x, %d I/O APIC(s), %d CPU(s)\n",
+             lapic_id(), (uint32_t)lapic_base, ioapic_count, apic_cpu_count);
+    return true;
+}
+
+void apic_init_ap(void)
+{
+    uint64_t base_msr = rdmsr(MSR_APIC_BASE);
+    wrmsr(MSR_APIC_BASE, (base_msr & 0xFFF) | (1 << 11) | (uint32_t)lapic_base);
+    lapic_setup();
+}
+
+void apic_print_info(void)
+{
+    if (!apic_enabled) {
+        terminal_printf("Interrupt controller: 8259 PIC\n");
+        return;
+    }
+
+    terminal_printf("Interrupt controller: local APIC %d (version 0x%x) at 0x%x\n",
+                    lapic_id(), lapic_read(LAPIC_VERSION) & 0xFF, (uint32_t)lapic_base);
+    for (int i = 0; i < ioapic_count; i++) {
+        terminal_printf("I/O APIC %d at 0x%x: GSI %d-%d\n", ioapics[i].id, (uint32_t)ioapics[i].base,
+                        ioapics[i].gsi_base, ioapics[i].gsi_base + ioapics[i].gsi_count - 1);
+    }
+    terminal_printf("CPUs in MADT: %d\n", apic_cpu_count);
+    for (int irq = 0; irq < ISA_IRQ_COUNT; irq++) {
+        if (isa_gsi[irq] != (uint32_t)irq && isa_gsi[irq] != NO_GSI) {
+            terminal_printf("  IRQ%d -> GSI %d\n", irq, isa_gsi[irq]);
+        }
+    }
+}
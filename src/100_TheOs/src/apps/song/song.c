@@ -3,6 +3,7 @@
 #include "pit.h"
 #include "common.h"
 #include "libc/stdio.h"
+#include "log.h"
 
 void enable_speaker(){
     // Read the current state of the PC speaker control register
@@ -56,7 +57,7 @@ void play_song_impl(Song *song) {
     enable_speaker();
     for (uint32_t i = 0; i < song->length; i++) {
         Note* note = &song->notes[i];
-        printf("Note: %d, Freq=%d, Sleep=%d\n", i, note->frequency, note->duration);
+        LOG_DEBUG("song", "Note: %d, Freq=%d, Sleep=%d\n", i, note->frequency, note->duration);
         play_sound(note->frequency);
         sleep_interrupt(note->duration);
         stop_sound();
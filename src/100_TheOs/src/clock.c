@@ -0,0 +1,586 @@
+// clock.c -- Time since boot and the timer interrupt, periodic or tickless.
+//
+// Early in boot clock_calibrate_tsc() times the TSC against PIT channel
+// 2, which needs no interrupts, and from then on ktime_get_ns() and the
+// udelay()/ndelay() busy-waits run off the TSC.
+//
+// The PIT starts out interrupting TARGET_FREQUENCY times a second and its
+// tick count is the millisecond clock. clock_init() then goes tickless:
+// time is read from a free-running clocksource (an invariant TSC, else
+// the HPET main counter, else a TSC that may drift) and an event timer
+// (local APIC timer, else HPET comparator, else PIT) is programmed
+// one-shot for the nearest deadline passed to clock_arm(). An idle
+// machine takes one timer interrupt per CLOCK_IDLE_MS instead of a
+// thousand a second.
+
+#include "clock.h"
+#include "pit.h"
+#include "apic.h"
+#include "irq.h"
+#include "timer.h"
+#include "hpet.h"
+#include "thread.h"
+#include "percpu.h"
+#include "cpu.h"
+#include "common.h"
+#include "trace.h"
+#include "log.h"
+#include "libc/div64.h"
+
+extern void terminal_printf(const char* format, ...);
+
+// Channel 2 calibration: CLOCK_CALIBRATE_RUNS gates of CLOCK_CALIBRATE_MS,
+// the median is kept so one run disturbed by an SMI or the host does not
+// skew the result
+#define CLOCK_CALIBRATE_MS   10
+#define CLOCK_CALIBRATE_RUNS 5
+
+// ns = counts * mult >> NS_SHIFT, exact enough for clocks from 1 MHz up
+#define NS_SHIFT 22
+
+// clock_jitter_benchmark(): one-shots of JITTER_US, timed with the TSC
+#define JITTER_ROUNDS 100
+#define JITTER_US     1000
+
+// 0xFFFF PIT counts are 54.9 ms; longer waits take several one-shots
+#define PIT_ONESHOT_MAX_US 54000
+
+enum {
+    CLOCKSOURCE_PIT_TICK,
+    CLOCKSOURCE_TSC,
+    CLOCKSOURCE_HPET,
+};
+
+static const char* clocksource_names[] = {
+    [CLOCKSOURCE_PIT_TICK] = "PIT tick",
+    [CLOCKSOURCE_TSC] = "TSC",
+    [CLOCKSOURCE_HPET] = "HPET",
+};
+
+enum {
+    CLOCK_EVENT_PIT_PERIODIC,
+    CLOCK_EVENT_PIT_ONESHOT,
+    CLOCK_EVENT_HPET,
+    CLOCK_EVENT_LAPIC,
+};
+
+static const char* clock_event_names[] = {
+    [CLOCK_EVENT_PIT_PERIODIC] = "PIT periodic",
+    [CLOCK_EVENT_PIT_ONESHOT] = "PIT one-shot",
+    [CLOCK_EVENT_HPET] = "HPET comparator one-shot",
+    [CLOCK_EVENT_LAPIC] = "local APIC timer one-shot",
+};
+
+bool clock_tickless = false;
+uint32_t clock_events = 0;
+
+static int clock_event_device = CLOCK_EVENT_PIT_PERIODIC;
+static uint32_t tsc_per_ms = 0;
+static uint32_t tsc_ns_mult = 0;
+static bool tsc_invariant = false;
+static uint32_t lapic_per_ms = 0;
+
+// The clocksource in use, counts per millisecond and the ns multiplier
+static int clocksource = CLOCKSOURCE_PIT_TICK;
+static uint32_t cs_per_ms = 0;
+static uint32_t cs_ns_mult = 0;
+
+// ktime_get_ns() is ns_base plus the clocksource counts since ns_counts
+static uint64_t ns_base = 0;
+static uint64_t ns_counts = 0;
+
+// Clocksource count and millisecond count when the clock went tickless
+static uint64_t base_counts = 0;
+static uint32_t base_ms = 0;
+
+// Nearest deadline asked for, and whether the hardware has an event
+// programmed for it (or for an earlier step towards it)
+static bool clock_armed = false;
+static uint32_t clock_deadline = 0;
+static bool clock_programmed = false;
+
+static uint32_t tickless_events_base = 0;
+
+// Set while clock_jitter_benchmark() owns the event timers
+static volatile bool jitter_active = false;
+static volatile bool jitter_fired = false;
+static volatile uint64_t jitter_tsc = 0;
+
+static inline uint64_t cs_read(void)
+{
+    return clocksource == CLOCKSOURCE_HPET ? hpet_read_counter() : rdtsc();
+}
+
+static uint64_t counts_to_ns(uint64_t counts, uint32_t mult)
+{
+    // 64x32 bit multiply in two halves, i386 has no 96 bit product
+    uint64_t low = (uint64_t)(uint32_t)counts * mult;
+    uint64_t high = (counts >> 32) * mult;
+    return (high << (32 - NS_SHIFT)) + (low >> NS_SHIFT);
+}
+
+static uint32_t ns_mult_for(uint32_t per_ms)
+{
+    return (uint32_t)div64_32((uint64_t)1000000 << NS_SHIFT, per_ms, NULL);
+}
+
+uint32_t clock_now_ms(void)
+{
+    if (!clock_tickless) {
+        return pit_tick_count() / TICKS_PER_MS;
+    }
+    return base_ms + (uint32_t)div64_32(cs_read() - base_counts, cs_per_ms, NULL);
+}
+
+uint64_t ktime_get_ns(void)
+{
+    if (cs_per_ms == 0) {
+        return (uint64_t)pit_tick_count() / TICKS_PER_MS * 1000000;
+    }
+    return ns_base + counts_to_ns(cs_read() - ns_counts, cs_ns_mult);
+}
+
+uint32_t clock_tsc_khz(void)
+{
+    return tsc_per_ms;
+}
+
+uint32_t clock_lapic_per_ms(void)
+{
+    return lapic_per_ms;
+}
+
+void ndelay(uint32_t ns)
+{
+    if (cs_per_ms == 0) {
+        // Port 0x80 writes take about a microsecond on PC hardware
+        for (uint32_t us = (ns + 999) / 1000; us > 0; us--) {
+            outb(0x80, 0);
+        }
+        return;
+    }
+
+    uint64_t counts = div64_32((uint64_t)ns * cs_per_ms, 1000000, NULL);
+    uint64_t start = cs_read();
+    while (cs_read() - start < counts) {
+        asm volatile("pause");
+    }
+}
+
+void udelay(uint32_t us)
+{
+    // Whole milliseconds at a time, so us * 1000 cannot overflow
+    while (us >= 1000) {
+        ndelay(1000000);
+        us -= 1000;
+    }
+    ndelay(us * 1000);
+}
+
+// One channel 2 gate of CLOCK_CALIBRATE_MS, in TSC cycles
+static uint64_t clock_measure_tsc(void)
+{
+    uint32_t latch = PIT_BASE_FREQUENCY / 1000 * CLOCK_CALIBRATE_MS;
+
+    // Gate high, speaker off, then channel 2 in mode 0: OUT2 rises once
+    // the count runs out
+    outb(PC_SPEAKER_PORT, (inb(PC_SPEAKER_PORT) & ~0x02) | 0x01);
+    outb(PIT_CMD_PORT, 0xB0);  // channel 2, access mode low/high, mode 0, binary
+    outb(PIT_CHANNEL2_PORT, latch & 0xFF);
+    outb(PIT_CHANNEL2_PORT, (latch >> 8) & 0xFF);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PC_SPEAKER_PORT) & 0x20)) {}
+    return rdtsc() - start;
+}
+
+void clock_calibrate_tsc(void)
+{
+    if (!cpu_has_edx(CPUID_EDX_TSC)) {
+        LOG_INFO("clock", "No TSC, delays use port I/O\n");
+        return;
+    }
+
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    uint8_t speaker = inb(PC_SPEAKER_PORT);
+
+    uint64_t runs[CLOCK_CALIBRATE_RUNS];
+    for (int i = 0; i < CLOCK_CALIBRATE_RUNS; i++) {
+        uint64_t cycles = clock_measure_tsc();
+        int j = i;
+        for (; j > 0 && runs[j - 1] > cycles; j--) {
+            runs[j] = runs[j - 1];
+        }
+        runs[j] = cycles;
+    }
+
+    outb(PC_SPEAKER_PORT, speaker);
+    ns_counts = rdtsc();
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+
+    // The latch is not quite CLOCK_CALIBRATE_MS (PIT_BASE_FREQUENCY does
+    // not divide by 1000), so scale by the PIT rate itself
+    uint32_t latch = PIT_BASE_FREQUENCY / 1000 * CLOCK_CALIBRATE_MS;
+    uint64_t median = runs[CLOCK_CALIBRATE_RUNS / 2];
+    tsc_per_ms = (uint32_t)div64_32(median * PIT_BASE_FREQUENCY, latch * 1000, NULL);
+    tsc_ns_mult = ns_mult_for(tsc_per_ms);
+
+    clocksource = CLOCKSOURCE_TSC;
+    cs_per_ms = tsc_per_ms;
+    cs_ns_mult = tsc_ns_mult;
+
+    // CPUID 0x80000007 EDX bit 8: the rate does not change with P- or
+    // C-states
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        tsc_invariant = (edx & (1 << 8)) != 0;
+    }
+
+    LOG_INFO("clock", "TSC %u kHz%s (PIT channel 2, spread %u cycles)\n", tsc_per_ms,
+             tsc_invariant ? ", invariant" : "", (uint32_t)(runs[CLOCK_CALIBRATE_RUNS - 1] - runs[0]));
+}
+
+// One-shot on the given event timer, us from now
+static void clock_device_program(int device, uint32_t us)
+{
+    if (device == CLOCK_EVENT_LAPIC) {
+        uint32_t counts = (uint32_t)div64_32((uint64_t)us * lapic_per_ms, 1000, NULL);
+        lapic_write(LAPIC_TIMER_INIT, counts ? counts : 1);
+    } else if (device == CLOCK_EVENT_HPET) {
+        hpet_set_oneshot((uint32_t)div64_32((uint64_t)us * hpet_counts_per_ms(), 1000, NULL));
+    } else {
+        if (us > PIT_ONESHOT_MAX_US) us = PIT_ONESHOT_MAX_US;
+        uint32_t counts = us * (PIT_BASE_FREQUENCY / 1000) / 1000;
+        pit_set_oneshot(counts ? counts : 1);
+    }
+}
+
+static void clock_device_stop(int device)
+{
+    if (device == CLOCK_EVENT_LAPIC) {
+        lapic_write(LAPIC_TIMER_INIT, 0);
+    } else if (device == CLOCK_EVENT_HPET) {
+        hpet_stop();
+    } else {
+        // Channel 0 cannot be stopped, push its edge out 55 ms
+        pit_set_oneshot(0xFFFF);
+    }
+}
+
+// Program the one-shot for deadline, or as close to it as the hardware
+// reaches. Interrupts must be off.
+static void clock_program(uint32_t deadline)
+{
+    uint64_t target = base_counts + (uint64_t)(deadline - base_ms) * cs_per_ms;
+    uint64_t now = cs_read();
+    uint32_t us = 0;
+    if ((int64_t)(target - now) > 0) {
+        uint64_t counts = target - now;
+        uint64_t limit = (uint64_t)CLOCK_IDLE_MS * cs_per_ms;
+        if (counts > limit) counts = limit;
+        us = (uint32_t)div64_32(counts * 1000, cs_per_ms, NULL);
+    }
+
+    clock_device_program(clock_event_device, us);
+    clock_programmed = true;
+}
+
+void clock_arm(uint32_t deadline)
+{
+    if (!clock_tickless) {
+        return;  // The periodic tick comes anyway
+    }
+    if (this_cpu_index() != 0) {
+        return;  // Other processors tick every millisecond while busy
+    }
+
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+
+    if (!clock_armed || (int32_t)(deadline - clock_deadline) < 0) {
+        clock_deadline = deadline;
+        clock_armed = true;
+        clock_program(deadline);
+    }
+
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+uint32_t clock_next_event_ms(void)
+{
+    if (!clock_tickless) {
+        return 1000 / TARGET_FREQUENCY;
+    }
+    if (!clock_armed) {
+        return CLOCK_IDLE_MS;
+    }
+    int32_t left = (int32_t)(clock_deadline - clock_now_ms());
+    if (left < 0) left = 0;
+    if (clock_event_device == CLOCK_EVENT_PIT_ONESHOT && left > PIT_ONESHOT_MAX_US / 1000) {
+        left = PIT_ONESHOT_MAX_US / 1000;
+    }
+    return left;
+}
+
+void clock_event(registers_t* regs)
+{
+    if (jitter_active) {
+        jitter_tsc = rdtsc();
+        jitter_fired = true;
+        return;
+    }
+
+    clock_events++;
+    uint32_t now = clock_now_ms();
+    trace_event(TRACE_PIT_TICK, now, 0);
+
+    if (clock_tickless) {
+        clock_programmed = false;
+        if (clock_armed && (int32_t)(now - clock_deadline) >= 0) {
+            clock_armed = false;
+        }
+    }
+
+    irq_poll_throttled(regs);
+    timer_run(now);
+    sched_clock(now);
+
+    if (clock_tickless && !clock_programmed) {
+        // Deadline not reached yet (PIT range), or nothing pending
+        if (!clock_armed) {
+            clock_deadline = now + CLOCK_IDLE_MS;
+            clock_armed = true;
+        }
+        clock_program(clock_deadline);
+    }
+}
+
+static void clock_lapic_handler(registers_t* regs, void* context)
+{
+    apic_eoi();
+    clock_event(regs);
+}
+
+// Local APIC timer ticks per millisecond, timed with the clocksource
+static void clock_calibrate_lapic(void)
+{
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    udelay(CLOCK_CALIBRATE_MS * 1000);
+    lapic_per_ms = (0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR)) / CLOCK_CALIBRATE_MS;
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+void clock_init(void)
+{
+    hpet_init();
+
+    // A TSC that changes rate with power states is worse than the HPET
+    if (hpet_present && (cs_per_ms == 0 || !tsc_invariant)) {
+        uint32_t flags;
+        asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+        ns_base = ktime_get_ns();
+        clocksource = CLOCKSOURCE_HPET;
+        cs_per_ms = hpet_counts_per_ms();
+        cs_ns_mult = ns_mult_for(cs_per_ms);
+        ns_counts = cs_read();
+        asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+    }
+
+    if (cs_per_ms == 0) {
+        LOG_INFO("clock", "No clocksource, staying on the %d Hz PIT tick\n", TARGET_FREQUENCY);
+        return;
+    }
+
+    if (apic_enabled) {
+        clock_calibrate_lapic();
+    }
+
+    asm volatile("cli");
+    base_ms = clock_now_ms();
+    base_counts = cs_read();
+
+    if (apic_enabled && lapic_per_ms > 0) {
+        // The PIT goes quiet: one last one-shot, and IRQ0 masked
+        clock_event_device = CLOCK_EVENT_LAPIC;
+        load_interrupt_controller(APIC_TIMER_VECTOR, clock_lapic_handler, NULL);
+        pit_set_oneshot(0xFFFF);
+        irq_mask(0);
+        lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+    } else if (hpet_events_available()) {
+        // Arrives as IRQ0 like the PIT did
+        clock_event_device = CLOCK_EVENT_HPET;
+        pit_set_oneshot(0xFFFF);
+        hpet_enable_events();
+    } else {
+        clock_event_device = CLOCK_EVENT_PIT_ONESHOT;
+    }
+
+    clock_tickless = true;
+    tickless_events_base = clock_events;
+    clock_deadline = base_ms + CLOCK_IDLE_MS;
+    clock_armed = true;
+    clock_program(clock_deadline);
+    asm volatile("sti");
+
+    LOG_INFO("clock", "Tickless, %s clocksource, events from the %s\n",
+             clocksource_names[clocksource], clock_event_names[clock_event_device]);
+}
+
+void clock_print_info(void)
+{
+    terminal_printf("Clock source: %s\n", clock_tickless ? clocksource_names[clocksource] : "PIT tick");
+    if (tsc_per_ms > 0) {
+        terminal_printf("TSC: %u kHz%s\n", tsc_per_ms, tsc_invariant ? ", invariant" : "");
+    }
+    if (hpet_present) {
+        hpet_print_info();
+    }
+    if (lapic_per_ms > 0) {
+        terminal_printf("Local APIC timer: %u counts/ms (divide by 16)\n", lapic_per_ms);
+    }
+    terminal_printf("Timer events: %s, %u interrupts\n",
+                    clock_event_names[clock_event_device], clock_events);
+
+    uint32_t seconds = (clock_now_ms() - base_ms) / 1000;
+    if (clock_tickless && seconds > 0) {
+        terminal_printf("Since tickless: %u interrupts/s\n",
+                        (clock_events - tickless_events_base) / seconds);
+    }
+}
+
+// Error of JITTER_ROUNDS one-shots of JITTER_US on one device, in ns
+// against the TSC. Polls with interrupts on instead of halting, so a
+// device that never fires cannot hang the shell.
+static bool clock_jitter_run(int device, int32_t* min, int32_t* avg, int32_t* max)
+{
+    uint64_t timeout = (uint64_t)tsc_per_ms * 100;
+    int64_t total = 0;
+    *min = 0x7FFFFFFF;
+    *max = -0x7FFFFFFF;
+
+    for (int round = 0; round < JITTER_ROUNDS; round++) {
+        asm volatile("cli");
+        if (device != CLOCK_EVENT_PIT_ONESHOT) {
+            pit_set_oneshot(0xFFFF);  // Keep the PIT off the shared IRQ0
+        }
+        jitter_fired = false;
+        uint64_t start = rdtsc();
+        clock_device_program(device, JITTER_US);
+        asm volatile("sti");
+        while (!jitter_fired && rdtsc() - start < timeout) {
+            asm volatile("pause");
+        }
+        if (!jitter_fired) {
+            clock_device_stop(device);
+            return false;
+        }
+
+        int32_t error = (int32_t)counts_to_ns(jitter_tsc - start, tsc_ns_mult) - JITTER_US * 1000;
+        if (error < *min) *min = error;
+        if (error > *max) *max = error;
+        total += error;
+    }
+    // No 64-bit signed division without libgcc
+    uint32_t magnitude = (uint32_t)div64_32(total < 0 ? -total : total, JITTER_ROUNDS, NULL);
+    *avg = total < 0 ? -(int32_t)magnitude : (int32_t)magnitude;
+    return true;
+}
+
+static void clock_jitter_report(const char* name, int device)
+{
+    int32_t min, avg, max;
+    if (clock_jitter_run(device, &min, &avg, &max)) {
+        terminal_printf("  %s: min %d, avg %d, max %d ns\n", name, min, avg, max);
+    } else {
+        terminal_printf("  %s: no interrupt within 100 ms\n", name);
+    }
+}
+
+// Cycles per read of each clocksource, over 1000 reads
+static uint32_t clock_read_cost(int source)
+{
+    uint64_t start = rdtsc();
+    for (int i = 0; i < 1000; i++) {
+        if (source == CLOCKSOURCE_HPET) {
+            hpet_read_counter();
+        } else if (source == CLOCKSOURCE_PIT_TICK) {
+            outb(PIT_CMD_PORT, 0x00);  // Latch channel 0
+            inb(PIT_CHANNEL0_PORT);
+            inb(PIT_CHANNEL0_PORT);
+        } else {
+            rdtsc();
+        }
+    }
+    return (uint32_t)div64_32(rdtsc() - start, 1000, NULL);
+}
+
+void clock_jitter_benchmark(void)
+{
+    if (tsc_per_ms == 0 || !clock_tickless) {
+        terminal_printf("Needs a calibrated TSC and tickless mode\n");
+        return;
+    }
+
+    terminal_printf("One-shot error, %d x %d us:\n", JITTER_ROUNDS, JITTER_US);
+
+    asm volatile("cli");
+    jitter_active = true;
+    clock_device_stop(clock_event_device);
+    if (clock_event_device == CLOCK_EVENT_LAPIC) {
+        irq_unmask(0);
+    }
+    asm volatile("sti");
+
+    // With legacy replacement the PIT no longer reaches IRQ0
+    bool hpet_active = clock_event_device == CLOCK_EVENT_HPET;
+    if (!(hpet_active && hpet_legacy_routing())) {
+        clock_jitter_report("PIT  ", CLOCK_EVENT_PIT_ONESHOT);
+    }
+
+    if (hpet_events_available() && (hpet_active || !hpet_legacy_routing())) {
+        if (!hpet_active) hpet_enable_events();
+        clock_jitter_report("HPET ", CLOCK_EVENT_HPET);
+        hpet_stop();
+    } else if (hpet_present) {
+        terminal_printf("  HPET : comparator needs legacy replacement, skipped\n");
+    }
+
+    if (lapic_per_ms > 0) {
+        if (clock_event_device != CLOCK_EVENT_LAPIC) {
+            load_interrupt_controller(APIC_TIMER_VECTOR, clock_lapic_handler, NULL);
+        }
+        lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+        clock_jitter_report("LAPIC", CLOCK_EVENT_LAPIC);
+        if (clock_event_device != CLOCK_EVENT_LAPIC) {
+            lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | APIC_TIMER_VECTOR);
+        }
+    }
+
+    // Back to the normal event device
+    asm volatile("cli");
+    jitter_active = false;
+    if (clock_event_device == CLOCK_EVENT_LAPIC) {
+        pit_set_oneshot(0xFFFF);
+        irq_mask(0);
+    } else if (clock_event_device == CLOCK_EVENT_HPET) {
+        pit_set_oneshot(0xFFFF);
+    }
+    if (!clock_armed) {
+        clock_deadline = clock_now_ms() + CLOCK_IDLE_MS;
+        clock_armed = true;
+    }
+    clock_program(clock_deadline);
+    asm volatile("sti");
+
+    terminal_printf("Read cost: TSC %u, PIT latch %u", clock_read_cost(CLOCKSOURCE_TSC),
+                    clock_read_cost(CLOCKSOURCE_PIT_TICK));
+    if (hpet_present) {
+        terminal_printf(", HPET %u", clock_read_cost(CLOCKSOURCE_HPET));
+    }
+    terminal_printf(" cycles\n");
+}
@@ -20,4 +20,23 @@ uint16_t inw(uint16_t port)
    uint16_t ret;
    asm volatile ("inw %1, %0" : "=a" (ret) : "dN" (port));
    return ret;
-}
\ No newline at end of file
+}
+// Send a word (2 bytes) to I/O port
+void outw(uint16_t port, uint16_t value)
+{
+    asm volatile ("outw %1, %0" : : "dN" (port), "a" (value));
+}
+
+// Send a double word (4 bytes) to I/O port
+void outl(uint16_t port, uint32_t value)
+{
+    asm volatile ("outl %1, %0" : : "dN" (port), "a" (value));
+}
+
+// Read a double word (4 bytes) from I/O port
+uint32_t inl(uint16_t port)
+{
+   uint32_t ret;
+   asm volatile ("inl %1, %0" : "=a" (ret) : "dN" (port));
+   return ret;
+}
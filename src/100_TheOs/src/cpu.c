@@ -0,0 +1,58 @@
+// cpu.c -- CPU feature queries and control register setup.
+
+#include "cpu.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+static bool features_read = false;
+static uint32_t features_edx = 0;
+static uint32_t features_ecx = 0;
+static bool sse_enabled = false;
+
+static void cpu_read_features(void)
+{
+    uint32_t eax, ebx;
+    cpuid(1, &eax, &ebx, &features_ecx, &features_edx);
+    features_read = true;
+}
+
+uint32_t cpu_features_edx(void)
+{
+    if (!features_read) cpu_read_features();
+    return features_edx;
+}
+
+uint32_t cpu_features_ecx(void)
+{
+    if (!features_read) cpu_read_features();
+    return features_ecx;
+}
+
+bool cpu_enable_sse(void)
+{
+    if (sse_enabled) return true;
+    if (!cpu_has_edx(CPUID_EDX_SSE2) || !cpu_has_edx(CPUID_EDX_FXSR)) return false;
+
+    uint32_t cr0, cr4;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP;
+    asm volatile("mov %0, %%cr0" : : "r" (cr0));
+
+    asm volatile("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("mov %0, %%cr4" : : "r" (cr4));
+
+    // No fninit: the registers belong to whichever context fpu.c last
+    // gave them to
+    sse_enabled = true;
+    return true;
+}
+
+bool cpu_sse_enabled(void)
+{
+    return sse_enabled;
+}
@@ -0,0 +1,254 @@
+// fpu.c -- Lazy x87/SSE context switching.
+//
+// Saving 512 bytes of FPU state on every context switch is wasted work
+// when most contexts never touch the FPU. Instead fpu_switch() only sets
+// CR0.TS. The first FPU or SSE instruction after that raises #NM
+// (vector 7); the handler saves the registers for whoever owns them,
+// loads the current context's and clears TS. Switching away and back
+// without using the FPU in between costs no trap at all.
+//
+// Each processor has its own registers, so the current context and the
+// owner are per CPU. Once threads can move between processors, a thread
+// must not leave its state behind in another CPU's registers: from then
+// on the owner is saved at every switch and only the restore stays lazy.
+
+#include "fpu.h"
+#include "cpu.h"
+#include "interrupts.h"
+#include "smp.h"
+#include "percpu.h"
+#include "log.h"
+#include "libc/div64.h"
+
+extern void terminal_printf(const char* format, ...);
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+#define FPU_VECTOR 7
+
+fpu_context_t fpu_kernel_context;
+
+static bool fpu_present = false;
+static bool fpu_fxsr = false;
+
+// The context that is running and the one whose state is in the FPU
+// registers right now are per CPU (percpu_t). They differ while CR0.TS
+// is set.
+
+static inline void fpu_set_ts(void)
+{
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0));
+    asm volatile("mov %0, %%cr0" : : "r" (cr0 | CR0_TS));
+}
+
+static inline void fpu_save(fpu_context_t* ctx)
+{
+    if (fpu_fxsr) {
+        asm volatile("fxsave %0" : "=m" (ctx->state));
+    } else {
+        asm volatile("fnsave %0; fwait" : "=m" (ctx->state));
+    }
+}
+
+static inline void fpu_restore(fpu_context_t* ctx)
+{
+    if (fpu_fxsr) {
+        asm volatile("fxrstor %0" : : "m" (ctx->state));
+    } else {
+        asm volatile("frstor %0" : : "m" (ctx->state));
+    }
+}
+
+static void fpu_nm_handler(registers_t* regs, void* context)
+{
+    fpu_context_t* current = this_cpu_read(fpu_current);
+    fpu_context_t* owner = this_cpu_read(fpu_owner);
+
+    asm volatile("clts");
+    this_cpu_inc(fpu_stats.traps);
+
+    if (owner == current) {
+        return;
+    }
+
+    if (owner) {
+        fpu_save(owner);
+        this_cpu_inc(fpu_stats.saves);
+    }
+
+    if (current->used) {
+        fpu_restore(current);
+        this_cpu_inc(fpu_stats.restores);
+    } else {
+        asm volatile("fninit");
+        current->used = true;
+        this_cpu_inc(fpu_stats.inits);
+    }
+    this_cpu_write(fpu_owner, current);
+}
+
+// CR0 and CR4 bits for the FPU and SSE on the calling processor
+static void fpu_enable(void)
+{
+    // MP makes wait/fwait honour TS too, NE reports x87 errors as #MF
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0));
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    asm volatile("mov %0, %%cr0" : : "r" (cr0));
+
+    if (fpu_fxsr) {
+        uint32_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r" (cr4));
+        cr4 |= CR4_OSFXSR;
+        if (cpu_has_edx(CPUID_EDX_SSE)) cr4 |= CR4_OSXMMEXCPT;
+        asm volatile("mov %0, %%cr4" : : "r" (cr4));
+    }
+}
+
+void fpu_init(void)
+{
+    if (!cpu_has_edx(CPUID_EDX_FPU)) {
+        LOG_INFO("fpu", "no FPU\n");
+        return;
+    }
+
+    fpu_fxsr = cpu_has_edx(CPUID_EDX_FXSR);
+    fpu_enable();
+
+    load_interrupt_controller(FPU_VECTOR, fpu_nm_handler, NULL);
+
+    // The kernel owns the FPU from here on
+    asm volatile("fninit");
+    fpu_kernel_context.used = true;
+    this_cpu_write(fpu_current, &fpu_kernel_context);
+    this_cpu_write(fpu_owner, &fpu_kernel_context);
+    fpu_present = true;
+
+    LOG_INFO("fpu", "lazy switching with %s\n", fpu_fxsr ? "fxsave" : "fnsave");
+}
+
+void fpu_init_ap(fpu_context_t* ctx)
+{
+    if (!fpu_present) {
+        return;
+    }
+
+    fpu_enable();
+    asm volatile("fninit");
+    ctx->used = true;
+    this_cpu_write(fpu_current, ctx);
+    this_cpu_write(fpu_owner, ctx);
+}
+
+// Write the registers back to their owner, interrupts off. Afterwards no
+// context's state lives only in this CPU's registers.
+static void fpu_save_owner(void)
+{
+    fpu_context_t* owner = this_cpu_read(fpu_owner);
+    if (owner) {
+        asm volatile("clts");
+        fpu_save(owner);
+        this_cpu_inc(fpu_stats.saves);
+        this_cpu_write(fpu_owner, NULL);
+        fpu_set_ts();
+    }
+}
+
+void fpu_flush(void)
+{
+    if (!fpu_present) {
+        return;
+    }
+
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    fpu_save_owner();
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void fpu_context_init(fpu_context_t* ctx)
+{
+    ctx->used = false;
+}
+
+void fpu_switch(fpu_context_t* ctx)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+
+    if (!fpu_present || ctx == this_cpu_read(fpu_current)) {
+        asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+        return;
+    }
+
+    // The next thread to run ctx's owner may be on another processor
+    if (smp_active) {
+        fpu_save_owner();
+    }
+
+    this_cpu_inc(fpu_stats.switches);
+    this_cpu_write(fpu_current, ctx);
+    if (ctx == this_cpu_read(fpu_owner)) {
+        // Registers are still this context's, no need to trap
+        asm volatile("clts");
+    } else {
+        fpu_set_ts();
+    }
+
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void fpu_context_release(fpu_context_t* ctx)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+
+    // Its registers die with it, nothing to save
+    for (int cpu = 0; cpu < APIC_MAX_CPUS; cpu++) {
+        if (per_cpu(cpu)->fpu_owner == ctx) {
+            per_cpu(cpu)->fpu_owner = NULL;
+        }
+    }
+    ctx->used = false;
+
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void fpu_print_stats(void)
+{
+    if (!fpu_present) {
+        terminal_printf("No FPU\n");
+        return;
+    }
+
+    // Counted per CPU, summed here
+    fpu_stats_t fpu_stats = { 0 };
+    for (int cpu = 0; cpu < smp_cpus_online; cpu++) {
+        const fpu_stats_t* stats = &per_cpu(cpu)->fpu_stats;
+        fpu_stats.switches += stats->switches;
+        fpu_stats.traps += stats->traps;
+        fpu_stats.saves += stats->saves;
+        fpu_stats.restores += stats->restores;
+        fpu_stats.inits += stats->inits;
+    }
+
+    terminal_printf("FPU switching: lazy, %s\n", fpu_fxsr ? "fxsave/fxrstor" : "fnsave/frstor");
+    terminal_printf("  Context switches: %u\n", fpu_stats.switches);
+    terminal_printf("  #NM traps:        %u\n", fpu_stats.traps);
+    terminal_printf("  State saves:      %u\n", fpu_stats.saves);
+    terminal_printf("  State restores:   %u\n", fpu_stats.restores);
+    terminal_printf("  First uses:       %u\n", fpu_stats.inits);
+    if (fpu_stats.switches > 0) {
+        uint32_t avoided = fpu_stats.switches > fpu_stats.traps ? fpu_stats.switches - fpu_stats.traps : 0;
+        terminal_printf("  Switches without FPU work: %u (%u%%)\n", avoided,
+                        (uint32_t)div64_32((uint64_t)avoided * 100, fpu_stats.switches, NULL));
+    }
+    terminal_printf("  Trap cost: see irqstat %d\n", FPU_VECTOR);
+}
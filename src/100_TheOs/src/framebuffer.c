@@ -0,0 +1,312 @@
+// framebuffer.c -- Linear framebuffer text console.
+//                  Renders the monitor's cell buffer with the 8x16 VGA font.
+
+#include "framebuffer.h"
+#include "memory/memory.h"
+#include "font/vga_font.h"
+
+// Number of colour pairs (attribute bytes) kept pre-rendered at once,
+// enough for the console's text, cleared and status bar colours. Each
+// slot has room for all 256 glyphs expanded to 32-bit pixels (128 KB);
+// a glyph is expanded the first time it is drawn in that colour.
+#define GLYPH_CACHE_SLOTS 4
+#define GLYPH_PIXELS (FB_CELL_WIDTH * FB_CELL_HEIGHT)
+
+static framebuffer_t fb;
+static bool fb_ready = false;
+static size_t fb_cols = 0;
+static size_t fb_rows = 0;
+
+// Cell buffer owned by monitor.c
+static uint16_t* fb_cells = NULL;
+
+// Dirty rectangle in cell coordinates, [x0, x1) x [y0, y1)
+static bool dirty = false;
+static size_t dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+
+// Text rows scrolled since the last flush, applied as one memmove
+static size_t pending_scroll = 0;
+
+// Cursor position requested by the monitor and where it was last drawn
+static size_t cursor_x = 0, cursor_y = 0;
+static bool cursor_drawn = false;
+static size_t cursor_drawn_x = 0, cursor_drawn_y = 0;
+
+// Pre-expanded glyphs, one slot per attribute byte. The least recently
+// used slot is reclaimed on a miss.
+typedef struct {
+    uint16_t attr;              // 0xFFFF when free
+    uint32_t last_used;
+    uint32_t fg_pixel;
+    uint32_t bg_pixel;
+    uint32_t expanded[256 / 32];    // Bitmap of glyphs already in pixels
+} glyph_slot_t;
+
+static uint32_t glyph_cache[GLYPH_CACHE_SLOTS][256 * GLYPH_PIXELS];
+static glyph_slot_t glyph_slots[GLYPH_CACHE_SLOTS];
+static uint32_t glyph_cache_clock = 0;
+static int glyph_cache_last = 0;
+
+// Standard VGA text mode palette
+static const uint8_t vga_palette[16][3] = {
+    {0x00, 0x00, 0x00}, {0x00, 0x00, 0xAA}, {0x00, 0xAA, 0x00}, {0x00, 0xAA, 0xAA},
+    {0xAA, 0x00, 0x00}, {0xAA, 0x00, 0xAA}, {0xAA, 0x55, 0x00}, {0xAA, 0xAA, 0xAA},
+    {0x55, 0x55, 0x55}, {0x55, 0x55, 0xFF}, {0x55, 0xFF, 0x55}, {0x55, 0xFF, 0xFF},
+    {0xFF, 0x55, 0x55}, {0xFF, 0x55, 0xFF}, {0xFF, 0xFF, 0x55}, {0xFF, 0xFF, 0xFF},
+};
+
+bool framebuffer_init(struct multiboot_tag_framebuffer* tag) {
+    struct multiboot_tag_framebuffer_common* common = &tag->common;
+
+    // Only direct colour 32-bit surfaces below 4GB are supported, anything
+    // else (including EGA text) keeps using the VGA text backend
+    if (common->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB ||
+        common->framebuffer_bpp != 32 ||
+        (common->framebuffer_addr >> 32) != 0) {
+        return false;
+    }
+
+    fb.base = (uint8_t*)(uint32_t)common->framebuffer_addr;
+    fb.pitch = common->framebuffer_pitch;
+    fb.width = common->framebuffer_width;
+    fb.height = common->framebuffer_height;
+    fb.bpp = common->framebuffer_bpp;
+    fb.red_pos = tag->framebuffer_red_field_position;
+    fb.green_pos = tag->framebuffer_green_field_position;
+    fb.blue_pos = tag->framebuffer_blue_field_position;
+
+    fb_cols = fb.width / FB_CELL_WIDTH;
+    fb_rows = fb.height / FB_CELL_HEIGHT;
+    if (fb_cols > FB_MAX_COLS) fb_cols = FB_MAX_COLS;
+    if (fb_rows > FB_MAX_ROWS) fb_rows = FB_MAX_ROWS;
+
+    for (int i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+        glyph_slots[i].attr = 0xFFFF;
+    }
+
+    // The framebuffer normally lives far above the identity mapped 8MB
+    paging_map_mmio((uint32_t)fb.base, fb.pitch * fb.height);
+
+    fb_ready = true;
+    return true;
+}
+
+bool framebuffer_present(void) {
+    return fb_ready;
+}
+
+const framebuffer_t* framebuffer_get(void) {
+    return fb_ready ? &fb : NULL;
+}
+
+uint32_t framebuffer_rgb(uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)r << fb.red_pos) |
+           ((uint32_t)g << fb.green_pos) |
+           ((uint32_t)b << fb.blue_pos);
+}
+
+size_t fb_console_cols(void) {
+    return fb_cols;
+}
+
+size_t fb_console_rows(void) {
+    return fb_rows;
+}
+
+void fb_console_attach(uint16_t* cells) {
+    fb_cells = cells;
+    pending_scroll = 0;
+    cursor_drawn = false;
+    fb_console_mark_all();
+}
+
+// Grow the dirty rectangle to include cell (x, y)
+void fb_console_mark(size_t x, size_t y) {
+    if (!dirty) {
+        dirty_x0 = x;
+        dirty_y0 = y;
+        dirty_x1 = x + 1;
+        dirty_y1 = y + 1;
+        dirty = true;
+        return;
+    }
+    if (x < dirty_x0) dirty_x0 = x;
+    if (y < dirty_y0) dirty_y0 = y;
+    if (x + 1 > dirty_x1) dirty_x1 = x + 1;
+    if (y + 1 > dirty_y1) dirty_y1 = y + 1;
+}
+
+void fb_console_mark_all(void) {
+    dirty = true;
+    dirty_x0 = 0;
+    dirty_y0 = 0;
+    dirty_x1 = fb_cols;
+    dirty_y1 = fb_rows;
+}
+
+// The monitor has moved its cell rows up. The pixels follow on the next
+// flush; everything already dirty moves up with them.
+void fb_console_scroll(size_t lines) {
+    pending_scroll += lines;
+
+    if (cursor_drawn) {
+        if (cursor_drawn_y >= lines) {
+            cursor_drawn_y -= lines;
+        } else {
+            cursor_drawn = false;
+        }
+    }
+
+    if (dirty) {
+        if (dirty_y1 <= lines) {
+            dirty = false;
+        } else {
+            dirty_y0 = dirty_y0 > lines ? dirty_y0 - lines : 0;
+            dirty_y1 -= lines;
+        }
+    }
+}
+
+void fb_console_set_cursor(size_t x, size_t y) {
+    if (cursor_drawn) {
+        fb_console_mark(cursor_drawn_x, cursor_drawn_y);
+    }
+    cursor_x = x;
+    cursor_y = y;
+    if (x < fb_cols && y < fb_rows) {
+        fb_console_mark(x, y);
+    }
+}
+
+// Slot holding an attribute byte, claiming the least recently used one
+// on a miss
+static glyph_slot_t* glyph_slot(uint8_t attr) {
+    glyph_slot_t* slot = &glyph_slots[glyph_cache_last];
+    if (slot->attr == attr) {
+        return slot;
+    }
+
+    glyph_slot_t* victim = &glyph_slots[0];
+    for (int i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+        slot = &glyph_slots[i];
+        if (slot->attr == attr) {
+            slot->last_used = ++glyph_cache_clock;
+            glyph_cache_last = i;
+            return slot;
+        }
+        if (slot->last_used < victim->last_used) {
+            victim = slot;
+        }
+    }
+
+    const uint8_t* fg = vga_palette[attr & 0x0F];
+    const uint8_t* bg = vga_palette[(attr >> 4) & 0x0F];
+    victim->attr = attr;
+    victim->fg_pixel = framebuffer_rgb(fg[0], fg[1], fg[2]);
+    victim->bg_pixel = framebuffer_rgb(bg[0], bg[1], bg[2]);
+    for (int i = 0; i < 256 / 32; i++) {
+        victim->expanded[i] = 0;
+    }
+    victim->last_used = ++glyph_cache_clock;
+    glyph_cache_last = victim - glyph_slots;
+    return victim;
+}
+
+// Return the pixels of a cell entry, expanding the glyph on first use
+static const uint32_t* glyph_lookup(uint16_t entry) {
+    glyph_slot_t* slot = glyph_slot(entry >> 8);
+    uint8_t c = entry & 0xFF;
+    uint32_t* glyph = glyph_cache[slot - glyph_slots] + c * GLYPH_PIXELS;
+    uint32_t bit = 1u << (c & 31);
+    if (slot->expanded[c >> 5] & bit) {
+        return glyph;
+    }
+
+    const uint8_t* font = &vga_font_8x16[c * FB_CELL_HEIGHT];
+    uint32_t* out = glyph;
+    for (int y = 0; y < FB_CELL_HEIGHT; y++) {
+        uint8_t bits = font[y];
+        for (int x = 0; x < FB_CELL_WIDTH; x++) {
+            *out++ = (bits & (0x80 >> x)) ? slot->fg_pixel : slot->bg_pixel;
+        }
+    }
+    slot->expanded[c >> 5] |= bit;
+    return glyph;
+}
+
+// Copy one pre-rendered glyph into the framebuffer: 16 rows of 8 pixels
+static void draw_cell(size_t x, size_t y, uint16_t entry) {
+    const uint32_t* glyph = glyph_lookup(entry);
+    uint8_t* row = fb.base + y * FB_CELL_HEIGHT * fb.pitch + x * FB_CELL_WIDTH * 4;
+
+    for (int line = 0; line < FB_CELL_HEIGHT; line++) {
+        uint32_t* dst = (uint32_t*)row;
+        dst[0] = glyph[0];
+        dst[1] = glyph[1];
+        dst[2] = glyph[2];
+        dst[3] = glyph[3];
+        dst[4] = glyph[4];
+        dst[5] = glyph[5];
+        dst[6] = glyph[6];
+        dst[7] = glyph[7];
+        glyph += FB_CELL_WIDTH;
+        row += fb.pitch;
+    }
+}
+
+// Underline cursor in the cell's foreground colour
+static void draw_cursor(size_t x, size_t y) {
+    uint16_t entry = fb_cells[y * fb_cols + x];
+    const uint8_t* fg = vga_palette[(entry >> 8) & 0x0F];
+    uint32_t pixel = framebuffer_rgb(fg[0], fg[1], fg[2]);
+
+    for (int line = FB_CELL_HEIGHT - 2; line < FB_CELL_HEIGHT; line++) {
+        uint32_t* dst = (uint32_t*)(fb.base + (y * FB_CELL_HEIGHT + line) * fb.pitch
+                                    + x * FB_CELL_WIDTH * 4);
+        for (int i = 0; i < FB_CELL_WIDTH; i++) {
+            dst[i] = pixel;
+        }
+    }
+    cursor_drawn = true;
+    cursor_drawn_x = x;
+    cursor_drawn_y = y;
+}
+
+// Push pending scrolling and dirty cells to the screen
+void fb_console_flush(void) {
+    if (!fb_ready || fb_cells == NULL) return;
+
+    if (pending_scroll) {
+        if (pending_scroll >= fb_rows) {
+            fb_console_mark_all();
+        } else {
+            uint32_t shift = pending_scroll * FB_CELL_HEIGHT * fb.pitch;
+            uint32_t total = fb_rows * FB_CELL_HEIGHT * fb.pitch;
+            memmove(fb.base, fb.base + shift, total - shift);
+        }
+        pending_scroll = 0;
+    }
+
+    if (!dirty) return;
+
+    for (size_t y = dirty_y0; y < dirty_y1; y++) {
+        const uint16_t* line = fb_cells + y * fb_cols;
+        for (size_t x = dirty_x0; x < dirty_x1; x++) {
+            draw_cell(x, y, line[x]);
+        }
+    }
+
+    if (cursor_drawn &&
+        cursor_drawn_x >= dirty_x0 && cursor_drawn_x < dirty_x1 &&
+        cursor_drawn_y >= dirty_y0 && cursor_drawn_y < dirty_y1) {
+        cursor_drawn = false;
+    }
+
+    // Redrawing the cursor cell erased the cursor; put it back
+    if (cursor_x < fb_cols && cursor_y < fb_rows &&
+        cursor_x >= dirty_x0 && cursor_x < dirty_x1 &&
+        cursor_y >= dirty_y0 && cursor_y < dirty_y1) {
+        draw_cursor(cursor_x, cursor_y);
+    }
+    dirty = false;
+}
@@ -0,0 +1,61 @@
+// futex.c -- Wait queues keyed by the physical address of a word.
+//
+// Every futex shares one of FUTEX_HASH_SIZE wait queues with the
+// addresses that hash to the same bucket; a waiter records its address
+// as the wait key and futex_wake() only wakes matching waiters. Nothing
+// is allocated per futex, so any word can be one.
+
+#include "futex.h"
+#include "waitqueue.h"
+#include "atomic.h"
+#include "memory/memory.h"
+
+futex_stats_t futex_stats;
+
+// Unnamed: lock statistics would list FUTEX_HASH_SIZE identical entries
+static wait_queue_t futex_queues[FUTEX_HASH_SIZE];
+
+void futex_init(void)
+{
+    for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+        wait_queue_init(&futex_queues[i], NULL);
+    }
+}
+
+static uint32_t futex_key(volatile uint32_t* addr)
+{
+    return paging_virt_to_phys((uint32_t)addr);
+}
+
+// Fibonacci hashing of the word index
+static wait_queue_t* futex_queue(uint32_t key)
+{
+    return &futex_queues[((key >> 2) * 2654435761u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+uint32_t futex_wait(volatile uint32_t* addr, uint32_t val)
+{
+    uint32_t key = futex_key(addr);
+    wait_queue_t* wq = futex_queue(key);
+
+    // Queued before the word is read: whoever changes it and then calls
+    // futex_wake() either finds us on the queue or we see the new value
+    uint32_t flags = wait_prepare_key(wq, key);
+    bool sleep = *addr == val;
+    if (sleep) {
+        sched_block();
+    }
+    wait_finish(wq, flags);
+
+    atomic_inc(sleep ? &futex_stats.waits : &futex_stats.again);
+    return sleep ? FUTEX_WOKEN : FUTEX_AGAIN;
+}
+
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t n)
+{
+    uint32_t key = futex_key(addr);
+    uint32_t woken = wake_up_key(futex_queue(key), key, n);
+    atomic_inc(&futex_stats.wakes);
+    atomic_fetch_add(&futex_stats.woken, woken);
+    return woken;
+}
@@ -1,35 +1,71 @@
 #include "gdt.h"
 #include "common.h"
+#include "apic.h"
+#include "percpu.h"
 
-struct GdtEntry gdt_entries[3];
+#define GDT_COUNT 7
+
+struct GdtEntry gdt_entries[GDT_COUNT];
 struct GdtPtr gdt_ptr;
+struct TssEntry tss_entry;
+
+// Application processors get their own copy, each with its own TSS
+static struct GdtEntry ap_gdt[APIC_MAX_CPUS][GDT_COUNT];
+static struct GdtPtr ap_gdt_ptr[APIC_MAX_CPUS];
+static struct TssEntry ap_tss[APIC_MAX_CPUS];
 
-static void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
-    gdt_entries[num].base_low = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high = (base >> 24) & 0xFF;
+static void gdt_set_gate(struct GdtEntry* gdt, int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt[num].base_low = (base & 0xFFFF);
+    gdt[num].base_middle = (base >> 16) & 0xFF;
+    gdt[num].base_high = (base >> 24) & 0xFF;
 
-    gdt_entries[num].limit_low = (limit & 0xFFFF);
+    gdt[num].limit_low = (limit & 0xFFFF);
     
-    gdt_entries[num].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    gdt[num].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
     
-    gdt_entries[num].access = access;
+    gdt[num].access = access;
 }
 
-void init_gdt() {
+static void gdt_build(struct GdtEntry* gdt, struct GdtPtr* ptr, struct TssEntry* tss, percpu_t* percpu) {
 
-    gdt_ptr.limit = (sizeof(struct GdtEntry) * 3) - 1;
-    gdt_ptr.base = (uint32_t)&gdt_entries;
+    ptr->limit = (sizeof(struct GdtEntry) * GDT_COUNT) - 1;
+    ptr->base = (uint32_t)gdt;
 
-    gdt_set_gate(0, 0, 0, 0, 0); // Null segment
+    gdt_set_gate(gdt, 0, 0, 0, 0, 0); // Null segment
     
   
-    gdt_set_gate(1, 0, 0xFFFFF, 0x9A, 0xCF); // Code segment
+    gdt_set_gate(gdt, 1, 0, 0xFFFFF, 0x9A, 0xCF); // Code segment
      
     
-    gdt_set_gate(2, 0, 0xFFFFF, 0x92, 0xCF); // Data segment
+    gdt_set_gate(gdt, 2, 0, 0xFFFFF, 0x92, 0xCF); // Data segment
+
+    gdt_set_gate(gdt, 3, 0, 0xFFFFF, 0xFA, 0xCF); // User mode code segment
+
+    gdt_set_gate(gdt, 4, 0, 0xFFFFF, 0xF2, 0xCF); // User mode data segment
+
+    // TSS, esp0 is filled in before entering user mode
+    tss->ss0 = GDT_KERNEL_DATA;
+    tss->iomap_base = sizeof(struct TssEntry);
+    percpu->tss = tss;
+    gdt_set_gate(gdt, 5, (uint32_t)tss, sizeof(struct TssEntry) - 1, 0x89, 0x00);
+
+    // This CPU's percpu_t, byte granular so the limit is its size
+    gdt_set_gate(gdt, 6, (uint32_t)percpu, sizeof(percpu_t) - 1, 0x92, 0x40);
     
-    gdt_flush((uint32_t)&gdt_ptr);
+    gdt_flush((uint32_t)ptr);
+    asm volatile("ltr %w0" : : "r"((uint16_t)GDT_TSS));
+    asm volatile("mov %w0, %%gs" : : "r"((uint16_t)GDT_PERCPU));
+}
+
+void init_gdt() {
+    percpu_init(0);
+    gdt_build(gdt_entries, &gdt_ptr, &tss_entry, &percpu_areas[0]);
+    percpu_ready = true;
+}
+
+void gdt_init_ap(int cpu) {
+    percpu_init(cpu);
+    gdt_build(ap_gdt[cpu], &ap_gdt_ptr[cpu], &ap_tss[cpu], &percpu_areas[cpu]);
 }
 
 void start_gdt(void){
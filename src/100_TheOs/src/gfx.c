@@ -0,0 +1,319 @@
+// gfx.c -- Small 2D compositor on top of the VBE driver.
+//
+// Everything is drawn into the back page. gfx_present() flips and then
+// copies the rectangles that changed into the new back page, so the two
+// pages stay identical without redrawing whole frames.
+
+#include "gfx.h"
+#include "vbe.h"
+#include "cpu.h"
+#include "pit.h"
+#include "monitor.h"
+#include "memory/memory.h"
+#include "libc/system.h"
+
+typedef void (*fill_row_fn)(uint32_t* dst, uint32_t color, uint32_t count);
+typedef void (*copy_row_fn)(uint32_t* dst, const uint32_t* src, uint32_t count);
+
+static bool gfx_active = false;
+static uint32_t* back = NULL;
+static uint32_t pitch = 0;
+
+// Rectangles drawn this frame
+static gfx_rect_t dirty[GFX_MAX_DIRTY];
+static int dirty_count = 0;
+
+static void fill_row_rep(uint32_t* dst, uint32_t color, uint32_t count)
+{
+    asm volatile("cld; rep stosl"
+                 : "+D" (dst), "+c" (count)
+                 : "a" (color)
+                 : "memory");
+}
+
+static void copy_row_rep(uint32_t* dst, const uint32_t* src, uint32_t count)
+{
+    asm volatile("cld; rep movsl"
+                 : "+D" (dst), "+S" (src), "+c" (count)
+                 : : "memory");
+}
+
+// SSE2 kernels: 16-byte non-temporal stores once the destination is
+// aligned, so video memory writes bypass the cache. Only called after
+// cpu_enable_sse(); the fence is issued once per operation.
+__attribute__((target("sse2")))
+static void fill_row_sse2(uint32_t* dst, uint32_t color, uint32_t count)
+{
+    while (((uint32_t)dst & 15) && count) {
+        *dst++ = color;
+        count--;
+    }
+    uint32_t blocks = count / 4;
+    if (blocks) {
+        asm volatile("movd %[c], %%xmm0\n\t"
+                     "pshufd $0, %%xmm0, %%xmm0\n\t"
+                     "1:\n\t"
+                     "movntdq %%xmm0, (%[d])\n\t"
+                     "add $16, %[d]\n\t"
+                     "dec %[n]\n\t"
+                     "jnz 1b"
+                     : [d] "+r" (dst), [n] "+r" (blocks)
+                     : [c] "r" (color)
+                     : "xmm0", "memory");
+    }
+    count &= 3;
+    while (count--) *dst++ = color;
+}
+
+__attribute__((target("sse2")))
+static void copy_row_sse2(uint32_t* dst, const uint32_t* src, uint32_t count)
+{
+    while (((uint32_t)dst & 15) && count) {
+        *dst++ = *src++;
+        count--;
+    }
+    uint32_t blocks = count / 4;
+    if (blocks) {
+        asm volatile("1:\n\t"
+                     "movdqu (%[s]), %%xmm0\n\t"
+                     "movntdq %%xmm0, (%[d])\n\t"
+                     "add $16, %[s]\n\t"
+                     "add $16, %[d]\n\t"
+                     "dec %[n]\n\t"
+                     "jnz 1b"
+                     : [d] "+r" (dst), [s] "+r" (src), [n] "+r" (blocks)
+                     : : "xmm0", "memory");
+    }
+    count &= 3;
+    while (count--) *dst++ = *src++;
+}
+
+static fill_row_fn fill_row = fill_row_rep;
+static copy_row_fn copy_row = copy_row_rep;
+static bool kernels_sse2 = false;
+
+// Drain non-temporal stores before the frame is shown
+static inline void gfx_fence(void)
+{
+    if (kernels_sse2) asm volatile("sfence" ::: "memory");
+}
+
+bool gfx_use_sse2(bool enable)
+{
+    if (enable && cpu_enable_sse()) {
+        fill_row = fill_row_sse2;
+        copy_row = copy_row_sse2;
+        kernels_sse2 = true;
+    } else {
+        fill_row = fill_row_rep;
+        copy_row = copy_row_rep;
+        kernels_sse2 = false;
+    }
+    return kernels_sse2;
+}
+
+uint32_t gfx_width(void)
+{
+    const vbe_mode_t* mode = vbe_get_mode();
+    return mode ? mode->width : 0;
+}
+
+uint32_t gfx_height(void)
+{
+    const vbe_mode_t* mode = vbe_get_mode();
+    return mode ? mode->height : 0;
+}
+
+// Clip a rectangle to the screen, false if nothing is left
+static bool gfx_clip(gfx_rect_t* r)
+{
+    int32_t w = gfx_width(), h = gfx_height();
+    if (r->x < 0) { r->w += r->x; r->x = 0; }
+    if (r->y < 0) { r->h += r->y; r->y = 0; }
+    if (r->x + r->w > w) r->w = w - r->x;
+    if (r->y + r->h > h) r->h = h - r->y;
+    return r->w > 0 && r->h > 0;
+}
+
+static void gfx_mark_dirty(const gfx_rect_t* r)
+{
+    // Already covered by an existing rectangle
+    for (int i = 0; i < dirty_count; i++) {
+        gfx_rect_t* d = &dirty[i];
+        if (r->x >= d->x && r->y >= d->y &&
+            r->x + r->w <= d->x + d->w && r->y + r->h <= d->y + d->h) {
+            return;
+        }
+    }
+
+    if (dirty_count < GFX_MAX_DIRTY) {
+        dirty[dirty_count++] = *r;
+        return;
+    }
+
+    // Out of slots: merge everything into one bounding box
+    gfx_rect_t box = *r;
+    for (int i = 0; i < dirty_count; i++) {
+        int32_t x1 = box.x + box.w, y1 = box.y + box.h;
+        int32_t dx1 = dirty[i].x + dirty[i].w, dy1 = dirty[i].y + dirty[i].h;
+        if (dirty[i].x < box.x) box.x = dirty[i].x;
+        if (dirty[i].y < box.y) box.y = dirty[i].y;
+        box.w = (x1 > dx1 ? x1 : dx1) - box.x;
+        box.h = (y1 > dy1 ? y1 : dy1) - box.y;
+    }
+    dirty[0] = box;
+    dirty_count = 1;
+}
+
+bool gfx_begin(uint32_t width, uint32_t height)
+{
+    if (!vbe_init() || !vbe_set_mode(width, height)) {
+        return false;
+    }
+    const vbe_mode_t* mode = vbe_get_mode();
+    pitch = mode->pitch;
+    gfx_active = true;
+    dirty_count = 0;
+
+    // Start with both pages black
+    for (int page = 0; page < 2; page++) {
+        back = vbe_back_buffer();
+        for (uint32_t y = 0; y < height; y++) {
+            fill_row(back + y * pitch, 0, width);
+        }
+        gfx_fence();
+        vbe_flip();
+    }
+    back = vbe_back_buffer();
+    return true;
+}
+
+void gfx_end(void)
+{
+    if (!gfx_active) return;
+    vbe_restore_mode();
+    gfx_active = false;
+    monitor_redraw();
+}
+
+void gfx_fill_rect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+    gfx_rect_t r = { x, y, w, h };
+    if (!gfx_active || !gfx_clip(&r)) return;
+
+    uint32_t* row = back + r.y * pitch + r.x;
+    for (int32_t i = 0; i < r.h; i++) {
+        fill_row(row, color, r.w);
+        row += pitch;
+    }
+    gfx_mark_dirty(&r);
+}
+
+void gfx_blit(const uint32_t* src, uint32_t src_pitch, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    gfx_rect_t r = { x, y, w, h };
+    if (!gfx_active || !gfx_clip(&r)) return;
+
+    // Skip the clipped off part of the source
+    src += (r.y - y) * src_pitch + (r.x - x);
+    uint32_t* row = back + r.y * pitch + r.x;
+    for (int32_t i = 0; i < r.h; i++) {
+        copy_row(row, src, r.w);
+        row += pitch;
+        src += src_pitch;
+    }
+    gfx_mark_dirty(&r);
+}
+
+void gfx_present(void)
+{
+    if (!gfx_active) return;
+
+    gfx_fence();
+    vbe_flip();
+
+    // The old front page is the new back page; it is missing this frame
+    uint32_t* front = vbe_front_buffer();
+    back = vbe_back_buffer();
+    for (int i = 0; i < dirty_count; i++) {
+        const gfx_rect_t* r = &dirty[i];
+        for (int32_t y = r->y; y < r->y + r->h; y++) {
+            copy_row(back + y * pitch + r->x, front + y * pitch + r->x, r->w);
+        }
+    }
+    gfx_fence();
+    dirty_count = 0;
+}
+
+#define BENCH_MS 500
+#define BENCH_SPRITE 128
+
+static void gfx_bench_kernels(const uint32_t* sprite, uint32_t* fills, uint32_t* blits)
+{
+    uint32_t w = gfx_width(), h = gfx_height();
+
+    // Full screen fills
+    uint32_t count = 0;
+    uint32_t start = pit_get_ticks();
+    while (pit_get_ticks() - start < BENCH_MS * TICKS_PER_MS) {
+        gfx_fill_rect(0, 0, w, h, 0x00102030 + count * 0x010101);
+        gfx_fence();
+        dirty_count = 0;
+        count++;
+    }
+    *fills = count * 1000 / BENCH_MS;
+
+    // Sprite blits walking across the screen
+    count = 0;
+    start = pit_get_ticks();
+    while (pit_get_ticks() - start < BENCH_MS * TICKS_PER_MS) {
+        int32_t x = (count * 37) % (w - BENCH_SPRITE);
+        int32_t y = (count * 23) % (h - BENCH_SPRITE);
+        gfx_blit(sprite, BENCH_SPRITE, x, y, BENCH_SPRITE, BENCH_SPRITE);
+        count++;
+    }
+    gfx_fence();
+    *blits = count * 1000 / BENCH_MS;
+    gfx_present();
+}
+
+void gfx_benchmark(void)
+{
+    const uint32_t width = 1024, height = 768;
+
+    uint32_t* sprite = malloc(BENCH_SPRITE * BENCH_SPRITE * sizeof(uint32_t));
+    for (uint32_t y = 0; y < BENCH_SPRITE; y++) {
+        for (uint32_t x = 0; x < BENCH_SPRITE; x++) {
+            sprite[y * BENCH_SPRITE + x] = ((x ^ y) & 16) ? 0x00FFFFFF : 0x00FF4000;
+        }
+    }
+
+    uint32_t rep_fills = 0, rep_blits = 0, sse_fills = 0, sse_blits = 0;
+    bool have_sse2 = false;
+
+    gfx_use_sse2(false);
+    if (!gfx_begin(width, height)) {
+        printf("gfxbench: no Bochs VBE display (run QEMU with -vga std)\n");
+        free(sprite);
+        return;
+    }
+    gfx_bench_kernels(sprite, &rep_fills, &rep_blits);
+
+    if (gfx_use_sse2(true)) {
+        have_sse2 = true;
+        gfx_bench_kernels(sprite, &sse_fills, &sse_blits);
+    }
+    gfx_use_sse2(false);
+    gfx_end();
+    free(sprite);
+
+    printf("gfxbench %dx%dx32, %d ms per test\n", width, height, BENCH_MS);
+    printf("  rep stosd/movsd: %d fills/sec (%d Mpix/s), %d blits/sec of %dx%d\n",
+           rep_fills, rep_fills * (width * height / 1000) / 1000, rep_blits, BENCH_SPRITE, BENCH_SPRITE);
+    if (have_sse2) {
+        printf("  SSE2 movntdq:    %d fills/sec (%d Mpix/s), %d blits/sec of %dx%d\n",
+               sse_fills, sse_fills * (width * height / 1000) / 1000, sse_blits, BENCH_SPRITE, BENCH_SPRITE);
+    } else {
+        printf("  SSE2: not available on this CPU\n");
+    }
+}
@@ -0,0 +1,253 @@
+// hpet.c -- High Precision Event Timer.
+//
+// The main counter runs at a fixed rate (usually 14.318 MHz) whatever the
+// CPU does, so it is a clocksource for when the TSC cannot be trusted.
+// Comparator 0 is used as an event timer: unlike the PIT it is programmed
+// with one MMIO write instead of three port writes, and it reaches far
+// beyond the PIT's 55 ms.
+
+#include "hpet.h"
+#include "acpi.h"
+#include "apic.h"
+#include "memory/memory.h"
+#include "libc/div64.h"
+#include "log.h"
+#include "spinlock.h"
+
+extern void terminal_printf(const char* format, ...);
+
+// ACPI "HPET" table
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t event_timer_block_id;
+    uint8_t address_space;    // 0 = memory
+    uint8_t register_width;
+    uint8_t register_offset;
+    uint8_t reserved;
+    uint64_t address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+// Registers, byte offsets
+#define HPET_CAPABILITIES   0x000
+#define HPET_PERIOD         0x004  // Upper half of the capabilities, fs per count
+#define HPET_CONFIG         0x010
+#define HPET_COUNTER        0x0F0
+#define HPET_COUNTER_HIGH   0x0F4
+#define HPET_TIMER_CONFIG(n)    (0x100 + 0x20 * (n))
+#define HPET_TIMER_ROUTE_CAP(n) (0x104 + 0x20 * (n))
+#define HPET_TIMER_COMPARATOR(n) (0x108 + 0x20 * (n))
+
+#define HPET_CAP_COUNTER_64 (1 << 13)
+#define HPET_CAP_LEGACY     (1 << 15)
+#define HPET_CONFIG_ENABLE  (1 << 0)
+#define HPET_CONFIG_LEGACY  (1 << 1)
+
+#define HPET_TIMER_INT_ENABLE (1 << 2)
+#define HPET_TIMER_PERIODIC   (1 << 3)
+#define HPET_TIMER_PERIODIC_CAP (1 << 4)
+#define HPET_TIMER_VALUE_SET  (1 << 6)
+#define HPET_TIMER_32BIT      (1 << 8)
+#define HPET_TIMER_ROUTE_SHIFT 9
+
+// Comparator writes closer than this to the counter may be missed
+#define HPET_MIN_DELTA 64
+
+bool hpet_present = false;
+
+static volatile uint32_t* hpet_regs = NULL;
+static uint32_t hpet_per_ms = 0;
+static uint32_t hpet_period_fs = 0;
+static bool hpet_counter_64 = false;
+static uint8_t hpet_timer_count = 0;
+
+// Event timer routing
+static bool hpet_events = false;
+static bool hpet_legacy = false;
+static uint32_t hpet_route = 0;
+static bool hpet_periodic_cap = false;
+
+// Software high half for 32-bit counters. Every CPU reads the clock, so
+// the extension is done under a lock; a read taken before another CPU
+// moved hpet_last_low on would look like a wrap.
+static uint32_t hpet_last_low = 0;
+static uint32_t hpet_high = 0;
+static spinlock_t hpet_extend_lock = SPINLOCK_INIT("hpet");
+
+static inline uint32_t hpet_read(uint32_t reg)
+{
+    return hpet_regs[reg / 4];
+}
+
+static inline void hpet_write(uint32_t reg, uint32_t value)
+{
+    hpet_regs[reg / 4] = value;
+}
+
+uint64_t hpet_read_counter(void)
+{
+    if (hpet_counter_64) {
+        // The halves cannot be read at once, retry if the low one wrapped
+        uint32_t high, low;
+        do {
+            high = hpet_read(HPET_COUNTER_HIGH);
+            low = hpet_read(HPET_COUNTER);
+        } while (high != hpet_read(HPET_COUNTER_HIGH));
+        return ((uint64_t)high << 32) | low;
+    }
+
+    // Read the counter only once the lock is held, so it is never older
+    // than hpet_last_low
+    uint32_t flags = spin_lock_irqsave(&hpet_extend_lock);
+    uint32_t low = hpet_read(HPET_COUNTER);
+    if (low < hpet_last_low) hpet_high++;
+    hpet_last_low = low;
+    uint64_t value = ((uint64_t)hpet_high << 32) | low;
+    spin_unlock_irqrestore(&hpet_extend_lock, flags);
+    return value;
+}
+
+uint32_t hpet_counts_per_ms(void)
+{
+    return hpet_per_ms;
+}
+
+bool hpet_init(void)
+{
+    const acpi_hpet_t* table = (const acpi_hpet_t*)acpi_find_table("HPET");
+    if (table == NULL) {
+        LOG_INFO("hpet", "No ACPI HPET table\n");
+        return false;
+    }
+    if (table->address_space != 0 || (table->address >> 32) != 0) {
+        LOG_INFO("hpet", "HPET not in 32-bit memory space\n");
+        return false;
+    }
+
+    uint32_t base = (uint32_t)table->address;
+    paging_map_mmio(base, 1024);
+    hpet_regs = (volatile uint32_t*)base;
+
+    uint32_t caps = hpet_read(HPET_CAPABILITIES);
+    hpet_period_fs = hpet_read(HPET_PERIOD);
+    // The spec caps the period at 100 ns
+    if (hpet_period_fs == 0 || hpet_period_fs > 100000000) {
+        LOG_INFO("hpet", "Bad HPET period %u fs\n", hpet_period_fs);
+        return false;
+    }
+    hpet_counter_64 = (caps & HPET_CAP_COUNTER_64) != 0;
+    hpet_timer_count = ((caps >> 8) & 0x1F) + 1;
+    hpet_per_ms = (uint32_t)div64_32(1000000000000ULL, hpet_period_fs, NULL);
+
+    // Comparator 0 disarmed, then start the main counter
+    uint32_t timer0 = hpet_read(HPET_TIMER_CONFIG(0));
+    hpet_write(HPET_TIMER_CONFIG(0), timer0 & ~(HPET_TIMER_INT_ENABLE | HPET_TIMER_PERIODIC));
+    hpet_write(HPET_CONFIG, (hpet_read(HPET_CONFIG) & ~HPET_CONFIG_LEGACY) | HPET_CONFIG_ENABLE);
+    hpet_present = true;
+
+    // Comparator 0 interrupts as IRQ0: through the same I/O APIC input
+    // if it can be routed there, else in legacy replacement mode
+    uint32_t gsi;
+    uint32_t routes = hpet_read(HPET_TIMER_ROUTE_CAP(0));
+    if (apic_irq_gsi(0, &gsi) && gsi < 32 && (routes & (1u << gsi))) {
+        hpet_route = gsi;
+        hpet_events = true;
+    } else if (caps & HPET_CAP_LEGACY) {
+        hpet_legacy = true;
+        hpet_events = true;
+    }
+    hpet_periodic_cap = (timer0 & HPET_TIMER_PERIODIC_CAP) != 0;
+
+    LOG_INFO("hpet", "HPET at 0x%x, %u kHz, %d-bit counter, %d comparators\n",
+             base, hpet_per_ms, hpet_counter_64 ? 64 : 32, hpet_timer_count);
+    return true;
+}
+
+bool hpet_events_available(void)
+{
+    return hpet_events;
+}
+
+bool hpet_legacy_routing(void)
+{
+    return hpet_events && hpet_legacy;
+}
+
+bool hpet_legacy_enabled(void)
+{
+    return hpet_present && (hpet_read(HPET_CONFIG) & HPET_CONFIG_LEGACY);
+}
+
+void hpet_enable_events(void)
+{
+    if (!hpet_events) return;
+
+    uint32_t config = hpet_read(HPET_TIMER_CONFIG(0));
+    config &= ~(HPET_TIMER_INT_ENABLE | HPET_TIMER_PERIODIC | (0x1F << HPET_TIMER_ROUTE_SHIFT));
+    config |= HPET_TIMER_32BIT;  // Edge triggered, compared against the low half
+    if (!hpet_legacy) {
+        config |= hpet_route << HPET_TIMER_ROUTE_SHIFT;
+    }
+    hpet_write(HPET_TIMER_CONFIG(0), config);
+
+    if (hpet_legacy) {
+        hpet_write(HPET_CONFIG, hpet_read(HPET_CONFIG) | HPET_CONFIG_LEGACY);
+    }
+}
+
+void hpet_set_oneshot(uint32_t counts)
+{
+    uint32_t config = hpet_read(HPET_TIMER_CONFIG(0)) & ~HPET_TIMER_PERIODIC;
+    hpet_write(HPET_TIMER_CONFIG(0), config | HPET_TIMER_INT_ENABLE);
+
+    // The comparator only matches on equality, so a value the counter
+    // has already passed would not fire for a whole wrap
+    if (counts < HPET_MIN_DELTA) counts = HPET_MIN_DELTA;
+    while (1) {
+        uint32_t target = hpet_read(HPET_COUNTER) + counts;
+        hpet_write(HPET_TIMER_COMPARATOR(0), target);
+        if ((int32_t)(target - hpet_read(HPET_COUNTER)) > 0) break;
+        counts *= 2;
+    }
+}
+
+void hpet_set_periodic(uint32_t counts)
+{
+    if (!hpet_periodic_cap) {
+        hpet_set_oneshot(counts);
+        return;
+    }
+    if (counts < HPET_MIN_DELTA) counts = HPET_MIN_DELTA;
+
+    // With VALUE_SET the first comparator write is the next match and
+    // the second one the period
+    uint32_t config = hpet_read(HPET_TIMER_CONFIG(0));
+    hpet_write(HPET_TIMER_CONFIG(0), config | HPET_TIMER_INT_ENABLE | HPET_TIMER_PERIODIC | HPET_TIMER_VALUE_SET);
+    hpet_write(HPET_TIMER_COMPARATOR(0), hpet_read(HPET_COUNTER) + counts);
+    hpet_write(HPET_TIMER_COMPARATOR(0), counts);
+}
+
+void hpet_stop(void)
+{
+    uint32_t config = hpet_read(HPET_TIMER_CONFIG(0));
+    hpet_write(HPET_TIMER_CONFIG(0), config & ~(HPET_TIMER_INT_ENABLE | HPET_TIMER_PERIODIC));
+}
+
+void hpet_print_info(void)
+{
+    if (!hpet_present) {
+        terminal_printf("HPET: not present\n");
+        return;
+    }
+    terminal_printf("HPET: %u kHz (%u fs), %d-bit counter, %d comparators\n", hpet_per_ms,
+                    hpet_period_fs, hpet_counter_64 ? 64 : 32, hpet_timer_count);
+    if (!hpet_events) {
+        terminal_printf("  Comparator 0 cannot reach IRQ0\n");
+    } else if (hpet_legacy) {
+        terminal_printf("  Comparator 0 on IRQ0 (legacy replacement)\n");
+    } else {
+        terminal_printf("  Comparator 0 on I/O APIC input %u\n", hpet_route);
+    }
+}
@@ -0,0 +1,256 @@
+// idle.c -- Idle states and CPU utilization.
+//
+// cpu_idle() is where the CPU goes when there is nothing to run. It asks
+// the clock how long until the next timer event and picks the deepest
+// state worth entering for that long: hlt, or mwait with a C-state hint
+// when the CPU has MONITOR/MWAIT. Time spent in each state is summed up
+// per CPU, which gives utilization without sampling the running code.
+//
+// The interrupt that ends an idle period runs before cpu_idle() reads the
+// clock again, so its handler time counts as idle. Handlers are short
+// enough for that not to matter at a percent resolution.
+
+#include "idle.h"
+#include "clock.h"
+#include "timer.h"
+#include "cpu.h"
+#include "percpu.h"
+#include "monitor.h"
+#include "workqueue.h"
+#include "libc/stdarg.h"
+#include "libc/div64.h"
+#include "log.h"
+#include "apic.h"
+#include "atomic.h"
+#include "smp.h"
+
+extern int vsnprintf(char* str, size_t size, const char* format, va_list args);
+
+// CPUID leaf 5: MONITOR/MWAIT, EDX has 4 bits of sub-state count per C-state
+#define CPUID_MWAIT_LEAF 5
+
+static char idle_deep_name[] = "mwait C?";
+
+idle_state_t idle_states[IDLE_STATE_COUNT] = {
+    [IDLE_HLT] = { "hlt", true, 0 },
+    [IDLE_MWAIT_C1] = { "mwait C1", false, 0x00 },
+    [IDLE_MWAIT_DEEP] = { idle_deep_name, false, 0 },
+};
+
+// Once-a-second sample, per CPU and averaged over the online ones
+static uint64_t sample_ns = 0;
+static uint64_t sample_idle_ns[APIC_MAX_CPUS];
+static uint32_t idle_cpu_percent[APIC_MAX_CPUS];
+static uint32_t idle_last_percent = 0;
+static bool idle_status = false;
+
+// mwait watches this line, interrupts wake it as well
+static volatile uint32_t idle_monitor_line __attribute__((aligned(64)));
+
+static int idle_pick_state(uint32_t predicted_ms)
+{
+    if (predicted_ms >= IDLE_DEEP_MIN_MS && idle_states[IDLE_MWAIT_DEEP].available) {
+        return IDLE_MWAIT_DEEP;
+    }
+    if (idle_states[IDLE_MWAIT_C1].available) {
+        return IDLE_MWAIT_C1;
+    }
+    return IDLE_HLT;
+}
+
+void cpu_idle(void)
+{
+    // Timer events are CPU 0's. Application processors sleep until an
+    // IPI or their tick, which a prediction of 0 keeps out of the deep
+    // state: a woken thread should not wait for its exit latency.
+    idle_stats_t* stats = &this_cpu()->idle_stats;
+    uint32_t predicted_ms = this_cpu_index() == 0 ? clock_next_event_ms() : 0;
+    int state = idle_pick_state(predicted_ms);
+    stats->entries[state]++;
+
+    uint64_t start = ktime_get_ns();
+    stats->seq++;
+    smp_wmb();
+    stats->enter = start;
+    stats->in_progress = true;
+    smp_wmb();
+    stats->seq++;
+
+    // sti only takes effect after the next instruction, so nothing gets
+    // in between it and the hlt or mwait
+    if (state == IDLE_HLT) {
+        asm volatile("sti; hlt" : : : "memory");
+    } else {
+        asm volatile("monitor" : : "a" (&idle_monitor_line), "c" (0), "d" (0));
+        asm volatile("sti; mwait" : : "a" (idle_states[state].hint), "c" (0) : "memory");
+    }
+
+    asm volatile("cli");
+    uint64_t slept = ktime_get_ns() - start;
+    stats->seq++;
+    smp_wmb();
+    stats->in_progress = false;
+    stats->residency_ns[state] += slept;
+    stats->total_ns += slept;
+    smp_wmb();
+    stats->seq++;
+    if (predicted_ms >= IDLE_DEEP_MIN_MS && slept < (uint64_t)predicted_ms * 500000) {
+        stats->early_wakeups++;
+    }
+    asm volatile("sti");
+}
+
+// Idle time of a CPU up to now, the period it is in included
+static uint64_t idle_cpu_ns(int cpu, uint64_t now)
+{
+    const idle_stats_t* stats = &per_cpu(cpu)->idle_stats;
+    uint32_t seq;
+    uint64_t idle;
+    do {
+        seq = stats->seq;
+        smp_rmb();
+        idle = stats->total_ns;
+        if (stats->in_progress && now > stats->enter) {
+            idle += now - stats->enter;
+        }
+        smp_rmb();
+    } while ((seq & 1) || seq != stats->seq);
+    return idle;
+}
+
+static void idle_format(char* out, size_t size, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(out, size, format, args);
+    va_end(args);
+}
+
+static void idle_draw_status(void* data)
+{
+    if (!idle_status) return;
+
+    char line[48];
+    uint32_t up = clock_now_ms() / 1000;
+    idle_format(line, sizeof(line), " CPU %d%% idle %d%% up %u:%s%u ", 100 - idle_last_percent,
+                idle_last_percent, up / 60, up % 60 < 10 ? "0" : "", up % 60);
+    monitor_status(line);
+}
+
+// Timer callback, interrupt context
+static void idle_sample(void* arg)
+{
+    uint64_t now = ktime_get_ns();
+    uint32_t wall_us = (uint32_t)div64_32(now - sample_ns, 1000, NULL);
+    int cpus = smp_cpus_online;
+    uint32_t sum = 0;
+
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        uint64_t idle = idle_cpu_ns(cpu, now);
+        uint32_t idle_us = (uint32_t)div64_32(idle - sample_idle_ns[cpu], 1000, NULL);
+        if (wall_us > 0) {
+            uint32_t percent = (uint32_t)div64_32((uint64_t)idle_us * 100, wall_us, NULL);
+            idle_cpu_percent[cpu] = percent > 100 ? 100 : percent;
+        }
+        sample_idle_ns[cpu] = idle;
+        sum += idle_cpu_percent[cpu];
+    }
+    idle_last_percent = sum / cpus;
+    sample_ns = now;
+
+    if (idle_status) {
+        work_queue(idle_draw_status, NULL);
+    }
+}
+
+void idle_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (cpu_has_ecx(CPUID_ECX_MONITOR) && eax >= CPUID_MWAIT_LEAF) {
+        idle_states[IDLE_MWAIT_C1].available = true;
+
+        // Deepest C-state with at least one sub-state, hint (n - 1) << 4
+        cpuid(CPUID_MWAIT_LEAF, &eax, &ebx, &ecx, &edx);
+        for (int cstate = 7; cstate >= 2; cstate--) {
+            if ((edx >> (cstate * 4)) & 0xF) {
+                idle_states[IDLE_MWAIT_DEEP].available = true;
+                idle_states[IDLE_MWAIT_DEEP].hint = (cstate - 1) << 4;
+                idle_deep_name[7] = '0' + cstate;
+                break;
+            }
+        }
+    }
+
+    sample_ns = ktime_get_ns();
+    timer_add_periodic(clock_now_ms() + 1000, 1000, idle_sample, NULL);
+
+    LOG_INFO("idle", "Idle states: hlt%s%s%s\n",
+             idle_states[IDLE_MWAIT_C1].available ? ", mwait C1" : "",
+             idle_states[IDLE_MWAIT_DEEP].available ? ", " : "",
+             idle_states[IDLE_MWAIT_DEEP].available ? idle_deep_name : "");
+}
+
+uint32_t idle_percent(void)
+{
+    return idle_last_percent;
+}
+
+static void idle_print_since_boot(uint64_t idle_ns, uint64_t wall_ns)
+{
+    uint32_t idle_ms = (uint32_t)div64_32(idle_ns, 1000000, NULL);
+    uint32_t wall_ms = (uint32_t)div64_32(wall_ns, 1000000, NULL);
+    terminal_printf("%u of %u ms idle since boot", idle_ms, wall_ms);
+    if (wall_ms > 0) {
+        terminal_printf(" (%u%%)", (uint32_t)div64_32((uint64_t)idle_ms * 100, wall_ms, NULL));
+    }
+    terminal_printf("\n");
+}
+
+void idle_print_stats(void)
+{
+    uint64_t uptime_ns = ktime_get_ns();
+    int cpus = smp_cpus_online;
+
+    // Totals over all CPUs, printed last
+    idle_stats_t total = { 0 };
+    uint64_t total_idle_ns = 0;
+
+    terminal_printf("CPU utilization: %d%% busy, %d%% idle (last second, %d CPU%s)\n",
+                    100 - idle_last_percent, idle_last_percent, cpus, cpus > 1 ? "s" : "");
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        const idle_stats_t* stats = &per_cpu(cpu)->idle_stats;
+        uint64_t idle_ns = idle_cpu_ns(cpu, uptime_ns);
+        total_idle_ns += idle_ns;
+        total.early_wakeups += stats->early_wakeups;
+
+        terminal_printf("CPU %d: %u%% idle last second, ", cpu, idle_cpu_percent[cpu]);
+        idle_print_since_boot(idle_ns, uptime_ns);
+        for (int i = 0; i < IDLE_STATE_COUNT; i++) {
+            if (!idle_states[i].available) continue;
+            total.entries[i] += stats->entries[i];
+            total.residency_ns[i] += stats->residency_ns[i];
+            terminal_printf("  %s: %u entries, %u ms\n", idle_states[i].name, stats->entries[i],
+                            (uint32_t)div64_32(stats->residency_ns[i], 1000000, NULL));
+        }
+    }
+
+    if (cpus > 1) {
+        terminal_printf("All CPUs: ");
+        idle_print_since_boot(total_idle_ns, uptime_ns * cpus);
+        for (int i = 0; i < IDLE_STATE_COUNT; i++) {
+            if (!idle_states[i].available) continue;
+            terminal_printf("  %s: %u entries, %u ms\n", idle_states[i].name, total.entries[i],
+                            (uint32_t)div64_32(total.residency_ns[i], 1000000, NULL));
+        }
+    }
+    terminal_printf("  Early wakeups: %u (before half the predicted idle)\n", total.early_wakeups);
+}
+
+void idle_status_line(bool enable)
+{
+    idle_status = enable;
+    if (enable) {
+        work_queue(idle_draw_status, NULL);
+    }
+}
@@ -2,24 +2,80 @@
 #include "irq.h"
 #include "common.h"
 #include "libc/stddef.h"
+#include "trace.h"
+#include "apic.h"
+#include "pit.h"
+#include "clock.h"
+#include "log.h"
+#include "workqueue.h"
+
+extern void terminal_printf(const char* format, ...);
 
 #define IRQ_COUNT 16
 
+// Storm detection. A line that raises more than IRQ_STORM_THRESHOLD
+// interrupts within IRQ_STORM_WINDOW_MS is masked and its handler is
+// called from the timer every IRQ_POLL_INTERVAL_MS instead. The line is
+// unmasked again after a back-off that doubles with each storm, and
+// drops back to the minimum after IRQ_THROTTLE_RESET_MS without one.
+// The window only moves on when the clock does, so a storm that starves
+// the timer interrupt is caught all the same.
+#define IRQ_STORM_WINDOW_MS   10
+#define IRQ_STORM_THRESHOLD   1000
+#define IRQ_POLL_INTERVAL_MS  10
+#define IRQ_THROTTLE_MIN_MS   100
+#define IRQ_THROTTLE_MAX_MS   5000
+#define IRQ_THROTTLE_RESET_MS 10000
+
 struct irq_handler_t {
     isr_t handler;
     void* data;
     uint8_t num;
+
+    uint32_t window_start;    // Tick the current counting window began
+    uint32_t window_count;    // Interrupts in that window
+    uint32_t throttle_until;  // Tick the line is unmasked again
+    uint32_t throttle_ms;     // Back-off of the last storm
+    uint32_t last_poll;
+    uint32_t storms;
+    uint32_t polls;
 };
 
 static struct irq_handler_t irq_handlers[IRQ_COUNT];
 
+// Masked IRQ lines, bit n = IRQ n. Kept here so the mask survives the
+// switch from the PIC to the I/O APIC. IRQ2 is the PIC cascade.
+static uint16_t irq_mask_bits = 0xFFFF & ~(1 << 2);
+
+// Lines masked by storm detection, on top of irq_mask_bits
+static volatile uint16_t irq_throttle_bits = 0;
+
+static void pic_write_mask(void) {
+    uint16_t mask = irq_mask_bits | irq_throttle_bits;
+    outb(0x21, mask & 0xFF);
+    outb(0xA1, mask >> 8);
+}
+
+// Program one line's effective mask into the active controller
+static void irq_apply_mask(uint8_t irq) {
+    if (apic_enabled) {
+        apic_set_irq_mask(irq, (irq_mask_bits | irq_throttle_bits) & (1 << irq));
+    } else {
+        pic_write_mask();
+    }
+}
+
+// Route the IRQ vectors through irq_controller(). The entry stub passes
+// the IRQ's slot as context, so no lookup is needed on the way in.
+// Handlers registered before this (the PIT) are kept.
 void init_irq() {
     for (int i = 0; i < IRQ_COUNT; i++) {
-        irq_handlers[i].handler = NULL;
-        irq_handlers[i].data = NULL;
         irq_handlers[i].num = i;
+        load_interrupt_controller(IRQ0 + i, irq_controller, &irq_handlers[i]);
     }
     
+    // Remap the PIC to vectors 32-47 even if it ends up unused, so a
+    // stray PIC interrupt can never look like a CPU exception
     outb(0x20, 0x11);
     outb(0xA0, 0x11);
     
@@ -31,9 +87,29 @@ void init_irq() {
     
     outb(0x21, 0x01); 
     outb(0xA1, 0x01); 
-    
-    outb(0x21, inb(0x21) & ~(1 << 1));  // Enable IRQ1 (keyboard)
-    outb(0xA1, 0xFF);  //Mask all slave IRQs
+
+    if (apic_init()) {
+        // The I/O APIC takes over, the PIC is only the fallback
+        outb(0x21, 0xFF);
+        outb(0xA1, 0xFF);
+        for (int i = 0; i < IRQ_COUNT; i++) {
+            irq_apply_mask(i);
+        }
+    } else {
+        pic_write_mask();
+    }
+}
+
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) return;
+    irq_mask_bits &= ~(1 << irq);
+    irq_apply_mask(irq);
+}
+
+void irq_mask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) return;
+    irq_mask_bits |= 1 << irq;
+    irq_apply_mask(irq);
 }
 
 void register_irq_handler(uint8_t irq, isr_t handler, void* context) {
@@ -47,22 +123,120 @@ void register_irq_controller(int irq, isr_t controller, void* ctx) {
     register_irq_handler(irq, controller, ctx);
 }
 
-void irq_controller(registers_t* regs) {
-    if (regs->int_no < 32 || regs->int_no > 47) {
-        outb(0x20, 0x20);
+// Logging writes to the console, so it runs in the kernel worker
+static void irq_log_storm(void* data) {
+    struct irq_handler_t* irq = data;
+    LOG_WARN("irq", "IRQ %d storm (over %d in %d ms), masked for %d ms, polling every %d ms\n",
+             irq->num, IRQ_STORM_THRESHOLD, IRQ_STORM_WINDOW_MS, irq->throttle_ms, IRQ_POLL_INTERVAL_MS);
+}
+
+static void irq_log_unthrottle(void* data) {
+    struct irq_handler_t* irq = data;
+    LOG_INFO("irq", "IRQ %d unmasked after storm, %d polls\n", irq->num, irq->polls);
+}
+
+static void irq_storm_check(struct irq_handler_t* irq) {
+    uint32_t now = pit_get_ticks();
+
+    if (now - irq->window_start >= IRQ_STORM_WINDOW_MS) {
+        irq->window_start = now;
+        irq->window_count = 0;
+    }
+    if (++irq->window_count < IRQ_STORM_THRESHOLD) {
         return;
     }
-   
-    if (regs->int_no >= 40) {
-        outb(0xA0, 0x20);  
+
+    if (irq->throttle_ms == 0 || now - irq->throttle_until >= IRQ_THROTTLE_RESET_MS) {
+        irq->throttle_ms = IRQ_THROTTLE_MIN_MS;
+    } else if (irq->throttle_ms < IRQ_THROTTLE_MAX_MS) {
+        irq->throttle_ms *= 2;
+        if (irq->throttle_ms > IRQ_THROTTLE_MAX_MS) irq->throttle_ms = IRQ_THROTTLE_MAX_MS;
+    }
+    irq->throttle_until = now + irq->throttle_ms;
+    irq->last_poll = now;
+    irq->window_count = 0;
+    irq->storms++;
+
+    irq_throttle_bits |= 1 << irq->num;
+    irq_apply_mask(irq->num);
+    trace_event(TRACE_IRQ_THROTTLE, irq->num, 1);
+    work_queue(irq_log_storm, irq);
+    clock_arm(now + IRQ_POLL_INTERVAL_MS);
+}
+
+void irq_poll_throttled(registers_t* regs) {
+    if (irq_throttle_bits == 0) {
+        return;
+    }
+
+    uint32_t now = pit_get_ticks();
+    for (int i = 0; i < IRQ_COUNT; i++) {
+        if (!(irq_throttle_bits & (1 << i))) continue;
+        struct irq_handler_t* irq = &irq_handlers[i];
+
+        if ((int32_t)(now - irq->throttle_until) >= 0) {
+            irq_throttle_bits &= ~(1 << i);
+            irq_apply_mask(i);
+            irq->window_start = now;
+            irq->window_count = 0;
+            trace_event(TRACE_IRQ_THROTTLE, i, 0);
+            work_queue(irq_log_unthrottle, irq);
+        } else if (now - irq->last_poll >= IRQ_POLL_INTERVAL_MS) {
+            irq->last_poll = now;
+            irq->polls++;
+            if (irq->handler != NULL) {
+                irq->handler(regs, irq->data);
+            }
+        }
+
+        // Without a periodic tick the next poll needs a timer event
+        if (irq_throttle_bits & (1 << i)) {
+            uint32_t next = irq->last_poll + IRQ_POLL_INTERVAL_MS;
+            if ((int32_t)(irq->throttle_until - next) < 0) next = irq->throttle_until;
+            clock_arm(next);
+        }
+    }
+}
+
+void irq_print_throttle_stats(void) {
+    bool any = false;
+    for (int i = 0; i < IRQ_COUNT; i++) {
+        struct irq_handler_t* irq = &irq_handlers[i];
+        if (irq->storms == 0) continue;
+        if (!any) {
+            terminal_printf("IRQ storms:\n");
+            any = true;
+        }
+        terminal_printf("  IRQ %d: %u storms, %u polls, last back-off %u ms%s\n", i, irq->storms,
+                        irq->polls, irq->throttle_ms, (irq_throttle_bits & (1 << i)) ? ", throttled" : "");
+    }
+    if (!any) {
+        terminal_printf("IRQ storms: none\n");
+    }
+}
+
+void irq_controller(registers_t* regs, void* context) {
+    struct irq_handler_t* irq = context;
+
+    if (apic_enabled) {
+        apic_eoi();
+    } else {
+        if (irq->num >= 8) {
+            outb(0xA0, 0x20);
+        }
+        outb(0x20, 0x20);
+    }
+
+    // IRQ0 is the tick that drives both detection and polling
+    if (irq->num != 0) {
+        irq_storm_check(irq);
     }
-    outb(0x20, 0x20);     
 
-    uint8_t irq = regs->int_no - 32;
-   
-    if (irq < IRQ_COUNT && irq_handlers[irq].handler != NULL) {
-        irq_handlers[irq].handler(regs, irq_handlers[irq].data);
+    trace_event(TRACE_IRQ_BEGIN, irq->num, 0);
+    if (irq->handler != NULL) {
+        irq->handler(regs, irq->data);
     }
+    trace_event(TRACE_IRQ_END, irq->num, 0);
 }
 
 void start_irq() {
@@ -0,0 +1,176 @@
+// irqstat.c -- Per-vector interrupt counters and handler duration histograms.
+//
+// interrupt_common_stub reads the TSC before calling a handler and passes
+// it to irqstat_record() afterwards, so every vector is measured the same
+// way. The cost is two rdtsc and a few adds per interrupt.
+
+#include "irqstat.h"
+#include "common.h"
+#include "libc/div64.h"
+#include "percpu.h"
+#include "smp.h"
+
+extern void terminal_printf(const char* format, ...);
+
+irq_stat_t irq_stats[APIC_MAX_CPUS][IDT_ENTRIES];
+
+// TSC when the counters were last cleared
+static uint64_t irqstat_start_tsc = 0;
+
+static const char* exception_names[32] = {
+    "divide error", "debug", "NMI", "breakpoint", "overflow", "bound range",
+    "invalid opcode", "no FPU", "double fault", "coprocessor overrun",
+    "invalid TSS", "segment not present", "stack fault", "general protection",
+    "page fault", "reserved", "x87 error", "alignment check", "machine check",
+    "SIMD error", "virtualization", "control protection",
+};
+
+static const char* irq_names[IRQ_COUNT] = {
+    [0] = "timer", [1] = "keyboard", [2] = "cascade", [3] = "COM2",
+    [4] = "COM1", [8] = "RTC", [12] = "mouse", [14] = "ATA primary",
+    [15] = "ATA secondary",
+};
+
+void irqstat_record(registers_t* regs, uint64_t start)
+{
+    uint64_t elapsed = rdtsc() - start;
+    uint32_t cycles = elapsed > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)elapsed;
+    irq_stat_t* stat = &irq_stats[this_cpu_index()][regs->int_no & 0xFF];
+
+    stat->count++;
+    stat->cycles += cycles;
+    if (cycles > stat->max_cycles) {
+        stat->max_cycles = cycles;
+    }
+    stat->histogram[cycles ? 31 - __builtin_clz(cycles) : 0]++;
+}
+
+// Other CPUs keep taking interrupts while their blocks are cleared, so
+// one that lands right then may be counted only in part
+void irqstat_reset(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    for (int cpu = 0; cpu < APIC_MAX_CPUS; cpu++) {
+        for (int i = 0; i < IDT_ENTRIES; i++) {
+            irq_stat_t* stat = &irq_stats[cpu][i];
+            stat->count = 0;
+            stat->max_cycles = 0;
+            stat->cycles = 0;
+            for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+                stat->histogram[b] = 0;
+            }
+        }
+    }
+    irqstat_start_tsc = rdtsc();
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+// part / whole in hundredths of a percent
+static uint32_t share_basis_points(uint64_t part, uint64_t whole)
+{
+    while (whole >> 32) {
+        whole >>= 1;
+        part >>= 1;
+    }
+    if (whole == 0) return 0;
+    return (uint32_t)div64_32(part * 10000, (uint32_t)whole, NULL);
+}
+
+// All CPUs' counts for one vector
+static void irqstat_sum(uint8_t vector, irq_stat_t* sum)
+{
+    sum->count = 0;
+    sum->max_cycles = 0;
+    sum->cycles = 0;
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        sum->histogram[b] = 0;
+    }
+
+    for (int cpu = 0; cpu < smp_cpus_online; cpu++) {
+        const irq_stat_t* stat = &irq_stats[cpu][vector];
+        sum->count += stat->count;
+        sum->cycles += stat->cycles;
+        if (stat->max_cycles > sum->max_cycles) {
+            sum->max_cycles = stat->max_cycles;
+        }
+        for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+            sum->histogram[b] += stat->histogram[b];
+        }
+    }
+}
+
+static void irqstat_print_name(uint8_t vector)
+{
+    if (vector < 32) {
+        terminal_printf("%d %s", vector, exception_names[vector] ? exception_names[vector] : "exception");
+    } else if (vector >= IRQ0 && vector <= IRQ15) {
+        uint8_t irq = vector - IRQ0;
+        terminal_printf("%d IRQ%d %s", vector, irq, irq_names[irq] ? irq_names[irq] : "");
+    } else {
+        terminal_printf("%d software", vector);
+    }
+}
+
+void irqstat_print_summary(void)
+{
+    // CPU share is of all online CPUs' time together
+    int cpus = smp_cpus_online;
+    uint64_t total = (rdtsc() - irqstat_start_tsc) * cpus;
+
+    terminal_printf("Interrupt Statistics (%d CPU%s)\n", cpus, cpus > 1 ? "s" : "");
+    terminal_printf("--------------------\n");
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        irq_stat_t sum;
+        const irq_stat_t* stat = &sum;
+        irqstat_sum(i, &sum);
+        if (stat->count == 0) continue;
+
+        uint32_t avg = (uint32_t)div64_32(stat->cycles, stat->count, NULL);
+        uint32_t share = share_basis_points(stat->cycles, total);
+
+        terminal_printf("vec ");
+        irqstat_print_name(i);
+        terminal_printf(": %u calls, avg %u cyc, max %u cyc, %u.%u%u%% CPU\n",
+                        stat->count, avg, stat->max_cycles,
+                        share / 100, (share / 10) % 10, share % 10);
+
+        if (cpus > 1) {
+            terminal_printf("   calls per CPU:");
+            for (int cpu = 0; cpu < cpus; cpu++) {
+                terminal_printf(" %u", irq_stats[cpu][i].count);
+            }
+            terminal_printf("\n");
+        }
+    }
+}
+
+void irqstat_print_histogram(uint8_t vector)
+{
+    irq_stat_t sum;
+    const irq_stat_t* stat = &sum;
+    irqstat_sum(vector, &sum);
+
+    terminal_printf("Handler cycles for vector ");
+    irqstat_print_name(vector);
+    terminal_printf(" (%u calls)\n", stat->count);
+    if (stat->count == 0) return;
+
+    uint32_t peak = 0;
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        if (stat->histogram[b] > peak) peak = stat->histogram[b];
+    }
+
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+        uint32_t n = stat->histogram[b];
+        if (n == 0) continue;
+
+        char bar[41];
+        uint32_t len = (uint32_t)div64_32((uint64_t)n * 40, peak, NULL);
+        if (len == 0) len = 1;
+        for (uint32_t j = 0; j < len; j++) bar[j] = '#';
+        bar[len] = '\0';
+
+        terminal_printf("  >= %u: %u %s\n", 1u << b, n, bar);
+    }
+}
@@ -1,29 +1,90 @@
 #include "interrupts.h"
+#include "common.h"
 #include "libc/stdint.h"
 #include "libc/stddef.h"
+#include "libc/div64.h"
+
+extern void terminal_printf(const char* format, ...);
+
+// Handler for every vector, called straight from interrupt_common_stub.
+// start_idt() points empty entries at isr_controller().
+struct interrupt_handler_t interrupt_handlers[IDT_ENTRIES];
 
 // Load the interrupt controller
 // This function sets up the interrupt controller for a specific interrupt
 void load_interrupt_controller(uint8_t n, isr_t controller, void* context)
 {
-    int_controllers[n].controller = controller;
-    int_controllers[n].data = context;
+    interrupt_handlers[n].handler = controller ? controller : isr_controller;
+    interrupt_handlers[n].data = context;
 }
 
 // isr_controller function
-// This function is called when an interrupt occurs
-void isr_controller(registers_t* regs)
+// This function is called when an interrupt occurs that nobody handles
+void isr_controller(registers_t* regs, void* context)
 {
-    uint8_t int_no = regs->int_no & 0xFF;
-    struct int_controller_t intrpt = int_controllers[int_no];
-    if (intrpt.controller != 0)
-    {
-        intrpt.controller(regs, intrpt.data);
-    }
-    else
-    {
-        terminal_printf("No handler for interrupt %d\n", int_no);
-    }
+    terminal_printf("No handler for interrupt %d\n", regs->int_no);
 }
 
+// Vectors borrowed by the benchmark, nothing else uses them
+#define BENCH_VECTOR      0xF0  // Full entry stub with an empty handler
+#define BENCH_VECTOR_BARE 0xF1  // Gate pointing straight at an iret
+#define BENCH_VECTOR_OLD  0xF2  // The entry path before the stub table
+#define BENCH_ROUNDS      10000
+
+extern void interrupt_return_stub(void);
+extern void interrupt_legacy_stub(void);
+
+static void bench_handler(registers_t* regs, void* context)
+{
+}
+
+// Called by interrupt_legacy_stub, copies the handler entry the way
+// isr_controller() used to
+void interrupt_legacy_dispatch(registers_t* regs)
+{
+    struct interrupt_handler_t entry = interrupt_handlers[regs->int_no & 0xFF];
+    entry.handler(regs, entry.data);
+}
 
+// Cycles for one "int" round trip: the minimum and the average
+#define BENCH_LOOP(insn, min, total) \
+    do { \
+        for (int i = 0; i < BENCH_ROUNDS; i++) { \
+            uint64_t t0 = rdtsc(); \
+            asm volatile(insn ::: "memory"); \
+            uint32_t d = (uint32_t)(rdtsc() - t0); \
+            if (d < min) min = d; \
+            total += d; \
+        } \
+    } while (0)
+
+void interrupt_benchmark(void)
+{
+    uint32_t min_empty = ~0u, min_bare = ~0u, min_old = ~0u, min_stub = ~0u;
+    uint64_t total_empty = 0, total_bare = 0, total_old = 0, total_stub = 0;
+
+    load_interrupt_controller(BENCH_VECTOR, bench_handler, NULL);
+    interrupt_gate(BENCH_VECTOR_BARE, (uint32_t)interrupt_return_stub, 0x08, IDT_GATE_INTERRUPT);
+    interrupt_gate(BENCH_VECTOR_OLD, (uint32_t)interrupt_legacy_stub, 0x08, IDT_GATE_INTERRUPT);
+
+    BENCH_LOOP("", min_empty, total_empty);
+    BENCH_LOOP("int $0xF1", min_bare, total_bare);
+    BENCH_LOOP("int $0xF2", min_old, total_old);
+    BENCH_LOOP("int $0xF0", min_stub, total_stub);
+
+    interrupt_gate(BENCH_VECTOR_BARE, (uint32_t)isr_stub_table[BENCH_VECTOR_BARE], 0x08, IDT_GATE_INTERRUPT);
+    interrupt_gate(BENCH_VECTOR_OLD, (uint32_t)isr_stub_table[BENCH_VECTOR_OLD], 0x08, IDT_GATE_INTERRUPT);
+    load_interrupt_controller(BENCH_VECTOR, NULL, NULL);
+
+    uint32_t avg_empty = (uint32_t)div64_32(total_empty, BENCH_ROUNDS, NULL);
+    uint32_t avg_bare = (uint32_t)div64_32(total_bare, BENCH_ROUNDS, NULL);
+    uint32_t avg_old = (uint32_t)div64_32(total_old, BENCH_ROUNDS, NULL);
+    uint32_t avg_stub = (uint32_t)div64_32(total_stub, BENCH_ROUNDS, NULL);
+
+    terminal_printf("Interrupt round trip, %d rounds (cycles, min / avg)\n", BENCH_ROUNDS);
+    terminal_printf("  rdtsc overhead:       %u / %u\n", min_empty, avg_empty);
+    terminal_printf("  bare int + iret:      %u / %u\n", min_bare - min_empty, avg_bare - avg_empty);
+    terminal_printf("  old stub + handler:   %u / %u\n", min_old - min_empty, avg_old - avg_empty);
+    terminal_printf("  stub + empty handler: %u / %u\n", min_stub - min_empty, avg_stub - avg_empty);
+    terminal_printf("  stub cost:            %u cycles, was %u\n", min_stub - min_bare, min_old - min_bare);
+}
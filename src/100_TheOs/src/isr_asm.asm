@@ -2,157 +2,153 @@
 ; interrupt.s -- Contains interrupt service routine wrappers.
 ;                Based on Bran's kernel development tutorials.
 ;                Rewritten for JamesM's kernel development tutorials.
-
-; This macro creates a stub for an ISR which does not pass
-; an error code. The first parameter is the interrupt number.
-%macro ISR_NO_ERROR 1
-  global isr%1
-  isr%1:
-    ;cli                        ; Disable interrupts.
+;
+; One small entry stub is generated per IDT vector and collected in
+; isr_stub_table, which start_idt() walks to fill the IDT. All stubs
+; share interrupt_common_stub, which calls the handler registered in
+; interrupt_handlers[] directly.
+
+; Offsets into registers_t (see interrupts.h) once the frame is built
+%define REGS_INT_NO 36
+%define REGS_CS     48
+%define REGS_EFLAGS 52
+
+%define EFLAGS_IF   0x200
+
+; Vectors where the CPU pushes an error code itself
+%define HAS_ERROR_CODE(n) ((n) == 8 || ((n) >= 10 && (n) <= 14) || (n) == 17 || (n) == 21 || (n) == 29 || (n) == 30)
+
+section .text
+
+; The stubs. Every stub leaves the same frame behind: an error code
+; (0 when the CPU does not push one) and the vector number.
+%assign i 0
+%rep 256
+isr_stub_%+i:
+%if HAS_ERROR_CODE(i)
+    push dword i                ; CPU already pushed the error code
+%else
     push byte 0                 ; Push 0 for the error code.
-    push  %1                    ; Push the interrupt number
-    jmp isr_common_stub         ; Jump to the common ISR stub.
-%endmacro
-
-; This macro creates a stub for an ISR which does pass
-; an error code. The first parameter is the interrupt number.
-%macro ISR_ERROR 1
-  global isr%1
-  isr%1:
-    ;cli                         ; Disable interrupts.
-    push %1                      ; Push the error code.
-    jmp isr_common_stub          ; Jump to the common ISR stub.
-%endmacro
-
-; This macro creates a stub for an IRQ that remaps the
-; interrupt number to the correct IRQ number. The first
-; parameter is the interrupt number, and the second is the
-; IRQ number.
-%macro IRQ 2
-  global irq%1
-  irq%1:
-    ;cli
-    push byte 0
-    push byte %2
-    jmp irq_common_stub
-%endmacro
-
-; This is the list of ISRs. The first column is the
-; interrupt number, the second column is the name of
-; the ISR. The third column is the error code.
-ISR_NO_ERROR 0
-ISR_NO_ERROR 1
-ISR_NO_ERROR 2
-ISR_NO_ERROR 3
-ISR_NO_ERROR 4
-ISR_NO_ERROR 5
-ISR_NO_ERROR 6
-ISR_NO_ERROR 7
-ISR_ERROR   8
-ISR_NO_ERROR 9
-ISR_ERROR   10
-ISR_ERROR   11
-ISR_ERROR   12
-ISR_ERROR   13
-ISR_ERROR   14
-ISR_NO_ERROR 15
-ISR_NO_ERROR 16
-ISR_ERROR 17
-ISR_NO_ERROR 18
-ISR_NO_ERROR 19
-ISR_NO_ERROR 20
-ISR_ERROR 21
-ISR_NO_ERROR 22
-ISR_NO_ERROR 23
-ISR_NO_ERROR 24
-ISR_NO_ERROR 25
-ISR_NO_ERROR 26
-ISR_NO_ERROR 27
-ISR_NO_ERROR 28
-ISR_NO_ERROR 29
-ISR_NO_ERROR 30
-ISR_NO_ERROR 31
-ISR_NO_ERROR 128
-IRQ   0,    32
-IRQ   1,    33
-IRQ   2,    34
-IRQ   3,    35
-IRQ   4,    36
-IRQ   5,    37
-IRQ   6,    38
-IRQ   7,    39
-IRQ   8,    40
-IRQ   9,    41
-IRQ  10,    42
-IRQ  11,    43
-IRQ  12,    44
-IRQ  13,    45
-IRQ  14,    46
-IRQ  15,    47
-
-; isr controller in isr.c
-extern isr_controller
-
-; This is our common ISR stub. It saves the processor state,
-; sets up for kernel mode segments, calls the C-level fault
-; controller, and finally restores the stack frame.
-isr_common_stub:
+    push dword i                ; Push the interrupt number
+%endif
+    jmp interrupt_common_stub
+%assign i i+1
+%endrep
+
+; Table of handlers, filled in by isr.c and irq.c
+extern interrupt_handlers
+; Per-vector counters in irqstat.c
+extern irqstat_record
+; Switches threads if a handler asked for it (thread.c)
+extern sched_preempt
+
+; This is our common interrupt stub. It saves the processor state,
+; calls the registered handler as handler(regs, context), and
+; finally restores the stack frame. A thread switch a handler asked for
+; happens last, once the vector's time is recorded, and only when the
+; interrupted code had interrupts on.
+interrupt_common_stub:
     pusha                    ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
 
-    mov ax, ds               ; Lower 16-bits of eax = ds.
+    mov eax, ds              ; Lower 16-bits of eax = ds.
     push eax                 ; save the data segment descriptor
 
+    ; The kernel runs with flat data segments, so they only need loading
+    ; when we came from another privilege level. Segment loads are slow.
+    test byte [esp + REGS_CS], 3
+    jz .dispatch
     mov ax, 0x10             ; load the kernel data segment descriptor
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30             ; and this CPU's per-CPU data (percpu.h)
     mov gs, ax
 
-    push esp                 ; CRITICAL FIX: Pass pointer to registers structure
-    call isr_controller      ; Call the C handler
-    add esp, 4               ; Clean up the pushed parameter
-
-    pop ebx                  ; reload the original data segment descriptor
-    mov ds, bx
-    mov es, bx
-    mov fs, bx
-    mov gs, bx
+.dispatch:
+    cld                      ; C code expects the direction flag clear
+    rdtsc                    ; Handler start time for irqstat_record
+    push edx
+    push eax
+
+    mov eax, [esp + 8 + REGS_INT_NO]
+    lea ecx, [esp + 8]
+    push dword [interrupt_handlers + eax * 8 + 4]   ; context
+    push ecx                                        ; registers_t*
+    call [interrupt_handlers + eax * 8]
+    add esp, 8
+
+    lea ecx, [esp + 8]
+    push ecx                 ; irqstat_record(regs, start)
+    call irqstat_record
+    add esp, 12
+
+    test dword [esp + REGS_EFLAGS], EFLAGS_IF
+    jz .return
+    call sched_preempt
+
+.return:
+    pop eax                  ; reload the original data segment descriptor
+    test byte [esp + REGS_CS - 4], 3
+    jz .restore
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
 
+.restore:
     popa                     ; Pops edi,esi,ebp...
-    add esp, 8     ; Cleans up the pushed error code and pushed ISR number
-    sti
-    iret           ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
-; isr controller in isr.c
-extern irq_controller
+    add esp, 8               ; Cleans up the pushed error code and pushed ISR number
+    iret                     ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
 
+; Does nothing but return. Used by the interrupt benchmark to measure
+; the cost of the int/iret round trip itself.
+global interrupt_return_stub
+interrupt_return_stub:
+    iret
+
+; The entry path as it was before the stub table: every segment register
+; reloaded both ways and the handler found by a C function. Only the
+; interrupt benchmark uses it, so one run compares old and new. GS gets
+; the per-CPU selector instead of 0x10, the number of loads is the same.
+extern interrupt_legacy_dispatch
+global interrupt_legacy_stub
+interrupt_legacy_stub:
+    push byte 0
+    push dword 0xF0          ; BENCH_VECTOR in isr.c, the empty handler
+    pusha
 
-; This is our common ISR stub. It saves the processor state,
-; sets up for kernel mode segments, calls the C-level fault
-; controller, and finally restores the stack frame.
-irq_common_stub:
-    pusha                    ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
+    mov ax, ds
+    push eax
 
-    mov ax, ds               ; Lower 16-bits of eax = ds.
-    push eax                 ; save the data segment descriptor
-
-    mov ax, 0x10             ; load the kernel data segment descriptor
+    mov ax, 0x10
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30
     mov gs, ax
 
-    push esp                 ; CRITICAL FIX: Pass pointer to registers structure
-    call irq_controller      ; Call the C handler
-    add esp, 4               ; Clean up the pushed parameter
+    push esp
+    call interrupt_legacy_dispatch
+    add esp, 4
 
-    pop ebx                  ; reload the original data segment descriptor
+    pop ebx
     mov ds, bx
     mov es, bx
     mov fs, bx
+    mov bx, 0x30
     mov gs, bx
 
-    popa                     ; Pops edi,esi,ebp...
-    add esp, 8               ; Cleans up the pushed error code and pushed ISR number
-    iret                     ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
+    popa
+    add esp, 8
+    iret
 
+section .data
 
+; Entry point of every vector, indexed by vector number
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 256
+    dd isr_stub_%+i
+%assign i i+1
+%endrep
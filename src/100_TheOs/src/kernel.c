@@ -10,6 +10,11 @@
 #include "monitor.h"
 #include "memory/memory.h"
 #include "keyboard.h"
+#include "framebuffer.h"
+#include "serial.h"
+#include "trace.h"
+#include "acpi.h"
+#include "clock.h"
 
 // Structure to hold multiboot information.
 struct multiboot_info {
@@ -53,8 +58,8 @@ void wait_with_skip(int seconds) {
                     terminal_clear();
                     return;
                 }
-               
-                for (volatile int l = 0; l < 100000; l++) { }
+
+                udelay(1000);
             }
         }
     }
@@ -99,10 +104,39 @@ void display_welcome_screen() {
     printf("\n");
 }
 
+// Walk the multiboot2 information tags and hand them to their drivers.
+// Runs before the heap is set up, since that clears memory the bootloader
+// may have placed the tags in.
+static void parse_multiboot(uint32_t magic, struct multiboot_info* mb_info_addr) {
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC || mb_info_addr == NULL) {
+        return;
+    }
+
+    struct multiboot_tag* tag = (struct multiboot_tag*)((uint8_t*)mb_info_addr + 8);
+    while (tag->type != MULTIBOOT_TAG_TYPE_END) {
+        switch (tag->type) {
+            case MULTIBOOT_TAG_TYPE_FRAMEBUFFER:
+                framebuffer_init((struct multiboot_tag_framebuffer*)tag);
+                break;
+            case MULTIBOOT_TAG_TYPE_ACPI_OLD:
+            case MULTIBOOT_TAG_TYPE_ACPI_NEW:
+                acpi_set_rsdp(((struct multiboot_tag_new_acpi*)tag)->rsdp, tag->size - 8);
+                break;
+            default:
+                break;
+        }
+        // Tags are padded to 8 bytes
+        tag = (struct multiboot_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7));
+    }
+}
+
 // Main entry point for the kernel, called from boot code.
 // magic: The multiboot magic number, should be MULTIBOOT2_BOOTLOADER_MAGIC.
 // mb_info_addr: Pointer to the multiboot information structure.
 int kernel_main_c(uint32_t magic, struct multiboot_info* mb_info_addr) {
+    // Pick up the framebuffer (if any) before the monitor chooses a backend
+    parse_multiboot(magic, mb_info_addr);
+
     // Initialize monitor first so we can display text
     monitor_initialize();
    
@@ -118,9 +152,14 @@ int kernel_main_c(uint32_t magic, struct multiboot_info* mb_info_addr) {
    
  
     init_pit();
+    clock_calibrate_tsc();
+
+    // Serial port for trace dumps, tracing starts right away
+    serial_init();
+    trace_init();
     
     // Wait for 5 seconds or until a key is pressed
-    // This must be after PIT initialization since it depends on the timer
+    // This must be after clock_calibrate_tsc() since it uses udelay()
     printf("\n");
     printf("Skip to mainscreen, wait for system information\n");
     wait_with_skip(5);
@@ -7,6 +7,14 @@ extern "C" {
     #include "song/song.h"
     #include "monitor.h"
     #include "pit.h"
+    #include "workqueue.h"
+    #include "syscall.h"
+    #include "fpu.h"
+    #include "clock.h"
+    #include "rtc.h"
+    #include "idle.h"
+    #include "thread.h"
+    #include "smp.h"
     
     void panic(const char* reason);
     void init_gdt(void);
@@ -51,6 +59,12 @@ extern "C" int kernel_main(void) {
     start_isr_controllers();
     printf("ISR handlers initialized\n");
 
+    // System calls: int 0x80 gate and sysenter
+    init_syscalls();
+
+    // FPU/SSE with lazy state switching (#NM)
+    fpu_init();
+
     // 5. Initialize PIT
     init_pit();
 
@@ -63,15 +77,30 @@ extern "C" int kernel_main(void) {
     asm volatile("sti");
     printf("Interrupts enabled\n");
 
+    // 8. Go tickless once the TSC has been measured against the PIT
+    clock_init();
+
+    // 9. Wall clock from the CMOS RTC
+    rtc_init();
+
+    // 10. Idle states and utilization accounting
+    idle_init();
+
+    // 11. Kernel threads, this flow becomes the worker thread
+    sched_init();
+    monitor_start_thread();
+
+    // 12. Application processors, each with its own run queue
+    smp_init();
+
 
     // Prompt
     printf("Ready. Type something below:\n");
     display_prompt();
     
-    // Main loop
-    while (true) {
-        asm volatile("hlt");
-    }
+    // Main loop: the kernel worker runs deferred work (shell input and
+    // commands) and blocks when there is none
+    work_worker_loop();
     
     return 0;
 }
\ No newline at end of file
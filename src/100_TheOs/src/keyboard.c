@@ -1,10 +1,30 @@
 #include "keyboard.h"
 #include "common.h"
 #include "interrupts.h"
+#include "irq.h"
 #include "libc/string.h"
 #include "libc/stdio.h"   
 #include "libc/stdbool.h" 
 #include "song/song.h"    
+#include "log.h"
+#include "trace.h"
+#include "serial.h"
+#include "monitor.h"
+#include "gfx.h"
+#include "irqstat.h"
+#include "apic.h"
+#include "workqueue.h"
+#include "syscall.h"
+#include "fpu.h"
+#include "clock.h"
+#include "rtc.h"
+#include "idle.h"
+#include "thread.h"
+#include "smp.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "waitqueue.h"
+#include "pit.h"
 
 // Constants for keyboard input
 #define CHAR_NONE 0
@@ -12,10 +32,26 @@
 #define CHAR_SPACE 3
 #define CHAR_BACKSPACE 8
 
-// Keyboard buffer
+// Keys for keyboard_getchar(), only collected while a thread waits there
 #define KEYBOARD_BUFFER_SIZE 256
 static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
-static int buffer_pos = 0;
+static volatile uint32_t keyboard_head = 0;
+static volatile uint32_t keyboard_tail = 0;
+static volatile uint32_t keyboard_readers = 0;
+static spinlock_t keyboard_lock = SPINLOCK_INIT("keyboard");
+static wait_queue_t keyboard_wait = WAIT_QUEUE_INIT("keyboard-wait");
+
+// Scancodes from the interrupt, each with the console visible when it
+// was typed, until the worker gets to them. The work queue is shared and
+// small, so it only ever holds one item that drains this ring, and keys
+// typed during a long command wait here.
+#define SCANCODE_RING_SIZE 256
+static uint16_t scancode_ring[SCANCODE_RING_SIZE];
+static uint32_t scancode_head = 0;
+static uint32_t scancode_tail = 0;
+static bool scancode_drain_queued = false;
+static uint32_t scancodes_dropped = 0;
+static spinlock_t scancode_lock = SPINLOCK_INIT("scancodes");
 
 // Command count for system info
 static int command_count = 0;
@@ -257,10 +293,16 @@ char scancode_to_ascii(unsigned char scancode)
      }
 }
 
-// Command buffer
+// Command buffer, one shell per virtual console
 #define COMMAND_BUFFER_SIZE 256
-static char command_buffer[COMMAND_BUFFER_SIZE];
-static int cmd_buffer_pos = 0;
+
+typedef struct {
+     char command_buffer[COMMAND_BUFFER_SIZE];
+     int cmd_buffer_pos;
+} shell_state_t;
+
+static shell_state_t shells[VT_COUNT];
+static bool altEnabled = false;     // Keyboard interrupt only
 
 // Add these CPU-related definitions
 #define CPUID_VENDOR_ID        0x00000000
@@ -373,6 +415,8 @@ void display_cpu_info() {
     if (cpu_info.has_sse2) terminal_printf("SSE2 ");
     if (cpu_info.has_sse3) terminal_printf("SSE3 ");
     terminal_printf("\n");
+    smp_print_info();
+    idle_print_stats();
 }
 
 // Function to display memory information
@@ -395,6 +439,8 @@ void display_uptime_info() {
     terminal_printf("Uptime Information\n");
     terminal_printf("-----------------\n");
     terminal_printf("System uptime: %d seconds\n", uptime_seconds);
+    clock_print_info();
+    timer_print_info();
 }
 
 // Function to display command statistics
@@ -405,14 +451,62 @@ void display_command_stats() {
 }
 
 
+// Function to display interrupt statistics
+void display_interrupt_info() {
+    apic_print_info();
+    irqstat_print_summary();
+    irq_print_throttle_stats();
+}
+
+// Parse a decimal number, false if the text is not one
+static bool parse_uint(const char* text, uint32_t* value) {
+    uint32_t result = 0;
+    if (*text == '\0') return false;
+    for (; *text; text++) {
+        if (*text < '0' || *text > '9') return false;
+        result = result * 10 + (*text - '0');
+    }
+    *value = result;
+    return true;
+}
+
+// Songs and long tests run as threads, so the shell stays usable
+static Song play_thread_song;
+static volatile bool play_thread_busy = false;
+
+static void play_thread(void* arg)
+{
+    play_song_impl(&play_thread_song);
+    play_thread_busy = false;
+}
+
+static void play_in_thread(const Song* song)
+{
+    if (play_thread_busy) {
+        terminal_printf("A song is already playing\n");
+        return;
+    }
+    play_thread_song = *song;
+    play_thread_busy = true;
+    if (!thread_create("play", play_thread, NULL)) {
+        terminal_printf("No free thread, playing in the shell\n");
+        play_thread(NULL);
+    }
+}
+
+static void pitlong_thread(void* arg)
+{
+    test_pit_10seconds();
+}
+
 // Display prompt
 void display_prompt()
 {
      terminal_printf("The...OS> ");
 }
 
-// Process a command with flag support
-void process_command(const char *cmd)
+// Run a command with flag support
+static void run_command(const char *cmd)
 {
     // Existing code...
     if (cmd[0] == 0)
@@ -455,14 +549,18 @@ void process_command(const char *cmd)
                 // Command statistics
                 display_command_stats();
             }
+            else if (strcmp(flag, "i") == 0) {
+                // Interrupt statistics
+                display_interrupt_info();
+            }
             else if (strcmp(flag, "h") == 0) {
                 // Available flags
-                terminal_printf("Available flags:\n -c (CPU)\n -m (Memory)\n -os (OS)\n -up (Uptime)\n -cd (Commands)\n");
+                terminal_printf("Available flags:\n -c (CPU)\n -m (Memory)\n -os (OS)\n -up (Uptime)\n -cd (Commands)\n -i (Interrupts)\n");
             }
             else {
                 // Unknown flag
                 terminal_printf("Unknown flag: %s\n", flag);
-                terminal_printf("Available flags: -c (CPU), -m (Memory), -os (OS), -up (Uptime), -cd (Commands)\n");
+                terminal_printf("Available flags: -c (CPU), -m (Memory), -os (OS), -up (Uptime), -cd (Commands), -i (Interrupts)\n");
             }
         }
         else {
@@ -483,6 +581,9 @@ void process_command(const char *cmd)
             terminal_printf("\n");
             
             display_command_stats();
+            terminal_printf("\n");
+
+            display_interrupt_info();
         }
         return;
     }
@@ -501,6 +602,23 @@ void process_command(const char *cmd)
         terminal_printf("  play <songname>  - Play a song (try 'play list' for options)\n");
         terminal_printf("  pitlong  - Run 10-second PIT accuracy test\n");
         terminal_printf("  memtest  - Run memory allocation tests\n");
+        terminal_printf("  loglevel [level] - Show or set log level (error..trace)\n");
+        terminal_printf("  trace on|off|clear|dump [bin] - Event tracing, dumped to serial\n");
+        terminal_printf("  gfxbench - Benchmark VBE fills and blits (QEMU -vga std)\n");
+        terminal_printf("  intbench - Interrupt round trip in cycles, old and new entry stubs\n");
+        terminal_printf("  irqstat [vector|reset] - Interrupt counts, cycles and histograms\n");
+        terminal_printf("  syscallbench - Cycles per null system call (int 0x80, sysenter)\n");
+        terminal_printf("  futexbench - Ring 3 futex mutex, uncontended and contended\n");
+        terminal_printf("  fpustat  - Lazy FPU switches, #NM traps, saves and restores\n");
+        terminal_printf("  jitter   - One-shot accuracy of PIT, HPET and APIC timer\n");
+        terminal_printf("  timerbench - Tick jitter, sleep latency and overshoot (also to serial)\n");
+        terminal_printf("  date [set YYYY-MM-DD HH:MM:SS | irq on|off] - Wall clock (UTC)\n");
+        terminal_printf("  idle [status on|off] - Idle state residency, utilization status line\n");
+        terminal_printf("  ps       - Kernel threads and their CPU time\n");
+        terminal_printf("  quantum [ms] - Show or set the scheduler time slice\n");
+        terminal_printf("  switchbench - Cycles per thread context switch\n");
+        terminal_printf("  locks [reset] - Lock acquisitions, contention and wait cycles\n");
+        terminal_printf("  Alt+F1..F4 - Switch virtual console\n");
     }
      // Check for echo command
      else if (strncmp(cmd, "echo ", 5) == 0)
@@ -580,57 +698,57 @@ void process_command(const char *cmd)
           if (strcmp(song_name, "mario") == 0) {
               temp_song.notes = mario_theme;
               temp_song.length = sizeof(mario_theme) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "starwars") == 0) {
               temp_song.notes = starwars_theme;
               temp_song.length = sizeof(starwars_theme) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "battlefield") == 0) {
               temp_song.notes = battlefield_1942_theme;
               temp_song.length = sizeof(battlefield_1942_theme) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "twinkle") == 0) {
               temp_song.notes = twinkle_twinkle;
               temp_song.length = sizeof(twinkle_twinkle) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "takeonme") == 0) {
               temp_song.notes = take_on_me;
               temp_song.length = sizeof(take_on_me) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "odetojoy") == 0) {
               temp_song.notes = ode_to_joy;
               temp_song.length = sizeof(ode_to_joy) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "tetris") == 0) {
               temp_song.notes = tetris_theme;
               temp_song.length = sizeof(tetris_theme) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "zelda") == 0) {
               temp_song.notes = zelda_theme;
               temp_song.length = sizeof(zelda_theme) / sizeof(Note);
-              play_song_impl(&temp_song);
+              play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "castlevania") == 0) {
                temp_song.notes = castlevania_theme;
                temp_song.length = sizeof(castlevania_theme) / sizeof(Note);
-               play_song_impl(&temp_song);
+               play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "hip-hop") == 0) {
                temp_song.notes = hiphop_melody;
                temp_song.length = sizeof(hiphop_melody) / sizeof(Note);
-               play_song_impl(&temp_song);
+               play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "mario-underworld") == 0) {
                temp_song.notes = mario_underworld;
                temp_song.length = sizeof(mario_underworld) / sizeof(Note);
-               play_song_impl(&temp_song);
+               play_in_thread(&temp_song);
           }
           else if (strcmp(song_name, "list") == 0) {
               // List all available songs
@@ -654,12 +772,165 @@ void process_command(const char *cmd)
       }
       else if (strcmp(cmd, "pitlong") == 0){
           terminal_printf("Running 10-second PIT accuracy test...\n");
-          test_pit_10seconds();
+          if (!thread_create("pitlong", pitlong_thread, NULL)) {
+              test_pit_10seconds();
+          }
      }
      else if (strcmp(cmd, "memtest") == 0)
      {
           terminal_printf("Running memory allocation tests...\n");
           test_memory();
+     }
+     else if (strncmp(cmd, "loglevel", 8) == 0)
+     {
+          const char* arg = cmd + 8;
+          while (*arg == ' ') arg++;
+
+          if (*arg != '\0') {
+               int level = -1;
+               for (int i = LOG_LEVEL_NONE; i <= LOG_LEVEL_TRACE; i++) {
+                    if (strcmp(arg, log_level_name(i)) == 0) level = i;
+               }
+               if (arg[0] >= '0' && arg[0] <= '5' && arg[1] == '\0') level = arg[0] - '0';
+
+               if (level < 0) {
+                    terminal_printf("Unknown log level: %s\n", arg);
+               } else {
+                    if (level > LOG_LEVEL_MAX) {
+                         terminal_printf("Levels above %s are not compiled in (OS_LOG_LEVEL)\n",
+                                         log_level_name(LOG_LEVEL_MAX));
+                    }
+                    log_set_level(level);
+               }
+          }
+          terminal_printf("Log level: %s (compiled in up to %s)\n",
+                          log_level_name(log_level), log_level_name(LOG_LEVEL_MAX));
+     }
+     else if (strcmp(cmd, "gfxbench") == 0)
+     {
+          gfx_benchmark();
+     }
+     else if (strcmp(cmd, "intbench") == 0)
+     {
+          interrupt_benchmark();
+     }
+     else if (strcmp(cmd, "syscallbench") == 0)
+     {
+          syscall_benchmark();
+     }
+     else if (strcmp(cmd, "futexbench") == 0)
+     {
+          futex_benchmark();
+     }
+     else if (strcmp(cmd, "fpustat") == 0)
+     {
+          fpu_print_stats();
+     }
+     else if (strncmp(cmd, "date", 4) == 0 && (cmd[4] == '\0' || cmd[4] == ' '))
+     {
+          const char* args = cmd[4] ? cmd + 5 : "";
+          rtc_time_t time;
+          if (args[0] == '\0') {
+              rtc_print_date();
+          } else if (strncmp(args, "set ", 4) == 0 && rtc_parse(args + 4, &time)) {
+              settime(rtc_to_unix(&time));
+              rtc_print_date();
+          } else if (strcmp(args, "irq on") == 0 || strcmp(args, "irq off") == 0) {
+              if (!rtc_enable_periodic(args[5] == 'n')) {
+                  terminal_printf("IRQ8 is in use by the HPET (legacy replacement)\n");
+              }
+          } else {
+              terminal_printf("Usage: date [set YYYY-MM-DD HH:MM:SS | irq on|off]\n");
+          }
+     }
+     else if (strcmp(cmd, "ps") == 0)
+     {
+          sched_print_threads();
+     }
+     else if (strncmp(cmd, "quantum", 7) == 0 && (cmd[7] == '\0' || cmd[7] == ' '))
+     {
+          uint32_t ms;
+          if (cmd[7] == ' ' && parse_uint(cmd + 8, &ms) && ms > 0) {
+              sched_set_quantum(ms);
+          } else if (cmd[7] == ' ') {
+              terminal_printf("Usage: quantum [ms]\n");
+          }
+          terminal_printf("Time slice: %u ms\n", sched_quantum_ms);
+     }
+     else if (strcmp(cmd, "switchbench") == 0)
+     {
+          sched_benchmark();
+     }
+     else if (strcmp(cmd, "locks") == 0)
+     {
+          lock_print_stats();
+     }
+     else if (strcmp(cmd, "locks reset") == 0)
+     {
+          lock_reset_stats();
+          terminal_printf("Lock statistics cleared\n");
+     }
+     else if (strcmp(cmd, "idle") == 0)
+     {
+          idle_print_stats();
+     }
+     else if (strcmp(cmd, "idle status on") == 0 || strcmp(cmd, "idle status off") == 0)
+     {
+          idle_status_line(cmd[13] == 'n');
+     }
+     else if (strcmp(cmd, "timerbench") == 0)
+     {
+          timer_benchmark();
+     }
+     else if (strcmp(cmd, "jitter") == 0)
+     {
+          clock_jitter_benchmark();
+     }
+     else if (strncmp(cmd, "irqstat", 7) == 0 && (cmd[7] == '\0' || cmd[7] == ' '))
+     {
+          const char* arg = cmd + 7;
+          uint32_t vector;
+          while (*arg == ' ') arg++;
+
+          if (*arg == '\0') {
+               irqstat_print_summary();
+          } else if (strcmp(arg, "reset") == 0) {
+               irqstat_reset();
+               terminal_printf("Interrupt statistics cleared\n");
+          } else if (parse_uint(arg, &vector) && vector < IDT_ENTRIES) {
+               irqstat_print_histogram(vector);
+          } else {
+               terminal_printf("Usage: irqstat [vector|reset]\n");
+          }
+     }
+     else if (strcmp(cmd, "trace on") == 0)
+     {
+          trace_enabled = true;
+          terminal_printf("Tracing enabled\n");
+     }
+     else if (strcmp(cmd, "trace off") == 0)
+     {
+          trace_enabled = false;
+          terminal_printf("Tracing disabled\n");
+     }
+     else if (strcmp(cmd, "trace clear") == 0)
+     {
+          trace_clear();
+          terminal_printf("Trace buffers cleared\n");
+     }
+     else if (strcmp(cmd, "trace dump") == 0 || strcmp(cmd, "trace dump bin") == 0)
+     {
+          if (!serial_present()) {
+               terminal_printf("No serial port, cannot dump trace\n");
+          } else if (strcmp(cmd, "trace dump bin") == 0) {
+               terminal_printf("Writing binary trace to COM1 (convert with scripts/trace_to_chrome.py)...\n");
+               trace_dump_binary();
+               terminal_printf("Done\n");
+          } else {
+               terminal_printf("Writing Chrome trace JSON to COM1...\n");
+               trace_dump_json();
+               terminal_printf("Done\n");
+          }
      }
           else
      {
@@ -668,11 +939,61 @@ void process_command(const char *cmd)
      }
 }
 
-// Keyboard controller function
-void keyboard_controller(registers_t *regs, void *context)
+// Process a command, recording its duration in the event trace
+void process_command(const char *cmd)
 {
-     // Read scancode from keyboard port
-     unsigned char scancode = inb(0x60);
+     uint32_t tag = 0;
+     for (int i = 0; i < 4 && cmd[i]; i++) {
+          tag |= (uint32_t)(uint8_t)cmd[i] << (i * 8);
+     }
+
+     trace_event(TRACE_CMD_BEGIN, tag, strlen(cmd));
+     run_command(cmd);
+     trace_event(TRACE_CMD_END, tag, 0);
+}
+
+static void keyboard_push(char c)
+{
+     uint32_t flags = spin_lock_irqsave(&keyboard_lock);
+     if (keyboard_head - keyboard_tail < KEYBOARD_BUFFER_SIZE)
+     {
+          keyboard_buffer[keyboard_head++ % KEYBOARD_BUFFER_SIZE] = c;
+     }
+     spin_unlock_irqrestore(&keyboard_lock, flags);
+     wake_up(&keyboard_wait);
+}
+
+static bool keyboard_pop(char* c)
+{
+     uint32_t flags = spin_lock_irqsave(&keyboard_lock);
+     bool popped = keyboard_head != keyboard_tail;
+     if (popped)
+     {
+          *c = keyboard_buffer[keyboard_tail++ % KEYBOARD_BUFFER_SIZE];
+     }
+     spin_unlock_irqrestore(&keyboard_lock, flags);
+     return popped;
+}
+
+char keyboard_getchar(void)
+{
+     char c;
+     atomic_inc(&keyboard_readers);
+     while (!keyboard_pop(&c))
+     {
+          wait_event(&keyboard_wait, keyboard_head != keyboard_tail);
+     }
+     atomic_fetch_sub(&keyboard_readers, 1);
+     return c;
+}
+
+// Handle one scancode: modifiers and line editing. Runs from the kernel
+// worker, so commands started with Enter run with
+// interrupts enabled and outside the keyboard interrupt.
+static void keyboard_handle_scancode(uint16_t entry)
+{
+     unsigned char scancode = (unsigned char)entry;
+     int vt = entry >> 8;
 
      // Handle key release (bit 7 set)
      if (scancode & 0x80)
@@ -685,35 +1006,54 @@ void keyboard_controller(registers_t *regs, void *context)
           return; // No need to process key releases further
      }
 
+     // A thread waiting in keyboard_getchar() gets the key, not the shell
+     if (keyboard_readers > 0)
+     {
+          char ascii = scancode_to_ascii(scancode);
+          if (ascii == CHAR_ENTER)
+          {
+               keyboard_push('\n');
+          }
+          else if (ascii != CHAR_NONE)
+          {
+               keyboard_push(ascii);
+          }
+          return;
+     }
+
+     // Input belongs to the shell on the console visible when it was typed
+     shell_state_t* shell = &shells[vt];
+     monitor_select_output_vt(vt);
+
      // Handle special keys
      if (scancode == KEY_ENTER)
      {
           terminal_printf("\n");
-          command_buffer[cmd_buffer_pos] = '\0';
-          process_command(command_buffer);
-          cmd_buffer_pos = 0;
+          shell->command_buffer[shell->cmd_buffer_pos] = '\0';
+          process_command(shell->command_buffer);
+          shell->cmd_buffer_pos = 0;
           for (int i = 0; i < COMMAND_BUFFER_SIZE; i++)
           {
-               command_buffer[i] = 0;
+               shell->command_buffer[i] = 0;
           }
           display_prompt();
           return;
      }
      else if (scancode == KEY_SPACE)
      {
-          if (cmd_buffer_pos < COMMAND_BUFFER_SIZE - 1)
+          if (shell->cmd_buffer_pos < COMMAND_BUFFER_SIZE - 1)
           {
-               command_buffer[cmd_buffer_pos++] = ' ';
+               shell->command_buffer[shell->cmd_buffer_pos++] = ' ';
                terminal_printf(" ");
           }
           return;
      }
      else if (scancode == KEY_BACKSPACE)
      {
-          if (cmd_buffer_pos > 0)
+          if (shell->cmd_buffer_pos > 0)
           {
-               cmd_buffer_pos--;
-               command_buffer[cmd_buffer_pos] = 0;
+               shell->cmd_buffer_pos--;
+               shell->command_buffer[shell->cmd_buffer_pos] = 0;
                monitor_backspace();
           }
           return;
@@ -721,35 +1061,120 @@ void keyboard_controller(registers_t *regs, void *context)
 
      // Convert scancode to ASCII
      char ascii = scancode_to_ascii(scancode);
-     if (ascii != CHAR_NONE && cmd_buffer_pos < COMMAND_BUFFER_SIZE - 1)
+     if (ascii != CHAR_NONE && shell->cmd_buffer_pos < COMMAND_BUFFER_SIZE - 1)
      {
-          command_buffer[cmd_buffer_pos++] = ascii;
+          shell->command_buffer[shell->cmd_buffer_pos++] = ascii;
           terminal_printf("%c", ascii);
      }
 }
 
+// Work item: handle every queued scancode, in order
+static void keyboard_drain_scancodes(void* data)
+{
+     while (1)
+     {
+          uint32_t flags = spin_lock_irqsave(&scancode_lock);
+          if (scancode_tail == scancode_head)
+          {
+               scancode_drain_queued = false;
+               spin_unlock_irqrestore(&scancode_lock, flags);
+               return;
+          }
+          uint16_t entry = scancode_ring[scancode_tail++ % SCANCODE_RING_SIZE];
+          uint32_t dropped = scancodes_dropped;
+          scancodes_dropped = 0;
+          spin_unlock_irqrestore(&scancode_lock, flags);
+
+          if (dropped)
+          {
+               LOG_WARN("keyboard", "%u keys dropped, input ring full\n", dropped);
+          }
+          keyboard_handle_scancode(entry);
+     }
+}
+
+static void keyboard_queue_scancode(uint16_t entry)
+{
+     uint32_t flags = spin_lock_irqsave(&scancode_lock);
+     if (scancode_head - scancode_tail < SCANCODE_RING_SIZE)
+     {
+          scancode_ring[scancode_head++ % SCANCODE_RING_SIZE] = entry;
+     }
+     else
+     {
+          scancodes_dropped++;
+     }
+
+     // A full work queue drops the drain, not the key: the next key
+     // tries again
+     if (!scancode_drain_queued)
+     {
+          scancode_drain_queued = work_queue(keyboard_drain_scancodes, NULL);
+     }
+     spin_unlock_irqrestore(&scancode_lock, flags);
+}
+
+// Keyboard controller function
+// Switches consoles itself, so Alt+F1..F4 works while the worker runs a
+// long command; everything else is deferred to the worker
+void keyboard_controller(registers_t *regs, void *context)
+{
+     // Nothing to read, e.g. when polled while IRQ1 is throttled
+     if (!(inb(0x64) & 1)) return;
+
+     // Read scancode from keyboard port
+     unsigned char scancode = inb(0x60);
+
+     if ((scancode & 0x7F) == KEY_ALT)
+     {
+          altEnabled = !(scancode & 0x80);
+          return;
+     }
+     if (altEnabled && scancode >= KEY_F1 && scancode < KEY_F1 + VT_COUNT)
+     {
+          monitor_switch_vt(scancode - KEY_F1);
+          return;
+     }
+
+     // With the console it was typed on, which may be gone from screen by
+     // the time the worker gets to it
+     keyboard_queue_scancode(scancode | monitor_visible_vt() << 8);
+}
+
 void start_keyboard(void)
 {
      shiftEnabled = false;
      capsEnabled = false;
-     buffer_pos = 0;
-     cmd_buffer_pos = 0;
+     altEnabled = false;
 
-     // Clear command buffer
-     for (int i = 0; i < COMMAND_BUFFER_SIZE; i++)
+     // Clear command buffers
+     for (int vt = 0; vt < VT_COUNT; vt++)
      {
-          command_buffer[i] = 0;
+          shells[vt].cmd_buffer_pos = 0;
+          for (int i = 0; i < COMMAND_BUFFER_SIZE; i++)
+          {
+               shells[vt].command_buffer[i] = 0;
+          }
      }
 
      // Enable PS/2 keyboard
      outb(0x64, 0xAE);
 
      // Unmask keyboard IRQ
-     outb(0x21, inb(0x21) & ~(1 << 1));
+     irq_unmask(1);
 
      // Register keyboard handler
      register_irq_handler(1, keyboard_controller, NULL);
 
+     // The other consoles start out with just a prompt
+     for (int vt = 1; vt < VT_COUNT; vt++)
+     {
+          monitor_select_output_vt(vt);
+          terminal_printf("Console %d (Alt+F%d)\n", vt + 1, vt + 1);
+          display_prompt();
+     }
+     monitor_select_output_vt(0);
+
      // Display prompt
      display_prompt();
 }
\ No newline at end of file
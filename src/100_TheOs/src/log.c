@@ -0,0 +1,42 @@
+// log.c -- Leveled kernel logging.
+
+#include "log.h"
+#include "monitor.h"
+#include "libc/stdarg.h"
+
+extern int vsnprintf(char* str, size_t size, const char* format, va_list args);
+
+// Start out showing everything that was compiled in
+uint8_t log_level = LOG_LEVEL_MAX;
+
+static const char* level_names[] = {
+    "none", "error", "warn", "info", "debug", "trace"
+};
+
+void log_set_level(uint8_t level) {
+    log_level = level > LOG_LEVEL_TRACE ? LOG_LEVEL_TRACE : level;
+}
+
+const char* log_level_name(uint8_t level) {
+    return level <= LOG_LEVEL_TRACE ? level_names[level] : "?";
+}
+
+// Format "[level tag] message" into one buffer so a line is written at once
+void log_write(uint8_t level, const char* tag, const char* format, ...) {
+    char buffer[256];
+    size_t len = 0;
+
+    buffer[len++] = '[';
+    for (const char* p = log_level_name(level); *p; p++) buffer[len++] = *p;
+    buffer[len++] = ' ';
+    for (const char* p = tag; *p && len < 32; p++) buffer[len++] = *p;
+    buffer[len++] = ']';
+    buffer[len++] = ' ';
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer + len, sizeof(buffer) - len, format, args);
+    va_end(args);
+
+    monitor_writestring(buffer);
+}
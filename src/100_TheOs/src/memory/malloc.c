@@ -1,6 +1,9 @@
 #include "memory/memory.h"
 #include "libc/system.h"
 #include "libc/string.h"
+#include "log.h"
+#include "trace.h"
+#include "spinlock.h"
 
 #define MAX_PAGE_ALIGNED_ALLOCS 32
 #define ALIGN_PADDING 4
@@ -20,6 +23,10 @@ static uint8_t* pheap_desc = 0;
 
 static uint32_t memory_used = 0;
 
+// Block headers and the page slots. Blocks are cleared after it is
+// dropped, they belong to the caller by then.
+static spinlock_t heap_lock = SPINLOCK_INIT("heap");
+
 void init_kernel_memory(uint32_t* kernel_end)
 {
     last_alloc = (uint32_t*)((uint32_t)kernel_end + 0x1000);
@@ -77,6 +84,7 @@ void* malloc(size_t size)
 {
     if (!size) return 0;
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     uint8_t* current = (uint8_t*)heap_begin;
     while ((uint32_t)current < (uint32_t)last_alloc) {
         alloc_t* block = (alloc_t*)current;
@@ -90,8 +98,10 @@ void* malloc(size_t size)
 
         if (block->size >= size) {
             block->status = 1;
-            memset(current + sizeof(alloc_t), 0, size);
             memory_used += size + sizeof(alloc_t);
+            spin_unlock_irqrestore(&heap_lock, flags);
+            memset(current + sizeof(alloc_t), 0, size);
+            trace_event(TRACE_MALLOC, size, (uint32_t)(current + sizeof(alloc_t)));
             return current + sizeof(alloc_t);
         }
 
@@ -108,28 +118,36 @@ void* malloc(size_t size)
 
     last_alloc = (uint32_t*)((uint32_t)last_alloc + size + sizeof(alloc_t) + ALIGN_PADDING);
     memory_used += size + sizeof(alloc_t) + ALIGN_PADDING;
+    spin_unlock_irqrestore(&heap_lock, flags);
 
     memset((uint8_t*)new_block + sizeof(alloc_t), 0, size);
+    trace_event(TRACE_MALLOC, size, (uint32_t)new_block + sizeof(alloc_t));
     return (uint8_t*)new_block + sizeof(alloc_t);
 }
 
 void free(void* ptr)
 {
     if (!ptr) return;
+    trace_event(TRACE_FREE, (uint32_t)ptr, 0);
     alloc_t* block = (alloc_t*)((uint8_t*)ptr - sizeof(alloc_t));
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     block->status = 0;
     memory_used -= block->size + sizeof(alloc_t) + ALIGN_PADDING;
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 void* pmalloc(size_t size)
 {
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     for (int i = 0; i < MAX_PAGE_ALIGNED_ALLOCS; i++) {
         if (pheap_desc[i]) continue;
 
         pheap_desc[i] = 1;
+        spin_unlock_irqrestore(&heap_lock, flags);
         uint32_t addr = pheap_begin + i * 4096;
         memset((void*)addr, 0, 4096); 
-        printf("✅ pmalloc: 0x%x → 0x%x\n", addr, addr + 4096);
+        trace_event(TRACE_PMALLOC, addr, 0);
+        LOG_DEBUG("mem", "pmalloc: 0x%x -> 0x%x\n", addr, addr + 4096);
         return (void*)addr;
     }
 
@@ -142,7 +160,9 @@ void pfree(void* ptr)
     if (!ptr || (uint32_t)ptr < pheap_begin || (uint32_t)ptr >= pheap_end) return;
 
     uint32_t page_id = ((uint32_t)ptr - pheap_begin) / 4096;
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     pheap_desc[page_id] = 0;
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 void test_memory(void) {
     printf("Minimal Memory Test\n");
@@ -38,3 +38,31 @@ void* memset (void * ptr, int value, size_t num )
         *p++ = (unsigned char)value;   
     return ptr;               
 }
+
+void* memmove(void* dest, const void* src, size_t count)
+{
+    unsigned char* d = dest;
+    const unsigned char* s = src;
+
+    if (d == s || count == 0)
+        return dest;
+
+    // Copy forwards when the destination is below the source, otherwise
+    // backwards, so overlapping ranges (like scrolled screen rows) survive.
+    if (d < s) {
+        if ((((uint32_t)d | (uint32_t)s | count) & 3) == 0) {
+            size_t dwords = count / 4;
+            asm volatile("cld; rep movsl"
+                         : "+D"(d), "+S"(s), "+c"(dwords) : : "memory");
+        } else {
+            while (count--)
+                *d++ = *s++;
+        }
+    } else {
+        d += count;
+        s += count;
+        while (count--)
+            *--d = *--s;
+    }
+    return dest;
+}
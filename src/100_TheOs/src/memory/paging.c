@@ -13,12 +13,18 @@
 // Page flags
 #define PAGE_PRESENT_RW 0x3    // Present + Writable
 #define PAGE_RW         0x2    // Writable only
+#define PAGE_USER       0x4    // Reachable from ring 3
 
 // Page table structures
 static uint32_t* kernel_page_directory = 0;
 static uint32_t* next_free_page_table = 0;
 static uint32_t page_directory_phys = 0;
 
+// Device ranges requested before paging was set up, mapped by init_paging()
+#define MAX_PENDING_MMIO 8
+static struct { uint32_t base; uint32_t size; } pending_mmio[MAX_PENDING_MMIO];
+static int pending_mmio_count = 0;
+
 // Map a full 4MB of virtual memory to 4MB physical memory
 void paging_map_region(uint32_t virtual_addr, uint32_t physical_addr) {
     uint32_t dir_index = virtual_addr >> 22;  // Use top 10 bits for directory index
@@ -32,6 +38,72 @@ void paging_map_region(uint32_t virtual_addr, uint32_t physical_addr) {
     next_free_page_table = (uint32_t*)((uint32_t)next_free_page_table + PAGE_SIZE);
 }
 
+// Identity map every 4MB region touched by [physical_addr, physical_addr + size)
+static void paging_map_range(uint32_t physical_addr, uint32_t size) {
+    uint32_t region = physical_addr & ~0x3FFFFF;
+    uint32_t last = (physical_addr + size - 1) & ~0x3FFFFF;
+
+    while (1) {
+        // Skip regions that already have a page table
+        if (!(kernel_page_directory[region >> 22] & 0x1)) {
+            paging_map_region(region, region);
+        }
+        if (region == last) break;
+        region += 0x400000;
+    }
+}
+
+// Identity map a device memory range (framebuffers, MMIO registers).
+// Before init_paging() the range is only remembered; afterwards it is
+// mapped immediately and the TLB is flushed.
+void paging_map_mmio(uint32_t physical_addr, uint32_t size) {
+    if (size == 0) return;
+
+    if (kernel_page_directory == 0) {
+        if (pending_mmio_count < MAX_PENDING_MMIO) {
+            pending_mmio[pending_mmio_count].base = physical_addr;
+            pending_mmio[pending_mmio_count].size = size;
+            pending_mmio_count++;
+        }
+        return;
+    }
+
+    paging_map_range(physical_addr, size);
+    asm volatile("mov %0, %%cr3" : : "r"(page_directory_phys) : "memory");
+}
+
+// Let ring 3 use the already mapped pages of [addr, addr + size). The
+// directory entry gets the user bit too; the CPU checks both levels.
+void paging_set_user(uint32_t addr, uint32_t size) {
+    uint32_t page = addr & ~(PAGE_SIZE - 1);
+    uint32_t last = (addr + size - 1) & ~(PAGE_SIZE - 1);
+
+    while (1) {
+        uint32_t* pde = &kernel_page_directory[page >> 22];
+        if (*pde & 0x1) {
+            uint32_t* table = (uint32_t*)(*pde & ~0xFFF);
+            *pde |= PAGE_USER;
+            table[(page >> 12) & 0x3FF] |= PAGE_USER;
+        }
+        if (page == last) break;
+        page += PAGE_SIZE;
+    }
+    asm volatile("mov %0, %%cr3" : : "r"(page_directory_phys) : "memory");
+}
+
+// Walks the tables, so it stays right once mappings are not identity
+uint32_t paging_virt_to_phys(uint32_t virtual_addr) {
+    if (kernel_page_directory == 0) {
+        return virtual_addr;  // Paging is not on yet
+    }
+
+    uint32_t pde = kernel_page_directory[virtual_addr >> 22];
+    if (!(pde & 0x1)) return 0;
+    uint32_t pte = ((uint32_t*)(pde & ~0xFFF))[(virtual_addr >> 12) & 0x3FF];
+    if (!(pte & 0x1)) return 0;
+    return (pte & ~0xFFF) | (virtual_addr & 0xFFF);
+}
+
 // Enable paging using inline assembly
 void paging_enable() {
     asm volatile("mov %0, %%cr3" : : "r"(page_directory_phys)); // Set page directory
@@ -55,6 +127,11 @@ void init_paging() {
     paging_map_region(0x00000000, 0x00000000);       // First 4MB
     paging_map_region(0x00400000, 0x00400000);       // Next 4MB
 
+    // Device memory registered during early boot (e.g. the framebuffer)
+    for (int i = 0; i < pending_mmio_count; i++) {
+        paging_map_range(pending_mmio[i].base, pending_mmio[i].size);
+    }
+
     paging_enable();
 
     terminal_printf("Paging is enabled and 0-8MB mapped!\n");
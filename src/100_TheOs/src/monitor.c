@@ -6,6 +6,12 @@
 #include "libc/system.h"
 #include "common.h"
 #include "libc/stdarg.h"
+#include "framebuffer.h"
+#include "memory/memory.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "waitqueue.h"
+#include "log.h"
 
 enum vga_color {
 	VGA_COLOR_BLACK = 0,
@@ -35,22 +41,67 @@ size_t terminal_column;
 uint8_t terminal_color;
 uint16_t* terminal_buffer;
 
+// Console size in cells, 80x25 in VGA text mode or larger on a framebuffer
+size_t terminal_width;
+size_t terminal_height;
+
+// Framebuffer backend: cells live in RAM and are rendered on flush
+static bool fb_console = false;
+static uint16_t fb_cell_buffer[VT_COUNT][FB_MAX_COLS * FB_MAX_ROWS];
+
+// Virtual consoles. In VGA text mode each one owns a 4KB page of the 32KB
+// text memory and switching only moves the CRTC start address. Every
+// thread prints to its own console (thread_console()), so work started
+// on one keeps printing there while another is on screen. The terminal_*
+// globals describe the console being written, selected under the
+// console lock by each call; the others are parked here.
+#define VT_PAGE_CELLS 2048
+
+typedef struct {
+    uint16_t* buffer;
+    size_t row;
+    size_t column;
+    uint8_t color;
+} vt_state_t;
+
+static vt_state_t vts[VT_COUNT];
+static int output_vt = 0;   // Console the terminal_* globals describe
+static int visible_vt = 0;  // Console on screen
+
+// Cursor, buffers and the hardware cursor, for every CPU and the keyboard
+// interrupt. Taken per call, so a line printed with one call stays whole.
+static spinlock_t console_lock = SPINLOCK_INIT("console");
+
+// A switch on the framebuffer repaints the whole screen, too slow for the
+// keyboard interrupt. monitor_switch_vt() only sets this; the console
+// thread repaints, and until then nothing is drawn.
+static volatile bool fb_switch_pending = false;
+static wait_queue_t console_wait = WAIT_QUEUE_INIT("console-wait");
+
+// Only the visible console touches the framebuffer
+static inline bool fb_draws(void)
+{
+    return fb_console && !fb_switch_pending && output_vt == visible_vt;
+}
+
 // Scrolls the text on the screen up by one line.
 static void scroll()
 {
     uint8_t attributeByte = (0 << 4) | (15 & 0x0F);
-    uint16_t blank = 0x20 | (attributeByte << 8);
-    if(terminal_row >= 25)
+    if(terminal_row >= terminal_height)
     {
-        for (int i = 0*80; i < 24*80; i++)
+        // Move rows 1..height-1 up in one go
+        memmove(terminal_buffer, terminal_buffer + terminal_width,
+                (terminal_height - 1) * terminal_width * sizeof(uint16_t));
+        if (fb_draws())
         {
-            terminal_buffer[i] = terminal_buffer[i+80];
+            fb_console_scroll(1);
         }
-        for (int i = 24*80; i < 25*80; i++)
+        for (size_t x = 0; x < terminal_width; x++)
         {
-            terminal_buffer[i] = blank;
+            monitor_putentryat(' ', attributeByte, x, terminal_height - 1);
         }
-        terminal_row = 24;
+        terminal_row = terminal_height - 1;
     }
 }
 
@@ -58,13 +109,36 @@ static void scroll()
 
 static void move_cursor()
 {
-    uint16_t pos = terminal_row * 80 + terminal_column;
+    if (output_vt != visible_vt)
+    {
+        return;
+    }
+    if (fb_console)
+    {
+        if (fb_draws())
+        {
+            fb_console_set_cursor(terminal_column, terminal_row);
+            fb_console_flush();
+        }
+        return;
+    }
+    // The cursor location is relative to the start of text memory
+    uint16_t pos = visible_vt * VT_PAGE_CELLS + terminal_row * terminal_width + terminal_column;
 	outb(0x3D4, 0x0F);
 	outb(0x3D5, (uint8_t) (pos & 0xFF));
 	outb(0x3D4, 0x0E);
 	outb(0x3D5, (uint8_t) ((pos >> 8) & 0xFF));
 }
 
+// Point the CRTC at a different character offset in text memory
+static void vga_set_start(uint16_t offset)
+{
+	outb(0x3D4, 0x0C);
+	outb(0x3D5, (uint8_t) ((offset >> 8) & 0xFF));
+	outb(0x3D4, 0x0D);
+	outb(0x3D5, (uint8_t) (offset & 0xFF));
+}
+
 static inline uint8_t vga_entry_color(enum vga_color fg, enum vga_color bg) 
 {
 	return fg | bg << 4;
@@ -80,32 +154,153 @@ void monitor_initialize(void)
 	terminal_row = 0;
 	terminal_column = 0;
 	terminal_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	terminal_buffer = video_memory;
-	for (size_t y = 0; y < VGA_HEIGHT; y++) {
-		for (size_t x = 0; x < VGA_WIDTH; x++) {
-			const size_t index = y * VGA_WIDTH + x;
-			terminal_buffer[index] = vga_entry(' ', terminal_color);
+	if (framebuffer_present()) {
+		// Render into the linear framebuffer from a RAM cell buffer
+		fb_console = true;
+		terminal_width = fb_console_cols();
+		terminal_height = fb_console_rows();
+	} else {
+		terminal_width = VGA_WIDTH;
+		terminal_height = VGA_HEIGHT;
+	}
+	for (int vt = 0; vt < VT_COUNT; vt++) {
+		vts[vt].buffer = fb_console ? fb_cell_buffer[vt] : video_memory + vt * VT_PAGE_CELLS;
+		vts[vt].row = 0;
+		vts[vt].column = 0;
+		vts[vt].color = terminal_color;
+		for (size_t i = 0; i < terminal_width * terminal_height; i++) {
+			vts[vt].buffer[i] = vga_entry(' ', terminal_color);
 		}
 	}
+	output_vt = 0;
+	visible_vt = 0;
+	terminal_buffer = vts[0].buffer;
+	if (fb_console) {
+		fb_console_attach(terminal_buffer);
+	} else {
+		vga_set_start(0);
+	}
+	move_cursor();
+}
+
+static void select_output_vt(int vt)
+{
+	if (vt < 0 || vt >= VT_COUNT || vt == output_vt) return;
+
+	vts[output_vt].row = terminal_row;
+	vts[output_vt].column = terminal_column;
+	vts[output_vt].color = terminal_color;
+
+	output_vt = vt;
+	terminal_buffer = vts[vt].buffer;
+	terminal_row = vts[vt].row;
+	terminal_column = vts[vt].column;
+	terminal_color = vts[vt].color;
+}
+
+// Console lock held
+static void select_thread_vt(void)
+{
+	select_output_vt(thread_console());
+}
+
+// Send the calling thread's output, and that of threads it creates from
+// now on, to another console without changing what is on screen
+void monitor_select_output_vt(int vt)
+{
+	if (vt < 0 || vt >= VT_COUNT) return;
+	thread_set_console(vt);
+}
+
+// Bring a console on screen. In text mode this is a page flip: the CRTC
+// start address moves to the console's page and nothing is copied. On
+// the framebuffer the console thread does the repaint.
+void monitor_switch_vt(int vt)
+{
+	if (vt < 0 || vt >= VT_COUNT || vt == visible_vt) return;
+
+	uint32_t flags = spin_lock_irqsave(&console_lock);
+	visible_vt = vt;
+	if (fb_console) {
+		fb_switch_pending = true;
+	} else {
+		vga_set_start(vt * VT_PAGE_CELLS);
+
+		// Put the cursor where the now visible console left it
+		select_output_vt(vt);
+		move_cursor();
+	}
+	spin_unlock_irqrestore(&console_lock, flags);
+
+	if (fb_console) {
+		wake_up(&console_wait);
+	}
+}
+
+// Repaint the visible console after a switch, or after something else
+// used the display
+void monitor_redraw(void)
+{
+	if (!fb_console) return;
+	uint32_t flags = spin_lock_irqsave(&console_lock);
+	fb_switch_pending = false;
+	fb_console_attach(vts[visible_vt].buffer);
+	select_output_vt(visible_vt);
+	move_cursor();
+	spin_unlock_irqrestore(&console_lock, flags);
+}
+
+static void console_thread(void* arg)
+{
+	while (1) {
+		wait_event(&console_wait, fb_switch_pending);
+		monitor_redraw();
+	}
+}
+
+void monitor_start_thread(void)
+{
+	if (!fb_console) return;
+	if (!thread_create("console", console_thread, NULL)) {
+		LOG_WARN("monitor", "no console thread, Alt+Fn will not repaint\n");
+	}
+}
+
+int monitor_visible_vt(void)
+{
+	return visible_vt;
+}
+
+int monitor_output_vt(void)
+{
+	return thread_console();
 }
  
 void monitor_backspace() {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    select_thread_vt();
     if (terminal_column > 0) {
         terminal_column--;
         monitor_putentryat(' ', terminal_color, terminal_column, terminal_row);
         move_cursor();
     }
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
 void monitor_setcolor(uint8_t color) 
 {
+	uint32_t flags = spin_lock_irqsave(&console_lock);
+	select_thread_vt();
 	terminal_color = color;
+	spin_unlock_irqrestore(&console_lock, flags);
 }
  
 void monitor_putentryat(char c, uint8_t color, size_t x, size_t y) 
 {
-	const size_t index = y * VGA_WIDTH + x;
+	const size_t index = y * terminal_width + x;
 	terminal_buffer[index] = vga_entry(c, color);
+	if (fb_draws())
+		fb_console_mark(x, y);
 }
 
 void _monitor_put(char c) 
@@ -121,26 +316,32 @@ void _monitor_put(char c)
 		break;
 	}
 	monitor_putentryat(c, terminal_color, terminal_column, terminal_row);
-	if (++terminal_column == VGA_WIDTH) {
+	if (++terminal_column == terminal_width) {
 		terminal_column = 0;
-		if (++terminal_row == VGA_HEIGHT)
+		if (++terminal_row == terminal_height)
 			terminal_row = 0;
 	}
 }
 
 void monitor_put(char c) 
 {
+	uint32_t flags = spin_lock_irqsave(&console_lock);
+	select_thread_vt();
 	_monitor_put(c);
     scroll();
     move_cursor();
+	spin_unlock_irqrestore(&console_lock, flags);
 }
  
 void monitor_write(const char* data, size_t size) 
 {
+	uint32_t flags = spin_lock_irqsave(&console_lock);
+	select_thread_vt();
 	for (size_t i = 0; i < size; i++)
 		_monitor_put(data[i]);
     scroll();
     move_cursor();
+	spin_unlock_irqrestore(&console_lock, flags);
 }
  
 void monitor_writestring(const char* data) 
@@ -148,17 +349,44 @@ void monitor_writestring(const char* data)
 	monitor_write(data, strlen(data));
 }
 
+// Drawn over whatever is there on the visible console; scrolling moves
+// it away until the next update
+void monitor_status(const char* text)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    select_output_vt(visible_vt);
+    size_t len = strlen(text);
+    if (len > terminal_width) len = terminal_width;
+    size_t x = terminal_width - len;
+    for (size_t i = 0; i < len; i++)
+    {
+        monitor_putentryat(text[i], 0x70, x + i, 0);
+    }
+    if (fb_draws())
+    {
+        fb_console_flush();
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
 void monitor_clear()
 {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    select_thread_vt();
     uint8_t attributeByte = (0 << 4) | (15 & 0x0F);
     uint16_t blank = 0x20 | (attributeByte << 8);
-    for (int i = 0; i < 80*25; i++)
+    for (size_t i = 0; i < terminal_width * terminal_height; i++)
     {
         terminal_buffer[i] = blank;
     }
+    if (fb_draws())
+    {
+        fb_console_mark_all();
+    }
     terminal_row = 0;
     terminal_column = 0;
     move_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
 void monitor_write_hex(uint32_t n)
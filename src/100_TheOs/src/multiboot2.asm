@@ -9,15 +9,15 @@ header_start:
     dd header_end - header_start 	                                ; Header length
     dd 0x100000000 - (0xe85250d6 + 0 + (header_end - header_start)) ; Checksum
 
-;align 8
-;framebuffer_tag_start:
-;    dw 5                                              ; type
-;    dw 1                                              ; flags
-;    dd framebuffer_tag_end - framebuffer_tag_start    ; size
-;    dd 800                                            ; width
-;    dd 600                                            ; height
-;    dd 32                                             ; depth
-;framebuffer_tag_end:
+align 8
+framebuffer_tag_start:
+    dw 5                                              ; type
+    dw 1                                              ; flags (optional, text mode is the fallback)
+    dd framebuffer_tag_end - framebuffer_tag_start    ; size
+    dd 1024                                           ; width
+    dd 768                                            ; height
+    dd 32                                             ; depth
+framebuffer_tag_end:
 
 align 8
     ; Required end tag:
@@ -0,0 +1,47 @@
+// pci.c -- PCI configuration space access (mechanism #1).
+
+#include "pci.h"
+#include "common.h"
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    uint32_t address = (1u << 31)
+                     | ((uint32_t)bus << 16)
+                     | ((uint32_t)(slot & 0x1F) << 11)
+                     | ((uint32_t)(function & 0x07) << 8)
+                     | (offset & 0xFC);
+    outl(PCI_CONFIG_ADDRESS, address);
+    return inl(PCI_CONFIG_DATA);
+}
+
+bool pci_find_device(uint16_t vendor, uint16_t device, pci_device_t* out)
+{
+    for (int bus = 0; bus < 256; bus++) {
+        for (int slot = 0; slot < 32; slot++) {
+            for (int function = 0; function < 8; function++) {
+                uint32_t id = pci_config_read(bus, slot, function, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    // No function 0 means no device in this slot
+                    if (function == 0) break;
+                    continue;
+                }
+                if ((id & 0xFFFF) == vendor && (id >> 16) == device) {
+                    out->bus = bus;
+                    out->slot = slot;
+                    out->function = function;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+uint32_t pci_bar_address(const pci_device_t* dev, int bar)
+{
+    uint32_t value = pci_config_read(dev->bus, dev->slot, dev->function, PCI_BAR0 + bar * 4);
+    if (value & 0x1) {
+        return value & ~0x3u;   // I/O space BAR
+    }
+    return value & ~0xFu;       // Memory BAR
+}
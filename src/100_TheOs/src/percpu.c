@@ -0,0 +1,15 @@
+// percpu.c -- Per-processor data blocks, addressed through GS.
+
+#include "percpu.h"
+
+percpu_t percpu_areas[APIC_MAX_CPUS];
+bool percpu_ready = false;
+
+_Static_assert(PERCPU_OFFSET(tss) == 16, "syscall_asm.asm has this offset");
+
+void percpu_init(int cpu)
+{
+    percpu_t* p = &percpu_areas[cpu];
+    p->self = p;
+    p->index = cpu;
+}
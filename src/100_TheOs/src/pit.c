@@ -1,12 +1,23 @@
 #include "interrupts.h"
 #include "pit.h"
+#include "irq.h"
 #include "common.h"
 #include "libc/system.h"
 #include "monitor.h"
-static uint32_t ticks = 0;
+#include "log.h"
+#include "trace.h"
+#include "clock.h"
+#include "timer.h"
+#include "idle.h"
+#include "thread.h"
+#include "waitqueue.h"
+#include "serial.h"
+#include "libc/div64.h"
+static volatile uint32_t ticks = 0;
 
 // Test the PIT for 10 seconds
-// This test will check if the PIT is accurate within 1% of the expected time
+// This test will check if the PIT is accurate within 1% of the expected time,
+// with the TSC as the independent reference
 void test_pit_10seconds(void) {
     uint32_t start_ticks, end_ticks, elapsed_ticks;
    
@@ -16,7 +27,8 @@ void test_pit_10seconds(void) {
     asm volatile("sti");
    
     // Record starting ticks
-    start_ticks = ticks;
+    start_ticks = pit_get_ticks();
+    uint64_t start_tsc = rdtsc();
     printf("Start ticks: %d\n", start_ticks);
    
     // Sleep for 10 seconds (10000 ms)
@@ -24,7 +36,8 @@ void test_pit_10seconds(void) {
     sleep_interrupt(10000);
    
     // Record ending ticks
-    end_ticks = ticks;
+    end_ticks = pit_get_ticks();
+    uint64_t end_tsc = rdtsc();
    
     // Calculate elapsed ticks
     elapsed_ticks = end_ticks - start_ticks;
@@ -32,31 +45,24 @@ void test_pit_10seconds(void) {
     printf("End ticks: %d\n", end_ticks);
     printf("Elapsed ticks: %d\n", elapsed_ticks);
     printf("Expected ticks: 10000\n");
-   
-    // Calculate the actual accuracy
-    uint32_t percent;
-    uint32_t decimal;
-    
-    if (elapsed_ticks == 10000) {
-        percent = 100;
-        decimal = 0;
-    } else if (elapsed_ticks > 10000) {
-        uint32_t accuracy_x10000 = (10000 * 10000) / elapsed_ticks;
-        percent = accuracy_x10000 / 100;
-        decimal = accuracy_x10000 % 100;
-    } else {
-        uint32_t accuracy_x10000 = (elapsed_ticks * 10000) / 10000;
-        percent = accuracy_x10000 / 100;
-        decimal = accuracy_x10000 % 100;
-    }
-    if (decimal < 10) {
-        printf("PIT timing accuracy: %d.0%d%%\n", percent, decimal);
-    } else {
-        printf("PIT timing accuracy: %d.%d%%\n", percent, decimal);
+
+    // The tick count is what sleep_interrupt() waited on, so it always
+    // lands close to 10000. The TSC tells how long the sleep really took.
+    uint32_t elapsed_ms = elapsed_ticks / TICKS_PER_MS;
+    if (clock_tsc_khz() > 0) {
+        elapsed_ms = (uint32_t)div64_32(end_tsc - start_tsc, clock_tsc_khz(), NULL);
+        printf("Elapsed by TSC: %u ms\n", elapsed_ms);
     }
-    if (elapsed_ticks >= 9900 && elapsed_ticks <= 10100) {
+
+    // One millisecond in ten seconds is 0.01%
+    uint32_t deviation = elapsed_ms > 10000 ? elapsed_ms - 10000 : 10000 - elapsed_ms;
+    uint32_t error_x100 = deviation;
+    printf("Timing error: %s%u.%u%u%%\n", elapsed_ms < 10000 ? "-" : "+",
+           error_x100 / 100, error_x100 / 10 % 10, error_x100 % 10);
+
+    if (deviation <= 100) {
         printf("TEST PASSED! Timing is accurate within 1%%.\n");
-    } else if (elapsed_ticks >= 9500 && elapsed_ticks <= 10500) {
+    } else if (deviation <= 500) {
         printf("TEST FAILED! Timing is outside accurate range (>1%%).\n");
         printf("However, it's still within 5%% which may be acceptable.\n");
     } else {
@@ -65,12 +71,30 @@ void test_pit_10seconds(void) {
 }
 
 uint32_t get_uptime_seconds(void) {
-    // Convert ticks to seconds based on your PIT frequency
-    return ticks / TARGET_FREQUENCY;
+    return clock_now_ms() / 1000;
+}
+// Milliseconds since boot in ticks, TICKS_PER_MS ticks per millisecond.
+// Comes from the clock, the PIT stops ticking once it is tickless.
+uint32_t pit_get_ticks(void) {
+    return clock_now_ms() * TICKS_PER_MS;
+}
+
+// Periodic interrupts seen, only advances before clock_init()
+uint32_t pit_tick_count(void) {
+    return ticks;
 }
+
+// Channel 0 in mode 0: IRQ0 fires once, count PIT clocks from now
+void pit_set_oneshot(uint16_t count) {
+    outb(PIT_CMD_PORT, 0x30);  // channel 0, access mode low/high, mode 0, binary
+    outb(PIT_CHANNEL0_PORT, count & 0xFF);
+    outb(PIT_CHANNEL0_PORT, (count >> 8) & 0xFF);
+}
+
 // The PIT IRQ handler
 void pit_irq_handler(registers_t* regs, void* context) {
     ticks++;
+    clock_event(regs);
 }
 
 void init_pit() {
@@ -85,45 +109,180 @@ void init_pit() {
     outb(PIT_CHANNEL0_PORT, divisor & 0xFF);        // Low byte
     outb(PIT_CHANNEL0_PORT, (divisor >> 8) & 0xFF); // High byte
     
-    // Unmask IRQ0 (timer) in PIC
-    outb(0x21, inb(0x21) & ~(1 << 0));  // Clear bit 0 in master PIC mask
+    // Unmask IRQ0 (timer)
+    irq_unmask(0);
     
-    printf("PIT initialized with frequency %d Hz\n", TARGET_FREQUENCY);
+    LOG_INFO("pit", "PIT initialized with frequency %d Hz\n", TARGET_FREQUENCY);
+}
+
+static void sleep_expired(void* arg) {
+    complete((completion_t*)arg);
 }
 
 void sleep_interrupt(uint32_t milliseconds) {
-    uint32_t start_tick = ticks;
+    // A thread blocks until a timer completes the wait, the CPU runs
+    // other threads or idles meanwhile
+    if (thread_current() != NULL) {
+        completion_t done;
+        completion_init(&done, NULL);
+        if (timer_add(pit_get_ticks() / TICKS_PER_MS + milliseconds, sleep_expired, &done) != 0) {
+            wait_for_completion(&done);
+            return;
+        }
+    }
+
+    // Before the scheduler runs, or with every timer taken: poll
+    uint32_t start_tick = pit_get_ticks();
     uint32_t ticks_to_wait = milliseconds * TICKS_PER_MS;
     uint32_t end_ticks = start_tick + ticks_to_wait;
     
-    printf("Sleep start: %d, wait for: %d, end at: %d\n", 
-           start_tick, ticks_to_wait, end_ticks);
+    LOG_TRACE("pit", "Sleep start: %d, wait for: %d, end at: %d\n",
+              start_tick, ticks_to_wait, end_ticks);
     
     // Debug counter
     uint32_t debug_counter = 0;
     
-    while (ticks < end_ticks) {
-        // Debug output every ~10000 iterations
+    while ((int32_t)(pit_get_ticks() - end_ticks) < 0) {
+        // Trace output every ~10000 iterations
         if (debug_counter % 10000 == 0) {
-            printf("Current ticks: %d\n", ticks);
+            LOG_TRACE("pit", "Current ticks: %d\n", pit_get_ticks());
         }
         debug_counter++;
         
-        // Enable interrupts and halt
-        asm volatile("sti");
-        asm volatile("hlt");
+        // Ask for a timer event at the end (tickless), then idle.
+        // cpu_idle() enables interrupts only as it halts, so the event
+        // cannot be missed in between.
+        asm volatile("cli");
+        clock_arm(end_ticks / TICKS_PER_MS);
+        cpu_idle();
+
+        // Whatever woke us may have given another thread work
+        if (sched_others_ready()) {
+            thread_yield();
+        }
     }
     
-    printf("Sleep complete, final ticks: %d\n", ticks);
+    LOG_TRACE("pit", "Sleep complete, final ticks: %d\n", pit_get_ticks());
 }
 
 void sleep_busy(uint32_t milliseconds){
-    uint32_t start_tick = ticks;
-    uint32_t ticks_to_wait = milliseconds * TICKS_PER_MS;
-    uint32_t elapsed_ticks = 0;
-    
-    while (elapsed_ticks < ticks_to_wait) {
-        while (ticks == start_tick + elapsed_ticks) {};
-        elapsed_ticks++;
-    }    
-}
\ No newline at end of file
+    // Calibrated spin, works with interrupts off too
+    while (milliseconds--) {
+        udelay(1000);
+    }
+}
+// timerbench: tick interval jitter, sleep_interrupt() latency and wakeup
+// overshoot, all timed with the TSC. Results also go to serial as
+// "timerbench <test> key=value ..." lines for regression scripts.
+#define BENCH_TICKS         1000
+#define BENCH_SLEEPS        200
+#define BENCH_SAMPLES_MAX   BENCH_TICKS
+
+static uint32_t bench_samples[BENCH_SAMPLES_MAX];
+static volatile uint32_t bench_count = 0;
+static uint64_t bench_last_tsc = 0;
+
+typedef struct {
+    uint32_t min, mean, p99, max;
+} bench_stats_t;
+
+static uint32_t cycles_to_ns(uint64_t cycles) {
+    return (uint32_t)div64_32(cycles * 1000000, clock_tsc_khz(), NULL);
+}
+
+// Sorts the samples
+static void bench_stats(uint32_t* samples, uint32_t count, bench_stats_t* stats) {
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t value = samples[i];
+        uint32_t j = i;
+        for (; j > 0 && samples[j - 1] > value; j--) {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = value;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    stats->min = samples[0];
+    stats->max = samples[count - 1];
+    stats->mean = (uint32_t)div64_32(total, count, NULL);
+    stats->p99 = samples[count * 99 / 100];
+}
+
+static void bench_report(const char* test, const char* unit, uint32_t count, bench_stats_t* stats) {
+    printf("  min %u, mean %u, p99 %u, max %u %s\n", stats->min, stats->mean, stats->p99, stats->max, unit);
+    serial_printf("timerbench %s unit=%s n=%u min=%u mean=%u p99=%u max=%u\n",
+                  test, unit, count, stats->min, stats->mean, stats->p99, stats->max);
+}
+
+// Periodic 1 ms timer, records the interval since the previous call
+static void bench_tick(void* arg) {
+    uint64_t now = rdtsc();
+    if (bench_last_tsc != 0 && bench_count < BENCH_TICKS) {
+        bench_samples[bench_count++] = cycles_to_ns(now - bench_last_tsc);
+    }
+    bench_last_tsc = now;
+}
+
+void timer_benchmark(void) {
+    if (clock_tsc_khz() == 0) {
+        printf("timerbench: needs a calibrated TSC\n");
+        return;
+    }
+    asm volatile("sti");
+    bench_stats_t stats;
+
+    // Interval between 1 ms timer callbacks, ideally 1000000 ns each
+    printf("Timer tick interval, %d ticks of 1 ms:\n", BENCH_TICKS);
+    bench_count = 0;
+    bench_last_tsc = 0;
+    timer_id_t id = timer_add_periodic(clock_now_ms() + 1, 1, bench_tick, NULL);
+    if (id == 0) {
+        printf("timerbench: no free timer\n");
+        return;
+    }
+    while (bench_count < BENCH_TICKS) {
+        asm volatile("hlt");
+    }
+    timer_cancel(id);
+
+    bench_stats(bench_samples, BENCH_TICKS, &stats);
+    bench_report("tick_interval", "ns", BENCH_TICKS, &stats);
+    uint32_t jitter = stats.max - stats.min;
+    printf("  jitter (max - min) %u ns\n", jitter);
+    serial_printf("timerbench tick_jitter unit=ns value=%u\n", jitter);
+
+    // sleep_interrupt(1) from wherever in the millisecond the call lands
+    printf("sleep_interrupt(1) duration, %d calls:\n", BENCH_SLEEPS);
+    for (uint32_t i = 0; i < BENCH_SLEEPS; i++) {
+        uint64_t start = rdtsc();
+        sleep_interrupt(1);
+        bench_samples[i] = cycles_to_ns(rdtsc() - start) / 1000;
+    }
+    bench_stats(bench_samples, BENCH_SLEEPS, &stats);
+    bench_report("sleep_1ms", "us", BENCH_SLEEPS, &stats);
+
+    // Wakeup overshoot: how much longer than asked a sleep takes. Starts
+    // on a millisecond edge, so the millisecond rounding does not count.
+    static const uint32_t durations[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+    printf("Wakeup overshoot (us):\n");
+    for (uint32_t d = 0; d < sizeof(durations) / sizeof(durations[0]); d++) {
+        uint32_t ms = durations[d];
+        uint32_t rounds = ms <= 100 ? 5 : 1;
+        int32_t worst = 0;
+        int32_t total = 0;
+        for (uint32_t r = 0; r < rounds; r++) {
+            sleep_interrupt(1);
+            uint64_t start = rdtsc();
+            sleep_interrupt(ms);
+            int32_t overshoot = (int32_t)(cycles_to_ns(rdtsc() - start) / 1000) - (int32_t)(ms * 1000);
+            if (r == 0 || overshoot > worst) worst = overshoot;
+            total += overshoot;
+        }
+        int32_t mean = total / (int32_t)rounds;
+        printf("  %u ms: mean %d, max %d\n", ms, mean, worst);
+        serial_printf("timerbench overshoot unit=us ms=%u n=%u mean=%d max=%d\n", ms, rounds, mean, worst);
+    }
+}
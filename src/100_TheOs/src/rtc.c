@@ -0,0 +1,347 @@
+// rtc.c -- CMOS real time clock.
+//
+// The RTC is read once at boot to give the wall clock its starting point;
+// from then on wall time is that point plus ktime_get_ns(), which is far
+// finer than the RTC's one second. settime() moves the starting point. It
+// is kept under a sequence counter: readers retry if a writer got in
+// between, so ktime_get_real_ns() never blocks and never takes locks.
+
+#include "rtc.h"
+#include "clock.h"
+#include "hpet.h"
+#include "acpi.h"
+#include "irq.h"
+#include "common.h"
+#include "libc/div64.h"
+#include "log.h"
+
+extern void terminal_printf(const char* format, ...);
+
+#define CMOS_INDEX 0x70
+#define CMOS_DATA  0x71
+
+#define RTC_SECONDS  0x00
+#define RTC_MINUTES  0x02
+#define RTC_HOURS    0x04
+#define RTC_DAY      0x07
+#define RTC_MONTH    0x08
+#define RTC_YEAR     0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+#define RTC_STATUS_C 0x0C
+
+#define RTC_A_UPDATING  0x80  // Update in progress, the time registers are changing
+#define RTC_B_SET       0x80  // Updates stopped while the time is written
+#define RTC_B_PERIODIC  0x40
+#define RTC_B_BINARY    0x04
+#define RTC_B_24HOUR    0x02
+#define RTC_HOUR_PM     0x80
+
+// Periodic rate: 32768 >> (rate - 1) Hz, rate 15 is 2 Hz
+#define RTC_RATE 15
+
+// Offset of the century register in the ACPI FADT, 0 if there is none
+#define FADT_CENTURY 108
+
+static uint8_t rtc_century_reg = 0;
+static uint8_t rtc_status_b = 0;
+
+// Wall clock: real_ns at the ktime_get_ns() value mono_ns
+static volatile uint32_t wall_seq = 0;
+static uint64_t wall_real_ns = 0;
+static uint64_t wall_mono_ns = 0;
+
+// Periodic interrupt, counted against the clocksource
+static bool rtc_periodic = false;
+static volatile uint32_t rtc_irqs = 0;
+static uint64_t rtc_periodic_start = 0;
+
+static uint8_t cmos_read(uint8_t reg)
+{
+    outb(CMOS_INDEX, reg);
+    return inb(CMOS_DATA);
+}
+
+static void cmos_write(uint8_t reg, uint8_t value)
+{
+    outb(CMOS_INDEX, reg);
+    outb(CMOS_DATA, value);
+}
+
+static uint8_t bcd_to_bin(uint8_t value)
+{
+    return (value & 0x0F) + (value >> 4) * 10;
+}
+
+static uint8_t bin_to_bcd(uint8_t value)
+{
+    return ((value / 10) << 4) | (value % 10);
+}
+
+static void rtc_read_raw(uint8_t regs[7])
+{
+    // Start right after an update, then it has almost a second to spare
+    while (cmos_read(RTC_STATUS_A) & RTC_A_UPDATING) {
+    }
+    regs[0] = cmos_read(RTC_SECONDS);
+    regs[1] = cmos_read(RTC_MINUTES);
+    regs[2] = cmos_read(RTC_HOURS);
+    regs[3] = cmos_read(RTC_DAY);
+    regs[4] = cmos_read(RTC_MONTH);
+    regs[5] = cmos_read(RTC_YEAR);
+    regs[6] = rtc_century_reg ? cmos_read(rtc_century_reg) : 0;
+}
+
+static void rtc_read(rtc_time_t* time)
+{
+    // An update can still start between the check and the reads, so
+    // read until two passes agree
+    uint8_t regs[7], again[7];
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    rtc_read_raw(regs);
+    while (1) {
+        rtc_read_raw(again);
+        bool same = true;
+        for (int i = 0; i < 7; i++) {
+            if (regs[i] != again[i]) same = false;
+        }
+        if (same) break;
+        for (int i = 0; i < 7; i++) {
+            regs[i] = again[i];
+        }
+    }
+    rtc_status_b = cmos_read(RTC_STATUS_B);
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+
+    bool pm = (regs[2] & RTC_HOUR_PM) != 0;
+    regs[2] &= ~RTC_HOUR_PM;
+    if (!(rtc_status_b & RTC_B_BINARY)) {
+        for (int i = 0; i < 7; i++) {
+            regs[i] = bcd_to_bin(regs[i]);
+        }
+    }
+    if (!(rtc_status_b & RTC_B_24HOUR)) {
+        // 12 is midnight in the AM and noon in the PM
+        regs[2] = (regs[2] % 12) + (pm ? 12 : 0);
+    }
+
+    time->second = regs[0];
+    time->minute = regs[1];
+    time->hour = regs[2];
+    time->day = regs[3];
+    time->month = regs[4];
+    time->year = regs[6] ? regs[6] * 100 + regs[5] : 2000 + regs[5];
+}
+
+static void rtc_write(const rtc_time_t* time)
+{
+    uint8_t regs[7] = {
+        time->second, time->minute, time->hour, time->day, time->month,
+        time->year % 100, time->year / 100,
+    };
+    if (!(rtc_status_b & RTC_B_24HOUR)) {
+        uint8_t hour = regs[2] % 12;
+        regs[2] = hour ? hour : 12;
+    }
+    if (!(rtc_status_b & RTC_B_BINARY)) {
+        for (int i = 0; i < 7; i++) {
+            regs[i] = bin_to_bcd(regs[i]);
+        }
+    }
+    if (!(rtc_status_b & RTC_B_24HOUR) && time->hour >= 12) {
+        regs[2] |= RTC_HOUR_PM;
+    }
+
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    cmos_write(RTC_STATUS_B, status_b | RTC_B_SET);
+    cmos_write(RTC_SECONDS, regs[0]);
+    cmos_write(RTC_MINUTES, regs[1]);
+    cmos_write(RTC_HOURS, regs[2]);
+    cmos_write(RTC_DAY, regs[3]);
+    cmos_write(RTC_MONTH, regs[4]);
+    cmos_write(RTC_YEAR, regs[5]);
+    if (rtc_century_reg) {
+        cmos_write(rtc_century_reg, regs[6]);
+    }
+    cmos_write(RTC_STATUS_B, status_b & ~RTC_B_SET);
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date, with years
+// starting in March so the leap day comes last
+uint32_t rtc_to_unix(const rtc_time_t* time)
+{
+    uint32_t year = time->year - (time->month <= 2);
+    uint32_t era = year / 400;
+    uint32_t year_of_era = year - era * 400;
+    uint32_t month = time->month > 2 ? time->month - 3 : time->month + 9;
+    uint32_t day_of_year = (153 * month + 2) / 5 + time->day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    uint32_t days = era * 146097 + day_of_era - 719468;
+    return days * 86400 + time->hour * 3600 + time->minute * 60 + time->second;
+}
+
+void rtc_from_unix(uint32_t unix_seconds, rtc_time_t* time)
+{
+    uint32_t days = unix_seconds / 86400;
+    uint32_t rest = unix_seconds % 86400;
+    time->hour = rest / 3600;
+    time->minute = rest / 60 % 60;
+    time->second = rest % 60;
+
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t day_of_era = z - era * 146097;
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t month = (5 * day_of_year + 2) / 153;
+    time->day = day_of_year - (153 * month + 2) / 5 + 1;
+    time->month = month < 10 ? month + 3 : month - 9;
+    time->year = year_of_era + era * 400 + (time->month <= 2);
+}
+
+uint64_t ktime_get_real_ns(void)
+{
+    uint32_t seq;
+    uint64_t real, mono;
+    do {
+        seq = wall_seq;
+        asm volatile("" : : : "memory");
+        real = wall_real_ns;
+        mono = wall_mono_ns;
+        asm volatile("" : : : "memory");
+    } while ((seq & 1) || seq != wall_seq);
+
+    return real + (ktime_get_ns() - mono);
+}
+
+static void wall_set(uint32_t unix_seconds)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    wall_seq++;
+    asm volatile("" : : : "memory");
+    wall_real_ns = (uint64_t)unix_seconds * 1000000000;
+    wall_mono_ns = ktime_get_ns();
+    asm volatile("" : : : "memory");
+    wall_seq++;
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void settime(uint32_t unix_seconds)
+{
+    rtc_time_t time;
+    rtc_from_unix(unix_seconds, &time);
+    wall_set(unix_seconds);
+    rtc_write(&time);
+    LOG_INFO("rtc", "Time set to %d-%d-%d %d:%d:%d UTC\n",
+             time.year, time.month, time.day, time.hour, time.minute, time.second);
+}
+
+static const char* rtc_number(const char* p, char end, uint32_t* value)
+{
+    if (*p < '0' || *p > '9') return NULL;
+    *value = 0;
+    while (*p >= '0' && *p <= '9') {
+        *value = *value * 10 + (*p++ - '0');
+    }
+    if (*p != end) return NULL;
+    return end ? p + 1 : p;
+}
+
+bool rtc_parse(const char* text, rtc_time_t* time)
+{
+    uint32_t year, month, day, hour, minute, second;
+    const char* p = text;
+    if (!(p = rtc_number(p, '-', &year)) || !(p = rtc_number(p, '-', &month)) ||
+        !(p = rtc_number(p, ' ', &day)) || !(p = rtc_number(p, ':', &hour)) ||
+        !(p = rtc_number(p, ':', &minute)) || !(p = rtc_number(p, '\0', &second))) {
+        return false;
+    }
+    if (year < 1970 || year > 2105 || month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+    time->year = year;
+    time->month = month;
+    time->day = day;
+    time->hour = hour;
+    time->minute = minute;
+    time->second = second;
+    return true;
+}
+
+void rtc_init(void)
+{
+    const uint8_t* fadt = (const uint8_t*)acpi_find_table("FACP");
+    if (fadt != NULL && ((const acpi_sdt_header_t*)fadt)->length > FADT_CENTURY) {
+        rtc_century_reg = fadt[FADT_CENTURY];
+    }
+
+    rtc_time_t time;
+    rtc_read(&time);
+    wall_set(rtc_to_unix(&time));
+
+    LOG_INFO("rtc", "%d-%d-%d %d:%d:%d UTC at uptime %u ms\n", time.year, time.month, time.day,
+             time.hour, time.minute, time.second, clock_now_ms());
+}
+
+static void rtc_irq_handler(registers_t* regs, void* context)
+{
+    // Nothing more is raised until register C has been read
+    cmos_read(RTC_STATUS_C);
+    rtc_irqs++;
+}
+
+bool rtc_enable_periodic(bool enable)
+{
+    if (enable && hpet_legacy_enabled()) {
+        return false;
+    }
+
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    if (enable) {
+        register_irq_handler(8, rtc_irq_handler, NULL);
+        cmos_write(RTC_STATUS_A, (cmos_read(RTC_STATUS_A) & 0xF0) | RTC_RATE);
+        cmos_write(RTC_STATUS_B, cmos_read(RTC_STATUS_B) | RTC_B_PERIODIC);
+        cmos_read(RTC_STATUS_C);
+        rtc_irqs = 0;
+        rtc_periodic_start = ktime_get_ns();
+        irq_unmask(8);
+    } else {
+        irq_mask(8);
+        cmos_write(RTC_STATUS_B, cmos_read(RTC_STATUS_B) & ~RTC_B_PERIODIC);
+        cmos_read(RTC_STATUS_C);
+    }
+    rtc_periodic = enable;
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+    return true;
+}
+
+void rtc_print_date(void)
+{
+    uint64_t real = ktime_get_real_ns();
+    uint32_t rest;
+    uint32_t seconds = (uint32_t)div64_32(real, 1000000000, &rest);
+    rtc_time_t time;
+    rtc_from_unix(seconds, &time);
+
+    terminal_printf("%d-%s%d-%s%d %s%d:%s%d:%s%d.%s%s%d UTC (%u)\n", time.year,
+                    time.month < 10 ? "0" : "", time.month, time.day < 10 ? "0" : "", time.day,
+                    time.hour < 10 ? "0" : "", time.hour, time.minute < 10 ? "0" : "", time.minute,
+                    time.second < 10 ? "0" : "", time.second, rest < 100000000 ? "0" : "",
+                    rest < 10000000 ? "0" : "", rest / 1000000, seconds);
+
+    if (rtc_periodic) {
+        // Elapsed by RTC interrupts against elapsed by the clocksource
+        uint32_t rtc_ms = rtc_irqs * (1000 / RTC_PERIODIC_HZ);
+        uint64_t clock_ns = ktime_get_ns() - rtc_periodic_start;
+        uint32_t clock_ms = (uint32_t)div64_32(clock_ns, 1000000, NULL);
+        terminal_printf("RTC periodic: %u interrupts at %d Hz, %u ms by RTC, %u ms by clock\n",
+                        rtc_irqs, RTC_PERIODIC_HZ, rtc_ms, clock_ms);
+    }
+}
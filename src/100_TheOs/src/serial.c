@@ -0,0 +1,70 @@
+// serial.c -- Polled 16550 UART driver for COM1.
+
+#include "serial.h"
+#include "common.h"
+#include "libc/string.h"
+#include "libc/stdarg.h"
+
+extern int vsnprintf(char* str, size_t size, const char* format, va_list args);
+
+#define SERIAL_DATA        (SERIAL_COM1 + 0)
+#define SERIAL_INT_ENABLE  (SERIAL_COM1 + 1)
+#define SERIAL_FIFO_CTRL   (SERIAL_COM1 + 2)
+#define SERIAL_LINE_CTRL   (SERIAL_COM1 + 3)
+#define SERIAL_MODEM_CTRL  (SERIAL_COM1 + 4)
+#define SERIAL_LINE_STATUS (SERIAL_COM1 + 5)
+
+#define LINE_STATUS_THR_EMPTY 0x20
+
+static bool serial_ok = false;
+
+bool serial_init(void) {
+    outb(SERIAL_INT_ENABLE, 0x00);  // No UART interrupts, we poll
+    outb(SERIAL_LINE_CTRL, 0x80);   // DLAB on to set the divisor
+    outb(SERIAL_DATA, 0x01);        // Divisor 1 = 115200 baud
+    outb(SERIAL_INT_ENABLE, 0x00);
+    outb(SERIAL_LINE_CTRL, 0x03);   // 8 bits, no parity, one stop bit
+    outb(SERIAL_FIFO_CTRL, 0xC7);   // Enable and clear FIFOs, 14-byte threshold
+
+    // Loopback test: a missing UART reads back 0xFF
+    outb(SERIAL_MODEM_CTRL, 0x1E);
+    outb(SERIAL_DATA, 0xAE);
+    if (inb(SERIAL_DATA) != 0xAE) {
+        serial_ok = false;
+        return false;
+    }
+
+    outb(SERIAL_MODEM_CTRL, 0x0F);  // Normal operation, OUT1/OUT2, RTS/DTR
+    serial_ok = true;
+    return true;
+}
+
+bool serial_present(void) {
+    return serial_ok;
+}
+
+void serial_putc(char c) {
+    if (!serial_ok) return;
+    while ((inb(SERIAL_LINE_STATUS) & LINE_STATUS_THR_EMPTY) == 0) {}
+    outb(SERIAL_DATA, (uint8_t)c);
+}
+
+void serial_write(const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    for (size_t i = 0; i < size; i++) {
+        serial_putc(bytes[i]);
+    }
+}
+
+void serial_writestring(const char* str) {
+    serial_write(str, strlen(str));
+}
+
+void serial_printf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    serial_writestring(buffer);
+}
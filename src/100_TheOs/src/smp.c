@@ -0,0 +1,238 @@
+// smp.c -- Starting the application processors.
+//
+// The MADT lists every processor; the one that booted is CPU 0 and the
+// others wait for an INIT and a STARTUP IPI. STARTUP starts them in real
+// mode at a page below 1 MB, so smp_trampoline.asm is copied there first.
+// It gets each processor into protected mode with paging on and calls
+// smp_ap_main() on a stack of its own, which loads the processor's GDT,
+// TSS and IDT, enables its local APIC, programs its SYSENTER MSRs and
+// makes the boot flow its idle thread. Processors are started one at a time, the trampoline only has
+// room for one set of parameters.
+//
+// An idle processor halts with its timer off. thread_create() kicks one
+// awake with an IPI and it steals the new thread from the creating CPU's
+// run queue. While it runs threads, a periodic local APIC tick ends time
+// slices; timers and the clock stay on CPU 0. A thread woken by another
+// CPU, and a timer added by one, come with a reschedule IPI.
+
+#include "smp.h"
+#include "apic.h"
+#include "percpu.h"
+#include "clock.h"
+#include "gdt.h"
+#include "fpu.h"
+#include "idle.h"
+#include "thread.h"
+#include "timer.h"
+#include "syscall.h"
+#include "interrupts.h"
+#include "memory/memory.h"
+#include "log.h"
+
+extern void terminal_printf(const char* format, ...);
+
+// Interrupt command register, low word
+#define ICR_INIT           0x00004500   // INIT, level assert
+#define ICR_STARTUP        0x00004600   // STARTUP, vector is the page number
+#define ICR_FIXED          0x00004000   // Fixed delivery, level assert
+#define ICR_PENDING        (1 << 12)    // Delivery status: not accepted yet
+
+#define LAPIC_LVT_PERIODIC (1 << 17)
+
+// Startup waits, from the MultiProcessor Specification
+#define SMP_INIT_DELAY_US    10000
+#define SMP_STARTUP_DELAY_US 200
+#define SMP_ONLINE_WAIT_MS   100
+
+// smp_trampoline.asm, its parameters are filled in at the copy
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_cr3[];
+extern uint8_t smp_trampoline_stack[];
+extern uint8_t smp_trampoline_entry[];
+extern uint8_t smp_trampoline_cpu[];
+
+#define TRAMPOLINE_WORD(label) \
+    (*(volatile uint32_t*)(SMP_TRAMPOLINE_BASE + ((label) - smp_trampoline_start)))
+
+volatile int smp_cpus_online = 1;
+volatile bool smp_active = false;
+
+static uint32_t smp_kicks = 0;
+
+static void smp_send_ipi(uint8_t apic_id, uint32_t icr)
+{
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        asm volatile("pause");
+    }
+}
+
+void smp_kick_idle(void)
+{
+    if (smp_cpus_online < 2) {
+        return;
+    }
+
+    // idle_waiting is set by the processor's idle loop before it halts
+    // and cleared by whoever sends it the IPI
+    int self = this_cpu_index();
+    for (int cpu = 1; cpu < smp_cpus_online; cpu++) {
+        if (cpu != self && __sync_lock_test_and_set(&per_cpu(cpu)->idle_waiting, false)) {
+            smp_kicks++;
+            smp_send_ipi(per_cpu(cpu)->apic_id, ICR_FIXED | SMP_RESCHED_VECTOR);
+            return;
+        }
+    }
+}
+
+void smp_send_resched(int cpu)
+{
+    // It need not be kicked for thread_create() any more
+    __sync_lock_test_and_set(&per_cpu(cpu)->idle_waiting, false);
+    smp_send_ipi(per_cpu(cpu)->apic_id, ICR_FIXED | SMP_RESCHED_VECTOR);
+}
+
+// Ending the halt is most of what the IPI is for; the idle loop looks for
+// work. CPU 0 also arms the clock for timers added elsewhere.
+static void smp_resched_handler(registers_t* regs, void* context)
+{
+    apic_eoi();
+    if (this_cpu_index() == 0) {
+        timer_rearm();
+    }
+    sched_remote_wake();
+}
+
+static void smp_tick_handler(registers_t* regs, void* context)
+{
+    apic_eoi();
+    sched_clock(clock_now_ms());
+}
+
+// Run the scheduler tick only while there is something to schedule
+static void smp_tick(bool run)
+{
+    if (this_cpu_read(tick_running) == run) {
+        return;
+    }
+    this_cpu_write(tick_running, run);
+    if (run) {
+        lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_PERIODIC | SMP_TICK_VECTOR);
+        lapic_write(LAPIC_TIMER_INIT, clock_lapic_per_ms());
+    } else {
+        lapic_write(LAPIC_TIMER_INIT, 0);
+    }
+}
+
+static void smp_idle_loop(void)
+{
+    while (1) {
+        // Announce the halt before the last look at the run queues, so a
+        // thread_create() in between sends the IPI that ends it
+        asm volatile("cli");
+        this_cpu_write(idle_waiting, true);
+        if (sched_others_ready()) {
+            this_cpu_write(idle_waiting, false);
+            smp_tick(true);
+            thread_yield();
+        } else {
+            smp_tick(false);
+            cpu_idle();
+        }
+    }
+}
+
+// First C code on an application processor, interrupts off, paging on,
+// running on the trampoline's flat GDT
+void smp_ap_main(int cpu)
+{
+    gdt_init_ap(cpu);
+    idt_load();
+    apic_init_ap();
+    syscall_init_cpu();
+    sched_init_ap(cpu);
+    fpu_init_ap(thread_current()->fpu);
+
+    // Processors start one at a time, nobody else writes this now
+    smp_cpus_online++;
+    smp_idle_loop();
+}
+
+static bool smp_start_cpu(uint8_t apic_id, int cpu)
+{
+    int before = smp_cpus_online;
+
+    uint8_t* stack = malloc(SMP_STACK_SIZE);
+    if (stack == NULL) {
+        return false;
+    }
+    TRAMPOLINE_WORD(smp_trampoline_stack) = (uint32_t)(stack + SMP_STACK_SIZE);
+    TRAMPOLINE_WORD(smp_trampoline_cpu) = cpu;
+    per_cpu(cpu)->apic_id = apic_id;
+
+    smp_send_ipi(apic_id, ICR_INIT);
+    udelay(SMP_INIT_DELAY_US);
+
+    // A second STARTUP only if the first went unnoticed
+    for (int attempt = 0; attempt < 2 && smp_cpus_online == before; attempt++) {
+        smp_send_ipi(apic_id, ICR_STARTUP | (SMP_TRAMPOLINE_BASE >> 12));
+        udelay(SMP_STARTUP_DELAY_US);
+    }
+
+    for (int ms = 0; ms < SMP_ONLINE_WAIT_MS && smp_cpus_online == before; ms++) {
+        udelay(1000);
+    }
+    return smp_cpus_online != before;
+}
+
+void smp_init(void)
+{
+    if (!apic_enabled || apic_cpu_count < 2 || clock_lapic_per_ms() == 0) {
+        LOG_INFO("smp", "Single processor\n");
+        return;
+    }
+
+    memcpy((void*)SMP_TRAMPOLINE_BASE, smp_trampoline_start,
+           smp_trampoline_end - smp_trampoline_start);
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r" (cr3));
+    TRAMPOLINE_WORD(smp_trampoline_cr3) = cr3;
+    TRAMPOLINE_WORD(smp_trampoline_entry) = (uint32_t)smp_ap_main;
+
+    load_interrupt_controller(SMP_TICK_VECTOR, smp_tick_handler, NULL);
+    load_interrupt_controller(SMP_RESCHED_VECTOR, smp_resched_handler, NULL);
+
+    uint8_t bsp_id = lapic_id();
+    this_cpu_write(apic_id, bsp_id);
+
+    // From here on threads may move to another processor
+    smp_active = true;
+    fpu_flush();
+
+    int cpu = 1;
+    for (int i = 0; i < apic_cpu_count && cpu < APIC_MAX_CPUS; i++) {
+        if (apic_cpu_ids[i] == bsp_id) continue;
+        if (smp_start_cpu(apic_cpu_ids[i], cpu)) {
+            cpu++;
+        } else {
+            LOG_WARN("smp", "CPU with APIC ID %d did not start\n", apic_cpu_ids[i]);
+        }
+    }
+
+    LOG_INFO("smp", "%d of %d processors online\n", smp_cpus_online, apic_cpu_count);
+}
+
+void smp_print_info(void)
+{
+    terminal_printf("Processors online: %d\n", smp_cpus_online);
+    if (smp_cpus_online < 2) return;
+    for (int cpu = 0; cpu < smp_cpus_online; cpu++) {
+        const percpu_t* p = per_cpu(cpu);
+        terminal_printf("  CPU %d: APIC ID %d, %s\n", cpu, p->apic_id,
+                        cpu == 0 ? "boot CPU" : p->idle_waiting ? "idle" : "busy");
+    }
+    terminal_printf("  Wakeup IPIs: %u\n", smp_kicks);
+}
@@ -0,0 +1,75 @@
+;
+; smp_trampoline.asm -- Where application processors start.
+;
+; A STARTUP IPI starts a CPU in real mode at vector * 4 KB. smp.c copies
+; this code to SMP_TRAMPOLINE_BASE below 1 MB, fills in the data words at
+; the end and sends the IPIs. The code only uses addresses relative to
+; that copy: it loads a flat GDT, enters protected mode, turns on paging
+; with the kernel's page directory and calls smp_ap_main(cpu) on the stack
+; it was given. smp_ap_main() then loads the CPU's real GDT.
+
+%define SMP_TRAMPOLINE_BASE 0x8000     ; Must match smp.h
+%define REL(x) (SMP_TRAMPOLINE_BASE + (x) - smp_trampoline_start)
+
+section .text
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_cr3
+global smp_trampoline_stack
+global smp_trampoline_entry
+global smp_trampoline_cpu
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [REL(tramp_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                ; PE
+    mov cr0, eax
+    jmp dword 0x08:REL(tramp_protected)
+
+bits 32
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov eax, [REL(smp_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000       ; PG
+    mov cr0, eax
+
+    mov esp, [REL(smp_trampoline_stack)]
+    push dword [REL(smp_trampoline_cpu)]
+    mov eax, [REL(smp_trampoline_entry)]
+    call eax                 ; Never returns
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Flat code and data at the selectors the kernel GDT uses
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+tramp_gdt_ptr:
+    dw 3 * 8 - 1
+    dd REL(tramp_gdt)
+
+; Filled in by smp.c before each CPU is started
+align 4
+smp_trampoline_cr3:   dd 0
+smp_trampoline_stack: dd 0
+smp_trampoline_entry: dd 0
+smp_trampoline_cpu:   dd 0
+smp_trampoline_end:
@@ -0,0 +1,148 @@
+// spinlock.c -- Lock slow paths and lock statistics.
+//
+// The uncontended paths are inline in spinlock.h. A CPU only gets here
+// when it has to wait, which is also the only time there is anything
+// worth measuring: how often each lock made someone wait, and for how
+// many cycles.
+
+#include "spinlock.h"
+#include "common.h"
+#include "libc/div64.h"
+#include "libc/stddef.h"
+
+extern void terminal_printf(const char* format, ...);
+
+// Every lock that has been taken at least once, newest first
+static lock_stats_t* volatile lock_list = NULL;
+
+#if LOCK_STATS
+static void lock_stats_init(lock_stats_t* stats, const char* name)
+{
+    stats->name = name;
+    stats->acquired = 0;
+    stats->contended = 0;
+    stats->spin_cycles = 0;
+    stats->next = NULL;
+    stats->registered = 0;
+}
+#endif
+
+void spin_lock_init(spinlock_t* lock, const char* name)
+{
+    lock->tickets = 0;
+#if LOCK_STATS
+    lock_stats_init(&lock->stats, name);
+#else
+    (void)name;
+#endif
+}
+
+void rwlock_init(rwlock_t* lock, const char* name)
+{
+    lock->state = 0;
+#if LOCK_STATS
+    lock_stats_init(&lock->stats, name);
+#else
+    (void)name;
+#endif
+}
+
+void spin_lock_wait(spinlock_t* lock, uint32_t ticket)
+{
+#if LOCK_STATS
+    atomic_inc(&lock->stats.contended);
+    uint64_t start = rdtsc();
+#endif
+    while ((atomic_load_explicit(&lock->tickets, memory_order_acquire) & 0xFFFF) != ticket) {
+        cpu_relax();
+    }
+#if LOCK_STATS
+    // Ours now, so the counter needs no atomics
+    lock->stats.spin_cycles += rdtsc() - start;
+#endif
+}
+
+void read_lock_wait(rwlock_t* lock)
+{
+#if LOCK_STATS
+    atomic_inc(&lock->stats.contended);
+#endif
+    for (;;) {
+        uint32_t old = lock->state;
+        if (!(old & (RWLOCK_WRITER | RWLOCK_WAITING)) &&
+            atomic_compare_exchange_weak(&lock->state, &old, old + 1)) {
+            return;
+        }
+        cpu_relax();
+    }
+}
+
+void write_lock_wait(rwlock_t* lock)
+{
+#if LOCK_STATS
+    atomic_inc(&lock->stats.contended);
+    uint64_t start = rdtsc();
+#endif
+    for (;;) {
+        uint32_t old = lock->state;
+        if ((old & ~RWLOCK_WAITING) == 0) {
+            // Free: take it, and clear WAITING. Any other waiting writer
+            // sets it again on its next pass.
+            if (atomic_compare_exchange_weak(&lock->state, &old, RWLOCK_WRITER)) {
+                break;
+            }
+        } else if (!(old & RWLOCK_WAITING)) {
+            // Hold off new readers so the current ones drain
+            atomic_compare_exchange_weak(&lock->state, &old, old | RWLOCK_WAITING);
+        }
+        cpu_relax();
+    }
+#if LOCK_STATS
+    lock->stats.spin_cycles += rdtsc() - start;
+#endif
+}
+
+void lock_stats_register(lock_stats_t* stats)
+{
+    // Two CPUs may take a new lock for the first time at once
+    if (atomic_exchange(&stats->registered, 1)) {
+        return;
+    }
+    // Unnamed locks may live on a stack and go away, leave them out
+    if (stats->name == NULL) {
+        return;
+    }
+
+    uint32_t head = (uint32_t)lock_list;
+    do {
+        stats->next = (lock_stats_t*)head;
+    } while (!atomic_compare_exchange_weak((volatile uint32_t*)&lock_list, &head, (uint32_t)stats));
+}
+
+void lock_print_stats(void)
+{
+#if LOCK_STATS
+    terminal_printf("Locks: times taken, times a CPU had to wait, average wait\n");
+    for (lock_stats_t* stats = lock_list; stats; stats = stats->next) {
+        uint32_t avg = stats->contended ?
+            (uint32_t)div64_32(stats->spin_cycles, stats->contended, NULL) : 0;
+        terminal_printf("  %s: %u taken, %u waited (%u%%), %u cycles\n",
+                        stats->name ? stats->name : "?", stats->acquired, stats->contended,
+                        stats->acquired ?
+                            (uint32_t)div64_32((uint64_t)stats->contended * 100, stats->acquired, NULL) : 0,
+                        avg);
+    }
+    terminal_printf("Reader-writer locks count writers only\n");
+#else
+    terminal_printf("Lock statistics are not compiled in (OS_LOCK_STATS=0)\n");
+#endif
+}
+
+void lock_reset_stats(void)
+{
+    for (lock_stats_t* stats = lock_list; stats; stats = stats->next) {
+        stats->acquired = 0;
+        stats->contended = 0;
+        stats->spin_cycles = 0;
+    }
+}
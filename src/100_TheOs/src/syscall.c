@@ -0,0 +1,267 @@
+// syscall.c -- System call table and its two entry paths.
+//
+// int 0x80 goes through the normal interrupt stubs (a DPL 3 gate, so
+// ring 3 may use it). sysenter skips the IDT and the stack frame the CPU
+// builds for an interrupt and enters at sysenter_entry in syscall_asm.asm.
+
+#include "syscall.h"
+#include "interrupts.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "pit.h"
+#include "clock.h"
+#include "monitor.h"
+#include "memory/memory.h"
+#include "libc/div64.h"
+#include "fpu.h"
+#include "thread.h"
+#include "percpu.h"
+#include "futex.h"
+#include "usync.h"
+#include "atomic.h"
+#include "log.h"
+
+extern void terminal_printf(const char* format, ...);
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// From syscall_asm.asm
+extern void sysenter_entry(void);
+extern void usermode_return(uint32_t code);
+extern void user_bench_main(void);
+extern uint8_t user_bench_stack_top[];
+
+// Shared with the ring 3 benchmark loop, layout fixed by syscall_asm.asm
+struct user_bench_data_t {
+    uint32_t mode;
+    uint32_t rounds;
+    uint32_t min_cycles;
+    uint64_t total_cycles;
+} __attribute__((packed));
+extern struct user_bench_data_t user_bench_data;
+
+// Shared with the ring 3 futex benchmark, layout fixed by user_sync.asm
+struct usync_bench_data_t {
+    uint32_t mode;
+    uint32_t rounds;
+    uint64_t cycles;
+} __attribute__((packed));
+extern struct usync_bench_data_t usync_bench_data;
+extern umutex_t usync_bench_mutex;
+extern void usync_bench_main(void);
+
+// Bounds of the .user section, from the linker script
+extern uint8_t user_start[];
+extern uint8_t user_end[];
+
+static bool sysenter_supported = false;
+
+// FPU state of the ring 3 code, switched lazily like any other context
+static fpu_context_t user_fpu_context;
+
+static uint32_t sys_null(uint32_t a, uint32_t b, uint32_t c)
+{
+    return 0;
+}
+
+static uint32_t sys_getticks(uint32_t a, uint32_t b, uint32_t c)
+{
+    return pit_get_ticks();
+}
+
+static uint32_t sys_write(uint32_t buffer, uint32_t length, uint32_t c)
+{
+    // Only user pages may be passed in
+    if (buffer < (uint32_t)user_start || length > (uint32_t)user_end - buffer) {
+        return (uint32_t)-1;
+    }
+    monitor_write((const char*)buffer, length);
+    return length;
+}
+
+// An aligned word that ring 3 may touch
+static bool user_word(uint32_t addr)
+{
+    return addr >= (uint32_t)user_start && addr <= (uint32_t)user_end - 4 && !(addr & 3);
+}
+
+static uint32_t sys_futex_wait(uint32_t addr, uint32_t value, uint32_t c)
+{
+    if (!user_word(addr)) {
+        return (uint32_t)-1;
+    }
+    return futex_wait((volatile uint32_t*)addr, value);
+}
+
+static uint32_t sys_futex_wake(uint32_t addr, uint32_t count, uint32_t c)
+{
+    if (!user_word(addr)) {
+        return (uint32_t)-1;
+    }
+    return futex_wake((volatile uint32_t*)addr, count);
+}
+
+static uint32_t sys_exit(uint32_t code, uint32_t b, uint32_t c)
+{
+    usermode_return(code);
+    return 0;
+}
+
+static syscall_fn_t syscall_table[SYSCALL_COUNT] = {
+    [SYS_NULL] = sys_null,
+    [SYS_GETTICKS] = sys_getticks,
+    [SYS_WRITE] = sys_write,
+    [SYS_EXIT] = sys_exit,
+    [SYS_FUTEX_WAIT] = sys_futex_wait,
+    [SYS_FUTEX_WAKE] = sys_futex_wake,
+};
+
+uint32_t syscall_dispatch(uint32_t number, uint32_t a, uint32_t b, uint32_t c)
+{
+    if (number >= SYSCALL_COUNT) {
+        return (uint32_t)-1;
+    }
+    return syscall_table[number](a, b, c);
+}
+
+static void syscall_interrupt(registers_t* regs, void* context)
+{
+    regs->eax = syscall_dispatch(regs->eax, regs->ebx, regs->esi, regs->edi);
+}
+
+bool syscall_sysenter_supported(void)
+{
+    return sysenter_supported;
+}
+
+void syscall_init_cpu(void)
+{
+    if (!sysenter_supported) {
+        return;
+    }
+    percpu_t* cpu = this_cpu();
+    wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)(cpu->sysenter_stack + sizeof(cpu->sysenter_stack) / 4));
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void init_syscalls(void)
+{
+    interrupt_gate(SYSCALL_VECTOR, (uint32_t)isr_stub_table[SYSCALL_VECTOR], GDT_KERNEL_CODE,
+                   IDT_GATE_INTERRUPT | IDT_GATE_USER);
+    load_interrupt_controller(SYSCALL_VECTOR, syscall_interrupt, NULL);
+
+    // The Pentium Pro reports SEP without having it
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint32_t family = (eax >> 8) & 0xF, model = (eax >> 4) & 0xF, stepping = eax & 0xF;
+    bool broken_sep = family == 6 && model < 3 && stepping < 3;
+
+    if (cpu_has_edx(CPUID_EDX_SEP) && cpu_has_edx(CPUID_EDX_MSR) && !broken_sep) {
+        sysenter_supported = true;
+        syscall_init_cpu();
+    }
+
+    fpu_context_init(&user_fpu_context);
+    futex_init();
+    paging_set_user((uint32_t)user_start, (uint32_t)(user_end - user_start));
+    LOG_INFO("syscall", "int 0x80 ready, sysenter %s\n", sysenter_supported ? "ready" : "not supported");
+}
+
+#define BENCH_ROUNDS 100000
+
+// Run ring 3 code until it exits, with its own FPU context
+static void user_run(void (*entry)(void))
+{
+    thread_t* self = thread_current();
+    fpu_switch(&user_fpu_context);
+    usermode_enter((uint32_t)entry, (uint32_t)user_bench_stack_top, &self->user_esp0);
+    self->user_esp0 = 0;
+    fpu_switch(self->fpu);
+}
+
+// Run the ring 3 loop with one mechanism, returns the average
+static uint32_t syscall_bench_run(uint32_t mode, uint32_t* min_cycles)
+{
+    user_bench_data.mode = mode;
+    user_bench_data.rounds = BENCH_ROUNDS;
+    user_run(user_bench_main);
+
+    *min_cycles = user_bench_data.min_cycles;
+    return (uint32_t)div64_32(user_bench_data.total_cycles, BENCH_ROUNDS, NULL);
+}
+
+void syscall_benchmark(void)
+{
+    uint32_t min, avg;
+
+    terminal_printf("Null system call from ring 3, %d rounds (cycles, min / avg)\n", BENCH_ROUNDS);
+
+    avg = syscall_bench_run(0, &min);
+    terminal_printf("  int 0x80: %u / %u\n", min, avg);
+
+    if (sysenter_supported) {
+        avg = syscall_bench_run(1, &min);
+        terminal_printf("  sysenter: %u / %u\n", min, avg);
+    } else {
+        terminal_printf("  sysenter: not supported by this CPU\n");
+    }
+}
+
+#define FUTEX_BENCH_ROUNDS 100000
+#define FUTEX_HOLD_MS      20
+
+static volatile bool futex_holder_ready = false;
+
+// Holds the benchmark mutex for a while from the kernel, with the same
+// protocol as umutex_lock() and umutex_unlock()
+static void futex_holder(void* arg)
+{
+    umutex_t* mutex = arg;
+    uint32_t expected = 0;
+    atomic_compare_exchange_strong(&mutex->state, &expected, 1);
+    futex_holder_ready = true;
+
+    sleep_interrupt(FUTEX_HOLD_MS);
+    if (atomic_fetch_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+void futex_benchmark(void)
+{
+    uint32_t khz = clock_tsc_khz();
+    futex_stats_t before = futex_stats;
+
+    // Nobody else wants the mutex, so no system calls at all
+    usync_bench_mutex.state = 0;
+    usync_bench_data.mode = 0;
+    usync_bench_data.rounds = FUTEX_BENCH_ROUNDS;
+    user_run(usync_bench_main);
+    uint32_t calls = futex_stats.waits + futex_stats.again + futex_stats.wakes -
+                     (before.waits + before.again + before.wakes);
+    terminal_printf("Ring 3 mutex, uncontended: %u cycles per lock + unlock (%d rounds, %u futex calls)\n",
+                    (uint32_t)div64_32(usync_bench_data.cycles, FUTEX_BENCH_ROUNDS, NULL),
+                    FUTEX_BENCH_ROUNDS, calls);
+
+    // A kernel thread holds it: the lock sleeps in SYS_FUTEX_WAIT until
+    // the holder's unlock wakes it
+    futex_holder_ready = false;
+    if (!thread_create("futex-holder", futex_holder, &usync_bench_mutex)) {
+        terminal_printf("futexbench: no free thread slots\n");
+        return;
+    }
+    while (!futex_holder_ready) {
+        thread_yield();
+    }
+    before = futex_stats;
+    usync_bench_data.mode = 1;
+    user_run(usync_bench_main);
+    terminal_printf("Ring 3 mutex, contended: waited %u us for a %d ms holder (%u waits, %u wakes, %u woken)\n",
+                    khz ? (uint32_t)div64_32(usync_bench_data.cycles * 1000, khz, NULL) : 0,
+                    FUTEX_HOLD_MS, futex_stats.waits - before.waits, futex_stats.wakes - before.wakes,
+                    futex_stats.woken - before.woken);
+}
@@ -0,0 +1,186 @@
+;
+; syscall_asm.asm -- sysenter entry, switching to user mode, and the
+;                    ring 3 half of the system call benchmark.
+
+%define GDT_KERNEL_DATA 0x10
+%define GDT_USER_CODE   0x1B
+%define GDT_USER_DATA   0x23
+%define GDT_PERCPU      0x30
+
+; percpu_t.tss (percpu.h) and TssEntry.esp0 (gdt.h)
+%define PERCPU_TSS      16
+%define TSS_ESP0        4
+
+; Must match syscall.h
+%define SYS_NULL 0
+%define SYS_EXIT 3
+
+; Layout of user_bench_data, must match syscall.c
+%define BENCH_MODE     0
+%define BENCH_ROUNDS   4
+%define BENCH_MIN      8
+%define BENCH_TOTAL_LO 12
+%define BENCH_TOTAL_HI 16
+
+extern syscall_dispatch
+
+section .text
+
+; sysenter lands here with CS/SS from SYSENTER_CS, esp = this CPU's
+; percpu_t.sysenter_stack and interrupts off. ecx holds the caller's esp,
+; edx its return address. The user data segments are flat like the
+; kernel's, so they are left loaded; that is most of what makes this
+; path cheaper than int 0x80. Only GS has to point at the per-CPU data
+; while in the kernel. The call itself runs on the thread's own kernel
+; stack (TSS esp0), like int 0x80, with interrupts on, so it may block.
+global sysenter_entry
+sysenter_entry:
+    push ecx                 ; user esp, the landing stack holds only this
+    mov cx, GDT_PERCPU
+    mov gs, cx
+    pop ecx
+    mov esp, [gs:PERCPU_TSS]
+    mov esp, [esp + TSS_ESP0]
+
+    push ecx                 ; user esp
+    push edx                 ; user eip
+    push edi
+    push esi
+    push ebx
+    push eax
+    sti
+    call syscall_dispatch    ; result in eax
+    add esp, 16
+    cli                      ; no interrupt with the user GS loaded
+    mov dx, GDT_USER_DATA
+    mov gs, dx
+    pop edx
+    pop ecx
+    sti                      ; takes effect after sysexit
+    sysexit
+
+; uint32_t usermode_enter(uint32_t eip, uint32_t esp, uint32_t* kernel_esp)
+; iret into ring 3. Interrupts and system calls from there get the stack
+; below this frame (TSS esp0, also kept in *kernel_esp for the
+; scheduler), and SYS_EXIT comes back through usermode_return.
+global usermode_enter
+usermode_enter:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushf
+    cli                      ; iret turns interrupts back on; none may
+                             ; arrive in ring 0 with the user segments
+    mov eax, [esp + 32]      ; kernel_esp
+    mov [eax], esp
+    mov eax, [gs:PERCPU_TSS]
+    mov [eax + TSS_ESP0], esp
+
+    mov eax, [esp + 24]      ; eip
+    mov ecx, [esp + 28]      ; user stack
+
+    mov dx, GDT_USER_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+
+    push GDT_USER_DATA       ; ss
+    push ecx                 ; esp
+    pushf
+    or dword [esp], 0x200    ; eflags with interrupts enabled
+    push GDT_USER_CODE       ; cs
+    push eax                 ; eip
+    iret
+
+; void usermode_return(uint32_t code)
+; Called by SYS_EXIT in kernel mode. Drops the stack it was called on and
+; returns from usermode_enter() with the exit code. The frame is at TSS
+; esp0, which the scheduler keeps pointing at the current thread's.
+global usermode_return
+usermode_return:
+    mov eax, [esp + 4]
+    mov ecx, [gs:PERCPU_TSS]
+    mov esp, [ecx + TSS_ESP0]
+
+    mov dx, GDT_KERNEL_DATA
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov dx, GDT_PERCPU
+    mov gs, dx
+
+    popf
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; Everything below runs in ring 3. The linker puts .user on pages of its
+; own and init_syscalls() makes them user accessible.
+section .user progbits alloc exec write align=4096
+
+; Parameters and results shared with syscall_benchmark()
+global user_bench_data
+user_bench_data:
+    dd 0                     ; mode: 0 = int 0x80, 1 = sysenter
+    dd 0                     ; rounds
+    dd 0                     ; minimum cycles
+    dd 0, 0                  ; total cycles
+
+; Time rounds null system calls, then exit
+global user_bench_main
+user_bench_main:
+    mov dword [user_bench_data + BENCH_MIN], 0xFFFFFFFF
+    mov dword [user_bench_data + BENCH_TOTAL_LO], 0
+    mov dword [user_bench_data + BENCH_TOTAL_HI], 0
+    mov ebp, [user_bench_data + BENCH_ROUNDS]
+    cmp dword [user_bench_data + BENCH_MODE], 0
+    jne .sysenter_loop
+
+.int_loop:
+    rdtsc
+    mov esi, eax
+    mov eax, SYS_NULL
+    int 0x80
+    call .account
+    dec ebp
+    jnz .int_loop
+    jmp .exit
+
+.sysenter_loop:
+    rdtsc
+    mov esi, eax
+    mov eax, SYS_NULL
+    mov ecx, esp
+    mov edx, .sysenter_return
+    sysenter
+.sysenter_return:
+    call .account
+    dec ebp
+    jnz .sysenter_loop
+
+.exit:
+    mov eax, SYS_EXIT
+    xor ebx, ebx
+    int 0x80
+
+; Add the cycles since esi to the totals
+.account:
+    rdtsc
+    sub eax, esi
+    cmp eax, [user_bench_data + BENCH_MIN]
+    jae .not_min
+    mov [user_bench_data + BENCH_MIN], eax
+.not_min:
+    add [user_bench_data + BENCH_TOTAL_LO], eax
+    adc dword [user_bench_data + BENCH_TOTAL_HI], 0
+    ret
+
+align 16
+global user_bench_stack_top
+user_bench_stack:
+    times 4096 db 0
+user_bench_stack_top:
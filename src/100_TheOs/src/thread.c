@@ -0,0 +1,603 @@
+// thread.c -- Kernel threads and the round-robin scheduler.
+//
+// Every thread has its own stack; switching is thread_switch() saving
+// the callee-saved registers on one stack and popping them off another.
+// Each processor has a FIFO run queue of ready threads. The running
+// thread keeps the CPU until it yields, exits, or its time slice of
+// sched_quantum_ms runs out: the timer interrupt calls sched_clock(),
+// and interrupt_common_stub calls sched_preempt() on its way out, which
+// switches right there. The preempted thread's interrupt frame stays on
+// its stack and is returned through when the thread next runs.
+//
+// The boot flow becomes thread 0, the kernel worker, and stays on CPU 0.
+// Every processor has an idle thread that runs only when nothing else
+// can: on CPU 0 one made in sched_init(), elsewhere the boot flow. An
+// idle processor steals the first thread that may move from the longest
+// run queue.
+//
+// A blocked thread (waitqueue.h) is on no run queue. thread_wake() puts
+// it back on the queue of the CPU it last ran on and, if that is another
+// CPU, sends it the reschedule IPI.
+//
+// One lock covers all run queues. The switching CPU takes it and the
+// thread switched to releases it, in sched_finish_switch(), so a thread
+// on a run queue cannot be stolen before its registers are saved.
+
+#include "thread.h"
+#include "clock.h"
+#include "common.h"
+#include "smp.h"
+#include "percpu.h"
+#include "gdt.h"
+#include "spinlock.h"
+#include "trace.h"
+#include "idle.h"
+#include "memory/memory.h"
+#include "libc/div64.h"
+#include "log.h"
+
+extern void terminal_printf(const char* format, ...);
+
+uint32_t sched_quantum_ms = SCHED_QUANTUM_MS;
+
+// Shared with other processors for stealing, so not in percpu_t
+typedef struct {
+    thread_t* run_head;
+    thread_t* run_tail;
+    uint32_t queued;
+    thread_t* idle;             // NULL on CPU 0, the worker stands in
+    thread_t* zombie;           // Exited, stack still in use until the switch
+    volatile bool need_resched;
+    uint32_t slice_end;
+    uint64_t slice_start_tsc;
+    uint32_t switches;
+    uint32_t steals;            // Threads taken from other run queues
+} sched_cpu_t;
+
+// Slot 0 is the boot flow, using the boot stack and the kernel FPU context
+static thread_t threads[THREAD_MAX] = {
+    [0] = { .state = THREAD_RUNNING, .name = "worker", .fpu = &fpu_kernel_context, .pinned = true },
+};
+static fpu_context_t thread_fpu[THREAD_MAX];
+
+static thread_t idle_threads[APIC_MAX_CPUS];
+static fpu_context_t idle_fpu[APIC_MAX_CPUS];
+
+static sched_cpu_t sched_cpus[APIC_MAX_CPUS];
+
+static spinlock_t runqueue_lock = SPINLOCK_INIT("runqueue");
+
+static bool sched_running = false;
+static uint32_t next_thread_id = 1;
+static uint32_t sched_switches = 0;
+
+// Interrupts must be off, a CPU holding the lock must not be preempted
+static inline void sched_lock(void)
+{
+    spin_lock(&runqueue_lock);
+}
+
+static inline void sched_unlock(void)
+{
+    spin_unlock(&runqueue_lock);
+}
+
+static inline sched_cpu_t* sched_this_cpu(void)
+{
+    return &sched_cpus[this_cpu_index()];
+}
+
+static void runqueue_push(sched_cpu_t* cpu, thread_t* t)
+{
+    t->next = NULL;
+    if (cpu->run_tail) {
+        cpu->run_tail->next = t;
+    } else {
+        cpu->run_head = t;
+    }
+    cpu->run_tail = t;
+    cpu->queued++;
+}
+
+static thread_t* runqueue_pop(sched_cpu_t* cpu)
+{
+    thread_t* t = cpu->run_head;
+    if (t) {
+        cpu->run_head = t->next;
+        if (!cpu->run_head) cpu->run_tail = NULL;
+        t->next = NULL;
+        cpu->queued--;
+    }
+    return t;
+}
+
+// Take the first thread that may move off the longest other run queue,
+// lock held
+static thread_t* sched_steal(sched_cpu_t* cpu)
+{
+    sched_cpu_t* victim = NULL;
+    for (int i = 0; i < smp_cpus_online; i++) {
+        sched_cpu_t* other = &sched_cpus[i];
+        if (other != cpu && other->queued > 0 && (!victim || other->queued > victim->queued)) {
+            victim = other;
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    thread_t* before = NULL;
+    for (thread_t* t = victim->run_head; t; before = t, t = t->next) {
+        if (t->pinned) continue;
+        if (before) {
+            before->next = t->next;
+        } else {
+            victim->run_head = t->next;
+        }
+        if (victim->run_tail == t) victim->run_tail = before;
+        victim->queued--;
+        t->next = NULL;
+        cpu->steals++;
+        return t;
+    }
+    return NULL;
+}
+
+// Start a new time slice and make sure the clock comes back to end it
+static void sched_start_slice(sched_cpu_t* cpu)
+{
+    cpu->slice_end = clock_now_ms() + sched_quantum_ms;
+    if (cpu->run_head) {
+        clock_arm(cpu->slice_end);
+    }
+}
+
+// Runs first thing on the new thread's stack after every switch, and
+// releases the lock the switching side took
+static void sched_finish_switch(void)
+{
+    sched_cpu_t* cpu = sched_this_cpu();
+    if (cpu->zombie) {
+        fpu_context_release(cpu->zombie->fpu);
+        cpu->zombie->state = THREAD_UNUSED;
+        cpu->zombie = NULL;
+    }
+    sched_unlock();
+}
+
+// Who runs after prev, lock held. NULL lets prev keep the CPU.
+static thread_t* sched_pick_next(sched_cpu_t* cpu, thread_t* prev)
+{
+    thread_t* next = runqueue_pop(cpu);
+    if (next == NULL && prev->state != THREAD_RUNNING) {
+        next = sched_steal(cpu);
+        if (next == NULL) {
+            next = cpu->idle;
+        }
+    }
+    return next;
+}
+
+// Switch to the next ready thread, interrupts off and lock held. The
+// current thread goes to the back of the queue unless it is blocked,
+// dead or the idle thread.
+static void sched_switch_locked(void)
+{
+    uint32_t index = this_cpu_index();
+    sched_cpu_t* cpu = &sched_cpus[index];
+    thread_t* prev = this_cpu_read(current);
+    thread_t* next = sched_pick_next(cpu, prev);
+    cpu->need_resched = false;
+    if (next == NULL || next == prev) {
+        sched_unlock();
+        return;
+    }
+
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != cpu->idle) {
+            runqueue_push(cpu, prev);
+        }
+    }
+
+    uint64_t now = rdtsc();
+    prev->cycles += now - cpu->slice_start_tsc;
+    cpu->slice_start_tsc = now;
+
+    next->state = THREAD_RUNNING;
+    next->cpu = index;
+    next->switches++;
+    cpu->switches++;
+    sched_switches++;
+    this_cpu_write(current, next);
+    sched_start_slice(cpu);
+
+    // Interrupts and system calls from its ring 3 code use its own stack
+    if (next->user_esp0) {
+        this_cpu_read(tss)->esp0 = next->user_esp0;
+    }
+
+    trace_event(TRACE_SCHED_SWITCH, prev->id, next->id);
+    fpu_switch(next->fpu);
+    thread_switch(&prev->esp, next->esp);
+
+    // Back in prev, some time later and maybe on another CPU
+    sched_finish_switch();
+}
+
+static void sched_switch(void)
+{
+    sched_lock();
+    sched_switch_locked();
+}
+
+static void thread_start(void)
+{
+    sched_finish_switch();
+    asm volatile("sti");
+    thread_t* self = thread_current();
+    self->fn(self->arg);
+    thread_exit();
+}
+
+// The frame thread_switch() pops: EFLAGS (interrupts off), edi, esi,
+// ebx, ebp, then the return into thread_start
+static void thread_init_stack(thread_t* t)
+{
+    uint32_t* sp = (uint32_t*)(t->stack + THREAD_STACK_SIZE);
+    *--sp = 0;                        // thread_start never returns
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0;                        // ebp
+    *--sp = 0;                        // ebx
+    *--sp = 0;                        // esi
+    *--sp = 0;                        // edi
+    *--sp = 0x002;                    // EFLAGS, reserved bit 1
+    t->esp = (uint32_t)sp;
+}
+
+static thread_t* thread_spawn(const char* name, thread_fn_t fn, void* arg, bool pinned)
+{
+    uint32_t flags = spin_lock_irqsave(&runqueue_lock);
+
+    thread_t* t = NULL;
+    for (int i = 1; i < THREAD_MAX; i++) {
+        if (threads[i].state == THREAD_UNUSED) {
+            t = &threads[i];
+            break;
+        }
+    }
+    if (t == NULL) {
+        spin_unlock_irqrestore(&runqueue_lock, flags);
+        return NULL;
+    }
+
+    // Taken before malloc so a nested create cannot pick the same slot
+    t->state = THREAD_READY;
+    t->id = next_thread_id++;
+    spin_unlock_irqrestore(&runqueue_lock, flags);
+
+    // Stacks stay with their slot, the heap does not reuse freed blocks
+    // well enough to hand them back
+    if (t->stack == NULL) {
+        t->stack = malloc(THREAD_STACK_SIZE);
+    }
+
+    int n = 0;
+    for (; name[n] && n < (int)sizeof(t->name) - 1; n++) {
+        t->name[n] = name[n];
+    }
+    t->name[n] = '\0';
+    t->fn = fn;
+    t->arg = arg;
+    t->pinned = pinned;
+    t->console = thread_console();
+    t->fpu = &thread_fpu[t - threads];
+    fpu_context_init(t->fpu);
+    t->switches = 0;
+    t->preemptions = 0;
+    t->cycles = 0;
+    thread_init_stack(t);
+
+    flags = spin_lock_irqsave(&runqueue_lock);
+    sched_cpu_t* cpu = sched_this_cpu();
+    t->cpu = cpu - sched_cpus;
+    bool was_alone = cpu->run_head == NULL;
+    runqueue_push(cpu, t);
+    if (was_alone) {
+        sched_start_slice(cpu);
+    }
+    spin_unlock_irqrestore(&runqueue_lock, flags);
+
+    // An idle processor can take it from here
+    if (!pinned) {
+        smp_kick_idle();
+    }
+
+    LOG_DEBUG("sched", "Thread %u '%s' created\n", t->id, t->name);
+    return t;
+}
+
+thread_t* thread_create(const char* name, thread_fn_t fn, void* arg)
+{
+    return thread_spawn(name, fn, arg, false);
+}
+
+thread_t* thread_create_pinned(const char* name, thread_fn_t fn, void* arg)
+{
+    return thread_spawn(name, fn, arg, true);
+}
+
+void thread_yield(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    sched_switch();
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+void thread_exit(void)
+{
+    asm volatile("cli");
+    thread_t* self = this_cpu_read(current);
+    self->state = THREAD_DEAD;
+    sched_this_cpu()->zombie = self;
+    sched_switch();
+
+    // There is always the worker or an idle thread, so this is never reached
+    while (1) {
+        asm volatile("hlt");
+    }
+}
+
+thread_t* thread_current(void)
+{
+    // A single load, so it cannot be split by a move to another CPU
+    return this_cpu_read(current);
+}
+
+// Before sched_init() GS may not hold the per-CPU segment yet, and an
+// application processor has no current thread until sched_init_ap()
+static thread_t* thread_console_owner(void)
+{
+    thread_t* self = sched_running ? this_cpu_read(current) : NULL;
+    return self ? self : &threads[0];
+}
+
+int thread_console(void)
+{
+    return thread_console_owner()->console;
+}
+
+void thread_set_console(int vt)
+{
+    thread_console_owner()->console = vt;
+}
+
+void sched_block(void)
+{
+    sched_lock();
+    if (this_cpu_read(current)->state != THREAD_BLOCKED) {
+        // Woken between wait_prepare() and here
+        sched_unlock();
+        return;
+    }
+    sched_switch_locked();
+}
+
+void thread_wake(thread_t* t)
+{
+    uint32_t flags = spin_lock_irqsave(&runqueue_lock);
+    if (t->state != THREAD_BLOCKED) {
+        spin_unlock_irqrestore(&runqueue_lock, flags);
+        return;
+    }
+
+    // The switching CPU holds the lock until the thread's registers are
+    // saved, so a thread still current somewhere has not gone yet
+    uint32_t target = t->cpu;
+    bool remote = false;
+    if (per_cpu(target)->current == t) {
+        t->state = THREAD_RUNNING;
+    } else {
+        sched_cpu_t* cpu = &sched_cpus[target];
+        bool was_alone = cpu->run_head == NULL;
+        t->state = THREAD_READY;
+        runqueue_push(cpu, t);
+        if (target != this_cpu_index()) {
+            remote = true;
+        } else if (was_alone) {
+            sched_start_slice(cpu);
+        }
+    }
+    spin_unlock_irqrestore(&runqueue_lock, flags);
+
+    if (remote) {
+        smp_send_resched(target);
+    }
+}
+
+void sched_remote_wake(void)
+{
+    // An idle CPU looks at its queue when the IPI ends the halt. A busy
+    // one needs its slice to end; APs tick anyway, CPU 0 may be tickless.
+    sched_cpu_t* cpu = sched_this_cpu();
+    if (sched_running && cpu->run_head && this_cpu_read(current) != cpu->idle) {
+        clock_arm(cpu->slice_end);
+    }
+}
+
+bool sched_others_ready(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+
+    sched_cpu_t* cpu = sched_this_cpu();
+    bool ready = cpu->run_head != NULL;
+    if (!ready && smp_cpus_online > 1) {
+        sched_lock();
+        thread_t* t = sched_steal(cpu);
+        if (t) {
+            runqueue_push(cpu, t);
+            ready = true;
+        }
+        sched_unlock();
+    }
+
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+    return ready;
+}
+
+// CPU 0's idle thread. Whatever wakes the CPU may have made a thread
+// ready; cpu_idle() enables interrupts only as it halts, so a wakeup
+// cannot slip in between the check and the halt.
+static void sched_idle_loop(void* arg)
+{
+    while (1) {
+        asm volatile("cli");
+        if (sched_others_ready()) {
+            asm volatile("sti");
+            thread_yield();
+        } else {
+            cpu_idle();
+        }
+    }
+}
+
+void sched_init(void)
+{
+    thread_t* idle = &idle_threads[0];
+    idle->state = THREAD_READY;
+    idle->id = next_thread_id++;
+    for (int n = 0; n < 5; n++) {
+        idle->name[n] = "idle"[n];
+    }
+    idle->fn = sched_idle_loop;
+    idle->pinned = true;
+    idle->stack = malloc(THREAD_STACK_SIZE);
+    idle->fpu = &idle_fpu[0];
+    fpu_context_init(idle->fpu);
+    thread_init_stack(idle);
+    sched_cpus[0].idle = idle;
+
+    this_cpu_write(current, &threads[0]);
+    sched_cpus[0].slice_start_tsc = rdtsc();
+    sched_running = true;
+    LOG_INFO("sched", "Round-robin scheduler, %u ms time slice\n", sched_quantum_ms);
+}
+
+void sched_init_ap(int index)
+{
+    thread_t* idle = &idle_threads[index];
+    idle->state = THREAD_RUNNING;
+    idle->pinned = true;
+    idle->cpu = index;
+    idle->fpu = &idle_fpu[index];
+    for (int n = 0; n < 5; n++) {
+        idle->name[n] = "idle"[n];
+    }
+
+    sched_lock();
+    idle->id = next_thread_id++;
+    sched_unlock();
+
+    sched_cpu_t* cpu = &sched_cpus[index];
+    cpu->idle = idle;
+    cpu->slice_start_tsc = rdtsc();
+    this_cpu_write(current, idle);
+}
+
+void sched_clock(uint32_t now)
+{
+    sched_cpu_t* cpu = sched_this_cpu();
+    if (!sched_running || cpu->run_head == NULL) {
+        return;
+    }
+    if ((int32_t)(now - cpu->slice_end) >= 0) {
+        cpu->need_resched = true;
+    } else {
+        clock_arm(cpu->slice_end);
+    }
+}
+
+void sched_preempt(void)
+{
+    sched_cpu_t* cpu = sched_this_cpu();
+    if (cpu->need_resched) {
+        this_cpu_read(current)->preemptions++;
+        sched_switch();
+    }
+}
+
+void sched_set_quantum(uint32_t ms)
+{
+    sched_quantum_ms = ms ? ms : 1;
+}
+
+static const char* thread_state_names[] = {
+    [THREAD_UNUSED] = "unused",
+    [THREAD_READY] = "ready",
+    [THREAD_RUNNING] = "running",
+    [THREAD_BLOCKED] = "blocked",
+    [THREAD_DEAD] = "dead",
+};
+
+static void sched_print_thread(const thread_t* t, uint32_t khz)
+{
+    uint32_t ms = khz ? (uint32_t)div64_32(t->cycles, khz, NULL) : 0;
+    terminal_printf("  %u %s: %s on CPU %u, %u switches, %u preempted, %u ms\n", t->id, t->name,
+                    thread_state_names[t->state], t->cpu, t->switches, t->preemptions, ms);
+}
+
+void sched_print_threads(void)
+{
+    uint32_t khz = clock_tsc_khz();
+    terminal_printf("Threads (%u ms slice, %u switches):\n", sched_quantum_ms, sched_switches);
+    for (int i = 0; i < THREAD_MAX; i++) {
+        if (threads[i].state == THREAD_UNUSED) continue;
+        sched_print_thread(&threads[i], khz);
+    }
+    for (int i = 0; i < smp_cpus_online; i++) {
+        sched_print_thread(&idle_threads[i], khz);
+    }
+    if (smp_cpus_online < 2) return;
+
+    for (int i = 0; i < smp_cpus_online; i++) {
+        const sched_cpu_t* cpu = &sched_cpus[i];
+        terminal_printf("CPU %d: running %s, %u queued, %u switches, %u stolen\n", i,
+                        per_cpu(i)->current->name, cpu->queued, cpu->switches, cpu->steals);
+    }
+}
+
+#define SCHED_BENCH_ROUNDS 10000
+
+static volatile uint32_t bench_done = 0;
+
+static void sched_bench_thread(void* arg)
+{
+    for (int i = 0; i < SCHED_BENCH_ROUNDS; i++) {
+        thread_yield();
+    }
+    asm volatile("lock incl %0" : "+m" (bench_done));
+}
+
+void sched_benchmark(void)
+{
+    bench_done = 0;
+    uint32_t switches = sched_switches;
+    uint64_t start = rdtsc();
+
+    // Kept on this CPU, so every yield is a switch
+    if (!thread_create_pinned("bench-a", sched_bench_thread, NULL) ||
+        !thread_create_pinned("bench-b", sched_bench_thread, NULL)) {
+        terminal_printf("switchbench: no free thread slots\n");
+        return;
+    }
+    while (bench_done < 2) {
+        thread_yield();
+    }
+
+    uint64_t cycles = rdtsc() - start;
+    switches = sched_switches - switches;
+    terminal_printf("Context switch: %u switches, %u cycles each (thread_yield to thread_yield)\n",
+                    switches, (uint32_t)div64_32(cycles, switches, NULL));
+}
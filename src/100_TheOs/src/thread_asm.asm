@@ -0,0 +1,30 @@
+;
+; thread_asm.asm -- Kernel thread context switch.
+
+section .text
+
+; void thread_switch(uint32_t* save_esp, uint32_t new_esp)
+;
+; Only what the C calling convention expects a call to keep has to be
+; saved: ebx, esi, edi, ebp, and EFLAGS so each thread keeps its own
+; interrupt flag. eax, ecx and edx are the caller's problem, and a thread
+; preempted in an interrupt has the rest on its stack already.
+; A new thread's stack is laid out as if it had called this function,
+; returning into thread_start.
+global thread_switch
+thread_switch:
+    mov eax, [esp + 4]       ; save_esp
+    mov edx, [esp + 8]       ; new_esp
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushfd
+    mov [eax], esp
+    mov esp, edx
+    popfd
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
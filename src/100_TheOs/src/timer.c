@@ -0,0 +1,309 @@
+// timer.c -- Hierarchical timer wheel.
+//
+// Four levels of 64 slots. Level 0 has one slot per millisecond, each
+// level above covers 64 times the span of the one below, so the wheel
+// reaches 2^24 ms (4.6 hours) ahead; later deadlines park in the top
+// level and are placed again when they come round. Adding and cancelling
+// are O(1): a timer goes into the slot its deadline falls in, and the
+// slot lists are doubly linked. Whenever level 0 wraps, the next slot of
+// level 1 is spread out over level 0 ("cascaded"), and so on up.
+//
+// timer_run() is called from clock_event(). In tickless mode it arms the
+// clock for the next slot that has something in it.
+//
+// timer_lock covers the pool and the wheel. Callbacks run without it, so
+// they can add and cancel timers.
+
+#include "timer.h"
+#include "clock.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "percpu.h"
+#include "libc/stddef.h"
+
+extern void terminal_printf(const char* format, ...);
+
+#define TIMER_LEVELS    4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_DELTA ((1u << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+typedef struct timer {
+    struct timer* next;
+    struct timer** pprev;     // Link pointing at this timer, for O(1) unlink
+    uint32_t expires;
+    uint32_t period;          // 0 for one-shot timers
+    timer_fn_t fn;
+    void* arg;
+    uint32_t generation;      // Bumped on every reuse, part of the id
+    uint8_t level;            // Wheel level it is on
+    bool pending;
+} ktimer_t;
+
+static ktimer_t timer_pool[TIMER_POOL_SIZE];
+static ktimer_t* timer_free = NULL;
+static bool timer_pool_ready = false;
+
+static ktimer_t* wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint32_t wheel_count[TIMER_LEVELS];
+
+// The level 0 slot being run. A list of its own, so callbacks can cancel
+// timers that are due in the same millisecond.
+static ktimer_t* timer_expiring = NULL;
+
+// Next millisecond the wheel has to process
+static uint32_t timer_base = 0;
+static uint32_t timer_pending = 0;
+static uint32_t timer_fired = 0;
+
+static spinlock_t timer_lock = SPINLOCK_INIT("timer");
+
+static void timer_pool_init(void)
+{
+    for (int i = TIMER_POOL_SIZE - 1; i >= 0; i--) {
+        timer_pool[i].next = timer_free;
+        timer_free = &timer_pool[i];
+    }
+    timer_base = clock_now_ms();
+    timer_pool_ready = true;
+}
+
+static timer_id_t timer_id(ktimer_t* t)
+{
+    return (t->generation << 8) | (uint32_t)(t - timer_pool + 1);
+}
+
+static void timer_enqueue(ktimer_t* t)
+{
+    uint32_t expires = t->expires;
+    uint32_t delta = expires - timer_base;
+    if ((int32_t)delta < 0) {
+        // Overdue, runs with the next slot
+        expires = timer_base;
+        delta = 0;
+    } else if (delta > TIMER_MAX_DELTA) {
+        expires = timer_base + TIMER_MAX_DELTA;
+        delta = TIMER_MAX_DELTA;
+    }
+
+    int level = 0;
+    while (delta >= (1u << ((level + 1) * TIMER_SLOT_BITS))) {
+        level++;
+    }
+    ktimer_t** slot = &wheel[level][(expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+
+    t->next = *slot;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+    t->level = level;
+    wheel_count[level]++;
+}
+
+static void timer_unlink(ktimer_t* t)
+{
+    wheel_count[t->level]--;
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// Spread one slot of a higher level over the levels below
+static void timer_cascade(int level, uint32_t index)
+{
+    ktimer_t* list = wheel[level][index];
+    wheel[level][index] = NULL;
+    while (list) {
+        ktimer_t* next = list->next;
+        wheel_count[level]--;
+        timer_enqueue(list);
+        list = next;
+    }
+}
+
+static timer_id_t timer_start(uint32_t deadline, uint32_t period, timer_fn_t fn, void* arg)
+{
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    if (!timer_pool_ready) timer_pool_init();
+
+    timer_id_t id = 0;
+    ktimer_t* t = timer_free;
+    if (t != NULL) {
+        timer_free = t->next;
+        t->expires = deadline;
+        t->period = period;
+        t->fn = fn;
+        t->arg = arg;
+        t->generation = (t->generation + 1) & 0xFFFFFF;
+        if (t->generation == 0) t->generation = 1;
+        t->pending = true;
+        timer_enqueue(t);
+        timer_pending++;
+        id = timer_id(t);
+    }
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    if (id != 0) {
+        if (this_cpu_index() == 0) {
+            clock_arm(deadline);
+        } else {
+            smp_send_resched(0);    // CPU 0 runs the wheel
+        }
+    }
+    return id;
+}
+
+timer_id_t timer_add(uint32_t deadline, timer_fn_t fn, void* arg)
+{
+    return timer_start(deadline, 0, fn, arg);
+}
+
+timer_id_t timer_add_periodic(uint32_t first, uint32_t period, timer_fn_t fn, void* arg)
+{
+    return timer_start(first, period ? period : 1, fn, arg);
+}
+
+static void timer_release(ktimer_t* t)
+{
+    t->pending = false;
+    t->next = timer_free;
+    timer_free = t;
+    timer_pending--;
+}
+
+bool timer_cancel(timer_id_t id)
+{
+    uint32_t index = (id & 0xFF) - 1;
+    if (id == 0 || index >= TIMER_POOL_SIZE) {
+        return false;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    ktimer_t* t = &timer_pool[index];
+    bool cancelled = false;
+    if (t->pending && t->generation == id >> 8) {
+        timer_unlink(t);
+        timer_release(t);
+        cancelled = true;
+    }
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return cancelled;
+}
+
+// Earliest time something in the wheel needs attention: the first
+// non-empty level 0 slot, or the cascade of a non-empty higher slot
+static bool timer_next_event(uint32_t* next)
+{
+    bool found = false;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        if (wheel_count[level] == 0) continue;
+
+        uint32_t shift = level * TIMER_SLOT_BITS;
+        uint32_t current = (timer_base >> shift) & TIMER_SLOT_MASK;
+        for (uint32_t step = 0; step < TIMER_SLOTS; step++) {
+            uint32_t index = (current + step) & TIMER_SLOT_MASK;
+            if (wheel[level][index] == NULL) continue;
+
+            // Level 0 slots run at their millisecond; higher slots are
+            // cascaded when the level below wraps into them. For the
+            // current index that is now if the wrap is still to be
+            // processed, a full turn away otherwise.
+            uint32_t when;
+            if (level == 0) {
+                when = timer_base + step;
+            } else if (step == 0 && (timer_base & ((1u << shift) - 1)) == 0) {
+                when = timer_base;
+            } else {
+                uint32_t units = step ? step : TIMER_SLOTS;
+                when = ((timer_base >> shift) + units) << shift;
+            }
+            if (!found || (int32_t)(when - *next) < 0) {
+                *next = when;
+                found = true;
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+void timer_run(uint32_t now)
+{
+    if (!timer_pool_ready) {
+        return;
+    }
+
+    // Interrupt context, interrupts are off
+    spin_lock(&timer_lock);
+    while ((int32_t)(now - timer_base) >= 0) {
+        if (timer_pending == 0) {
+            // Nothing to cascade or run, skip the idle stretch
+            timer_base = now + 1;
+            break;
+        }
+
+        uint32_t index = timer_base & TIMER_SLOT_MASK;
+        if (index == 0) {
+            for (int level = 1; level < TIMER_LEVELS; level++) {
+                uint32_t upper = (timer_base >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+                timer_cascade(level, upper);
+                if (upper != 0) break;
+            }
+        }
+
+        // Take the slot off the wheel before moving on, so periodic
+        // timers put back 64 ms later do not land in it again
+        timer_expiring = wheel[0][index];
+        wheel[0][index] = NULL;
+        if (timer_expiring) timer_expiring->pprev = &timer_expiring;
+        timer_base++;
+
+        while (timer_expiring) {
+            ktimer_t* t = timer_expiring;
+            timer_unlink(t);
+            timer_fired++;
+
+            timer_fn_t fn = t->fn;
+            void* arg = t->arg;
+            if (t->period) {
+                // Back on the wheel first, so fn may cancel it
+                t->expires += t->period;
+                timer_enqueue(t);
+            } else {
+                timer_release(t);
+            }
+            spin_unlock(&timer_lock);
+            fn(arg);
+            spin_lock(&timer_lock);
+        }
+    }
+
+    uint32_t next;
+    bool armed = timer_next_event(&next);
+    spin_unlock(&timer_lock);
+    if (armed) {
+        clock_arm(next);
+    }
+}
+
+void timer_rearm(void)
+{
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    uint32_t next;
+    bool armed = timer_pool_ready && timer_next_event(&next);
+    spin_unlock_irqrestore(&timer_lock, flags);
+    if (armed) {
+        clock_arm(next);
+    }
+}
+
+void timer_print_info(void)
+{
+    terminal_printf("Timers: %u pending (of %d), %u fired\n", timer_pending, TIMER_POOL_SIZE, timer_fired);
+}
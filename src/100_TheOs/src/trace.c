@@ -0,0 +1,207 @@
+// trace.c -- Binary event tracing with Chrome trace-format export.
+//
+// Events are logged into per-CPU rings by trace_event() (see trace.h) and
+// streamed over COM1 by 'trace dump'. The JSON output loads directly in
+// chrome://tracing or ui.perfetto.dev; the binary output is converted by
+// scripts/trace_to_chrome.py.
+
+#include "trace.h"
+#include "serial.h"
+#include "rtc.h"
+#include "clock.h"
+#include "monitor.h"
+#include "smp.h"
+#include "libc/string.h"
+#include "libc/div64.h"
+
+#define TRACE_BINARY_MAGIC 0x43525455  // "UTRC"
+#define TRACE_BINARY_VERSION 1
+
+bool trace_enabled = false;
+trace_buffer_t trace_buffers[TRACE_MAX_CPUS];
+
+// TSC when the buffers were cleared, event times are relative to it
+static uint64_t trace_start_tsc = 0;
+
+static const char* event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_IRQ_BEGIN] = "irq",
+    [TRACE_IRQ_END] = "irq",
+    [TRACE_CMD_BEGIN] = "cmd",
+    [TRACE_CMD_END] = "cmd",
+    [TRACE_MALLOC] = "malloc",
+    [TRACE_FREE] = "free",
+    [TRACE_PMALLOC] = "pmalloc",
+    [TRACE_PIT_TICK] = "pit_tick",
+    [TRACE_IRQ_THROTTLE] = "throttle",
+    [TRACE_SCHED_SWITCH] = "switch",
+};
+
+void trace_init(void) {
+    trace_clear();
+    trace_enabled = true;
+}
+
+void trace_clear(void) {
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++) {
+        trace_buffers[cpu].head = 0;
+    }
+    trace_start_tsc = rdtsc();
+}
+
+// TSC cycles per millisecond, from the boot calibration
+static uint32_t trace_cycles_per_ms(void) {
+    uint32_t khz = clock_tsc_khz();
+    return khz ? khz : 1000000;  // Not calibrated, assume 1 GHz
+}
+
+// Decimal formatting of 64-bit values (vsnprintf only handles 32 bits)
+static char* format_u64(char* out, uint64_t value) {
+    char digits[21];
+    int n = 0;
+    do {
+        uint32_t rem;
+        value = div64_32(value, 10, &rem);
+        digits[n++] = '0' + rem;
+    } while (value);
+    while (n) *out++ = digits[--n];
+    *out = '\0';
+    return out;
+}
+
+// First event still in the ring and the number of events to emit
+static uint32_t trace_window(const trace_buffer_t* buf, uint32_t* first) {
+    uint32_t head = buf->head;
+    if (head > TRACE_BUFFER_EVENTS) {
+        *first = head - TRACE_BUFFER_EVENTS;
+        return TRACE_BUFFER_EVENTS;
+    }
+    *first = 0;
+    return head;
+}
+
+// Follows the CPU names, so every event starts with a separator
+static void trace_write_json_event(const trace_event_t* ev, uint64_t base_tsc,
+                                   uint32_t cycles_per_ms) {
+    char ts[32];
+    char name[16];
+    const char* phase = "i";
+
+    // Timestamp in microseconds with nanosecond fraction
+    uint32_t rem;
+    uint64_t ms = div64_32(ev->tsc - base_tsc, cycles_per_ms, &rem);
+    uint32_t ns = (uint32_t)div64_32((uint64_t)rem * 1000000, cycles_per_ms, NULL);
+    char* p = format_u64(ts, ms * 1000 + ns / 1000);
+    *p++ = '.';
+    *p++ = '0' + (ns / 100) % 10;
+    *p++ = '0' + (ns / 10) % 10;
+    *p++ = '0' + ns % 10;
+    *p = '\0';
+
+    const char* base = ev->id < TRACE_EVENT_COUNT && event_names[ev->id] ? event_names[ev->id] : "unknown";
+    size_t n = 0;
+    while (base[n] && n < 8) { name[n] = base[n]; n++; }
+    name[n] = '\0';
+
+    switch (ev->id) {
+        case TRACE_IRQ_BEGIN:
+        case TRACE_IRQ_END: {
+            size_t len = strlen(name);
+            if (ev->arg0 >= 10) name[len++] = '0' + ev->arg0 / 10;
+            name[len++] = '0' + ev->arg0 % 10;
+            name[len] = '\0';
+            phase = ev->id == TRACE_IRQ_BEGIN ? "B" : "E";
+            break;
+        }
+        case TRACE_CMD_BEGIN:
+        case TRACE_CMD_END: {
+            // The command's first characters, packed into arg0
+            size_t len = strlen(name);
+            name[len++] = ':';
+            for (int i = 0; i < 4; i++) {
+                char c = (char)(ev->arg0 >> (i * 8));
+                if (c < ' ' || c > '~' || c == '"' || c == '\\') break;
+                name[len++] = c;
+            }
+            name[len] = '\0';
+            phase = ev->id == TRACE_CMD_BEGIN ? "B" : "E";
+            break;
+        }
+        default:
+            break;
+    }
+
+    serial_printf(",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%s,\"pid\":0,\"tid\":%u",
+                  name, phase, ts, ev->cpu);
+    if (phase[0] == 'i') {
+        serial_writestring(",\"s\":\"t\"");
+    }
+    serial_printf(",\"args\":{\"arg0\":%u,\"arg1\":%u}}", ev->arg0, ev->arg1);
+}
+
+// Name each CPU's track, events carry the CPU as their thread id
+static void trace_write_json_cpu_names(int cpus) {
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        serial_printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                      "\"args\":{\"name\":\"CPU %d\"}}", cpu ? ",\n" : "", cpu, cpu);
+    }
+}
+
+// Stream all buffers as a Chrome trace-format JSON object
+void trace_dump_json(void) {
+    bool was_enabled = trace_enabled;
+    trace_enabled = false;
+
+    uint32_t cycles_per_ms = trace_cycles_per_ms();
+    uint64_t base_tsc = trace_start_tsc;
+    int cpus = smp_cpus_online;
+
+    // Wall clock at the first timestamp (Unix time in microseconds), to
+    // line the trace up with host logs
+    char wall[24];
+    uint64_t since_start = div64_32((rdtsc() - base_tsc) * 1000, cycles_per_ms, NULL);
+    format_u64(wall, div64_32(ktime_get_real_ns(), 1000, NULL) - since_start);
+    serial_printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"wall_clock_start_us\":%s},", wall);
+    serial_writestring("\"traceEvents\":[\n");
+    trace_write_json_cpu_names(cpus);
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        const trace_buffer_t* buf = &trace_buffers[cpu];
+        uint32_t start;
+        uint32_t count = trace_window(buf, &start);
+        for (uint32_t i = 0; i < count; i++) {
+            const trace_event_t* ev = &buf->events[(start + i) & (TRACE_BUFFER_EVENTS - 1)];
+            trace_write_json_event(ev, base_tsc, cycles_per_ms);
+        }
+    }
+    serial_writestring("\n]}\n");
+
+    trace_enabled = was_enabled;
+}
+
+// Stream the raw rings: a header, then per CPU an event count and events
+void trace_dump_binary(void) {
+    bool was_enabled = trace_enabled;
+    trace_enabled = false;
+
+    uint32_t header[7] = {
+        TRACE_BINARY_MAGIC,
+        TRACE_BINARY_VERSION,
+        smp_cpus_online,
+        sizeof(trace_event_t),
+        trace_cycles_per_ms(),
+        (uint32_t)trace_start_tsc,
+        (uint32_t)(trace_start_tsc >> 32),
+    };
+    serial_write(header, sizeof(header));
+
+    for (int cpu = 0; cpu < (int)header[2]; cpu++) {
+        const trace_buffer_t* buf = &trace_buffers[cpu];
+        uint32_t start;
+        uint32_t count = trace_window(buf, &start);
+        serial_write(&count, sizeof(count));
+        for (uint32_t i = 0; i < count; i++) {
+            serial_write(&buf->events[(start + i) & (TRACE_BUFFER_EVENTS - 1)], sizeof(trace_event_t));
+        }
+    }
+
+    trace_enabled = was_enabled;
+}
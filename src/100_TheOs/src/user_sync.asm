@@ -0,0 +1,188 @@
+;
+; user_sync.asm -- Ring 3 mutexes and condition variables on futexes
+;                  (see include/usync.h), and the ring 3 half of the
+;                  futex benchmark.
+;
+; The mutex is the three-state futex mutex: 0 free, 1 held, 2 held and
+; possibly waited for. Only a lock that finds the mutex held sleeps in
+; SYS_FUTEX_WAIT, and only an unlock that finds it marked 2 calls
+; SYS_FUTEX_WAKE. Functions follow cdecl: eax, ecx and edx are
+; clobbered, int 0x80 clobbers eax only.
+
+; Must match syscall.h
+%define SYS_EXIT       3
+%define SYS_FUTEX_WAIT 4
+%define SYS_FUTEX_WAKE 5
+
+; ucond_t, must match usync.h
+%define UCOND_SEQ     0
+%define UCOND_WAITERS 4
+
+; Layout of usync_bench_data, must match syscall.c
+%define USYNC_MODE      0
+%define USYNC_ROUNDS    4
+%define USYNC_CYCLES_LO 8
+%define USYNC_CYCLES_HI 12
+
+section .user progbits alloc exec write align=4096
+
+; void umutex_lock(umutex_t* mutex)
+global umutex_lock
+umutex_lock:
+    mov edx, [esp + 4]
+    xor eax, eax
+    mov ecx, 1
+    lock cmpxchg [edx], ecx  ; free -> held, the whole uncontended path
+    jnz .contended
+    ret
+.contended:
+    push ebx
+    push esi
+    mov ebx, edx             ; futex address
+    mov esi, 2               ; sleep while the word is 2
+    cmp eax, 2
+    je .wait
+.mark:
+    mov eax, 2
+    xchg [ebx], eax          ; mark it waited for; if it was free, ours now
+    test eax, eax
+    jz .done
+.wait:
+    mov eax, SYS_FUTEX_WAIT
+    int 0x80
+    jmp .mark
+.done:
+    pop esi
+    pop ebx
+    ret
+
+; bool umutex_trylock(umutex_t* mutex)
+global umutex_trylock
+umutex_trylock:
+    mov edx, [esp + 4]
+    xor eax, eax
+    mov ecx, 1
+    lock cmpxchg [edx], ecx
+    sete al
+    movzx eax, al
+    ret
+
+; void umutex_unlock(umutex_t* mutex)
+global umutex_unlock
+umutex_unlock:
+    mov edx, [esp + 4]
+    lock dec dword [edx]     ; 1 -> 0 when nobody waited
+    jnz .wake
+    ret
+.wake:
+    mov dword [edx], 0
+    push ebx
+    push esi
+    mov ebx, edx
+    mov esi, 1               ; one waiter, it marks the mutex 2 again
+    mov eax, SYS_FUTEX_WAKE
+    int 0x80
+    pop esi
+    pop ebx
+    ret
+
+; void ucond_wait(ucond_t* cond, umutex_t* mutex)
+global ucond_wait
+ucond_wait:
+    push ebx
+    push esi
+    push edi
+    mov ebx, [esp + 16]      ; cond, its sequence is the futex
+    mov edi, [esp + 20]      ; mutex
+    lock inc dword [ebx + UCOND_WAITERS]
+    mov esi, [ebx + UCOND_SEQ]
+    push edi
+    call umutex_unlock
+    add esp, 4
+    mov eax, SYS_FUTEX_WAIT  ; returns at once if signalled since
+    int 0x80
+    lock dec dword [ebx + UCOND_WAITERS]
+
+    ; Take the mutex back marked 2: others woken with us may sleep on it
+.relock:
+    mov eax, 2
+    xchg [edi], eax
+    test eax, eax
+    jz .done
+    mov ebx, edi
+    mov esi, 2
+    mov eax, SYS_FUTEX_WAIT
+    int 0x80
+    jmp .relock
+.done:
+    pop edi
+    pop esi
+    pop ebx
+    ret
+
+; void ucond_signal(ucond_t* cond)
+global ucond_signal
+ucond_signal:
+    mov ecx, 1
+    jmp ucond_wake
+
+; void ucond_broadcast(ucond_t* cond)
+global ucond_broadcast
+ucond_broadcast:
+    mov ecx, 0x7FFFFFFF
+
+ucond_wake:
+    mov edx, [esp + 4]
+    lock inc dword [edx + UCOND_SEQ]
+    cmp dword [edx + UCOND_WAITERS], 0
+    je .done
+    push ebx
+    push esi
+    mov ebx, edx
+    mov esi, ecx
+    mov eax, SYS_FUTEX_WAKE
+    int 0x80
+    pop esi
+    pop ebx
+.done:
+    ret
+
+; Parameters and results shared with futex_benchmark()
+align 4
+global usync_bench_data
+usync_bench_data:
+    dd 0                     ; mode: 0 = lock/unlock rounds, 1 = one contended lock
+    dd 0                     ; rounds
+    dd 0, 0                  ; cycles
+
+global usync_bench_mutex
+usync_bench_mutex:
+    dd 0
+
+; Time the lock/unlock pairs, then exit
+global usync_bench_main
+usync_bench_main:
+    mov ebp, 1
+    cmp dword [usync_bench_data + USYNC_MODE], 0
+    jne .start
+    mov ebp, [usync_bench_data + USYNC_ROUNDS]
+.start:
+    rdtsc
+    mov esi, eax
+    mov edi, edx
+    push usync_bench_mutex
+.loop:
+    call umutex_lock
+    call umutex_unlock
+    dec ebp
+    jnz .loop
+    add esp, 4
+
+    rdtsc
+    sub eax, esi
+    sbb edx, edi
+    mov [usync_bench_data + USYNC_CYCLES_LO], eax
+    mov [usync_bench_data + USYNC_CYCLES_HI], edx
+    mov eax, SYS_EXIT
+    xor ebx, ebx
+    int 0x80
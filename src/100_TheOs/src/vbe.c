@@ -0,0 +1,139 @@
+// vbe.c -- Bochs/QEMU VBE (DISPI) graphics driver with page flipping.
+
+#include "vbe.h"
+#include "pci.h"
+#include "common.h"
+#include "memory/memory.h"
+#include "log.h"
+
+// Keep the pages clear of the first 256KB of video memory, which holds
+// the legacy VGA planes (text and font) we return to afterwards
+#define VBE_LEGACY_RESERVE (256 * 1024)
+
+static bool vbe_ok = false;
+static uint32_t lfb_phys = 0;
+static uint32_t vram_size = 0;
+static vbe_mode_t mode;
+static bool mode_active = false;
+
+// Registers saved by vbe_set_mode() so the previous mode can come back
+static uint16_t saved_regs[VBE_DISPI_INDEX_Y_OFFSET + 1];
+
+static void vbe_write(uint16_t index, uint16_t value)
+{
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    outw(VBE_DISPI_IOPORT_DATA, value);
+}
+
+static uint16_t vbe_read(uint16_t index)
+{
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    return inw(VBE_DISPI_IOPORT_DATA);
+}
+
+bool vbe_init(void)
+{
+    if (vbe_ok) return true;
+
+    uint16_t id = vbe_read(VBE_DISPI_INDEX_ID);
+    if (id < VBE_DISPI_ID2 || id > 0xB0CF) {
+        return false;
+    }
+
+    pci_device_t dev;
+    if (!pci_find_device(VBE_PCI_VENDOR, VBE_PCI_DEVICE, &dev)) {
+        return false;
+    }
+    lfb_phys = pci_bar_address(&dev, 0);
+
+    // Newer versions report the video memory size, older ones have 4MB
+    vram_size = id >= 0xB0C3 ? vbe_read(VBE_DISPI_INDEX_VIDEO_MEMORY_64K) * 65536 : 4 * 1024 * 1024;
+    if (vram_size == 0) vram_size = 4 * 1024 * 1024;
+
+    paging_map_mmio(lfb_phys, vram_size);
+
+    LOG_INFO("vbe", "Bochs VBE id 0x%x, LFB 0x%x, %d KB\n", id, lfb_phys, vram_size / 1024);
+    vbe_ok = true;
+    return true;
+}
+
+bool vbe_present(void)
+{
+    return vbe_ok;
+}
+
+bool vbe_set_mode(uint32_t width, uint32_t height)
+{
+    if (!vbe_ok) return false;
+
+    uint32_t pitch_bytes = width * 4;
+    uint32_t reserve_rows = (VBE_LEGACY_RESERVE + pitch_bytes - 1) / pitch_bytes;
+    uint32_t virt_height = reserve_rows + 2 * height;
+    if (virt_height * pitch_bytes > vram_size) {
+        LOG_WARN("vbe", "%dx%d double buffered does not fit in video memory\n", width, height);
+        return false;
+    }
+
+    if (!mode_active) {
+        for (int i = VBE_DISPI_INDEX_XRES; i <= VBE_DISPI_INDEX_Y_OFFSET; i++) {
+            saved_regs[i] = vbe_read(i);
+        }
+    }
+
+    vbe_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    vbe_write(VBE_DISPI_INDEX_XRES, width);
+    vbe_write(VBE_DISPI_INDEX_YRES, height);
+    vbe_write(VBE_DISPI_INDEX_BPP, 32);
+    vbe_write(VBE_DISPI_INDEX_VIRT_WIDTH, width);
+    vbe_write(VBE_DISPI_INDEX_VIRT_HEIGHT, virt_height);
+    vbe_write(VBE_DISPI_INDEX_X_OFFSET, 0);
+    vbe_write(VBE_DISPI_INDEX_Y_OFFSET, reserve_rows);
+    vbe_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED | VBE_DISPI_NOCLEARMEM);
+
+    mode.lfb = (uint32_t*)lfb_phys;
+    mode.width = width;
+    mode.height = height;
+    mode.pitch = vbe_read(VBE_DISPI_INDEX_VIRT_WIDTH);
+    mode.page_rows[0] = reserve_rows;
+    mode.page_rows[1] = reserve_rows + height;
+    mode.front = 0;
+    mode_active = true;
+    return true;
+}
+
+void vbe_restore_mode(void)
+{
+    if (!mode_active) return;
+
+    vbe_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    if (saved_regs[VBE_DISPI_INDEX_ENABLE] & VBE_DISPI_ENABLED) {
+        // A framebuffer console was already in graphics mode
+        for (int i = VBE_DISPI_INDEX_XRES; i <= VBE_DISPI_INDEX_Y_OFFSET; i++) {
+            if (i == VBE_DISPI_INDEX_ENABLE || i == VBE_DISPI_INDEX_BANK) continue;
+            vbe_write(i, saved_regs[i]);
+        }
+        vbe_write(VBE_DISPI_INDEX_ENABLE, saved_regs[VBE_DISPI_INDEX_ENABLE] | VBE_DISPI_NOCLEARMEM);
+    }
+    mode_active = false;
+}
+
+const vbe_mode_t* vbe_get_mode(void)
+{
+    return mode_active ? &mode : NULL;
+}
+
+uint32_t* vbe_back_buffer(void)
+{
+    return mode.lfb + mode.page_rows[mode.front ^ 1] * mode.pitch;
+}
+
+uint32_t* vbe_front_buffer(void)
+{
+    return mode.lfb + mode.page_rows[mode.front] * mode.pitch;
+}
+
+void vbe_flip(void)
+{
+    mode.front ^= 1;
+    vbe_write(VBE_DISPI_INDEX_Y_OFFSET, mode.page_rows[mode.front]);
+}
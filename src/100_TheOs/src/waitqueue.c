@@ -0,0 +1,153 @@
+// waitqueue.c -- Sleeping on events.
+//
+// A wait queue is a FIFO of blocked threads behind a spinlock. Waking
+// takes threads off it and hands them to thread_wake(), which puts them
+// back on a run queue. The queue lock is held across thread_wake(), so
+// a waiter that takes the lock afterwards knows its wakeup is complete.
+
+#include "waitqueue.h"
+#include "libc/stddef.h"
+
+void wait_queue_init(wait_queue_t* wq, const char* name)
+{
+    spin_lock_init(&wq->lock, name);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+// Queue lock held for these three
+static void wait_enqueue(wait_queue_t* wq, thread_t* t)
+{
+    t->wait_next = NULL;
+    t->wait_queue = wq;
+    if (wq->tail) {
+        wq->tail->wait_next = t;
+    } else {
+        wq->head = t;
+    }
+    wq->tail = t;
+}
+
+static void wait_remove(wait_queue_t* wq, thread_t* t)
+{
+    thread_t* before = NULL;
+    for (thread_t* w = wq->head; w; before = w, w = w->wait_next) {
+        if (w != t) continue;
+        if (before) {
+            before->wait_next = t->wait_next;
+        } else {
+            wq->head = t->wait_next;
+        }
+        if (wq->tail == t) wq->tail = before;
+        break;
+    }
+    t->wait_next = NULL;
+    t->wait_queue = NULL;
+}
+
+static uint32_t wake_locked(wait_queue_t* wq, uint32_t n)
+{
+    uint32_t woken = 0;
+    while (wq->head && woken < n) {
+        thread_t* t = wq->head;
+        wq->head = t->wait_next;
+        if (!wq->head) wq->tail = NULL;
+        t->wait_next = NULL;
+        t->wait_queue = NULL;
+        thread_wake(t);
+        woken++;
+    }
+    return woken;
+}
+
+uint32_t wait_prepare_key(wait_queue_t* wq, uint32_t key)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    thread_t* self = thread_current();
+    wait_enqueue(wq, self);
+    self->wait_key = key;
+    self->state = THREAD_BLOCKED;
+    spin_unlock(&wq->lock);
+    return flags;
+}
+
+uint32_t wait_prepare(wait_queue_t* wq)
+{
+    return wait_prepare_key(wq, 0);
+}
+
+void wait_finish(wait_queue_t* wq, uint32_t flags)
+{
+    spin_lock(&wq->lock);
+    thread_t* self = thread_current();
+    // Still queued when the condition came true before anyone woke us
+    if (self->wait_queue == wq) {
+        wait_remove(wq, self);
+    }
+    self->state = THREAD_RUNNING;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+uint32_t wake_up_nr(wait_queue_t* wq, uint32_t n)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    uint32_t woken = wake_locked(wq, n);
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+uint32_t wake_up_key(wait_queue_t* wq, uint32_t key, uint32_t n)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    uint32_t woken = 0;
+    thread_t* t = wq->head;
+    while (t && woken < n) {
+        thread_t* next = t->wait_next;
+        if (t->wait_key == key) {
+            wait_remove(wq, t);
+            thread_wake(t);
+            woken++;
+        }
+        t = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+uint32_t wake_up(wait_queue_t* wq)
+{
+    return wake_up_nr(wq, 1);
+}
+
+uint32_t wake_up_all(wait_queue_t* wq)
+{
+    return wake_up_nr(wq, THREAD_MAX);
+}
+
+void completion_init(completion_t* c, const char* name)
+{
+    wait_queue_init(&c->wait, name);
+    c->done = false;
+}
+
+void complete(completion_t* c)
+{
+    uint32_t flags = spin_lock_irqsave(&c->wait.lock);
+    c->done = true;
+    wake_locked(&c->wait, THREAD_MAX);
+    spin_unlock_irqrestore(&c->wait.lock, flags);
+}
+
+void wait_for_completion(completion_t* c)
+{
+    thread_t* self = thread_current();
+    uint32_t flags = spin_lock_irqsave(&c->wait.lock);
+    while (!c->done) {
+        wait_enqueue(&c->wait, self);
+        self->state = THREAD_BLOCKED;
+        spin_unlock(&c->wait.lock);
+        sched_block();
+        spin_lock(&c->wait.lock);
+    }
+    spin_unlock_irqrestore(&c->wait.lock, flags);
+}
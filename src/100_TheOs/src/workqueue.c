@@ -0,0 +1,88 @@
+// workqueue.c -- Deferred work, run outside interrupt context.
+//
+// Interrupt handlers do the minimum (read the device, queue an item) and
+// return. The kernel worker runs the items later with interrupts enabled,
+// so a slow item never delays the iret of the interrupt that queued it.
+// With nothing queued the worker blocks on work_wait.
+
+#include "workqueue.h"
+#include "thread.h"
+#include "spinlock.h"
+#include "waitqueue.h"
+#include "log.h"
+
+typedef struct {
+    work_fn_t fn;
+    void* data;
+} work_item_t;
+
+static work_item_t items[WORK_QUEUE_SIZE];
+static volatile uint32_t work_head = 0;  // Next slot to fill, written by producers
+static volatile uint32_t work_tail = 0;  // Next slot to run, written by the worker
+
+uint32_t work_dropped = 0;
+
+static wait_queue_t work_wait = WAIT_QUEUE_INIT("workqueue-wait");
+
+// Producers on any CPU, or interrupting each other, serialize on the
+// lock. There is only one consumer and it does not need it.
+static spinlock_t work_lock = SPINLOCK_INIT("workqueue");
+
+bool work_queue(work_fn_t fn, void* data)
+{
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+
+    bool queued = false;
+    if (work_head - work_tail < WORK_QUEUE_SIZE) {
+        items[work_head & (WORK_QUEUE_SIZE - 1)] = (work_item_t){ fn, data };
+        smp_wmb();
+        work_head++;
+        queued = true;
+    } else {
+        work_dropped++;
+    }
+
+    spin_unlock_irqrestore(&work_lock, flags);
+
+    if (queued) {
+        wake_up(&work_wait);
+    }
+    return queued;
+}
+
+bool work_pending(void)
+{
+    return work_head != work_tail;
+}
+
+void work_run_pending(void)
+{
+    while (work_tail != work_head) {
+        work_item_t item = items[work_tail & (WORK_QUEUE_SIZE - 1)];
+        asm volatile("" ::: "memory");
+        work_tail++;
+
+        asm volatile("sti");
+        item.fn(item.data);
+    }
+}
+
+void work_worker_loop(void)
+{
+    uint32_t dropped_seen = 0;
+    while (1) {
+        work_run_pending();
+
+        // Reported here rather than in work_queue(), which may run in an
+        // interrupt handler
+        uint32_t dropped = work_dropped;
+        if (dropped != dropped_seen) {
+            LOG_WARN("workqueue", "%u items dropped, queue full\n", dropped - dropped_seen);
+            dropped_seen = dropped;
+        }
+
+        // Other threads, or CPU 0's idle thread, get the CPU until
+        // work_queue() wakes us
+        wait_event(&work_wait, work_pending());
+    }
+}